@@ -2,11 +2,15 @@
 #include <igloo/viewers/test_viewer.hpp>
 #include <igloo/records/image.hpp>
 #include <igloo/surfaces/sphere.hpp>
+#include <igloo/surfaces/sphere_set.hpp>
 #include <igloo/surfaces/mesh.hpp>
+#include <igloo/surfaces/paged_mesh.hpp>
+#include <igloo/surfaces/instance.hpp>
 #include <igloo/renderers/debug_renderer.hpp>
 #include <igloo/renderers/direct_lighting_renderer.hpp>
 #include <igloo/renderers/path_tracing_renderer.hpp>
 #include <iostream>
+#include <fstream>
 #include <cmath>
 #include <algorithm>
 #include <cstdlib>
@@ -77,11 +81,64 @@ context::attributes_map context::default_attributes()
     {"record:width",  "512"},
     {"record:height", "512"},
     {"orientation", "outside"},
-    {"renderer", "direct_lighting"}
+    {"renderer", "direct_lighting"},
+    {"renderer:threads", "0"},
+    {"path_tracing:max_path_length", "10"},
+    {"path_tracing:roulette_path_length", "5"},
+    {"path_tracing:roulette_min_survival", "0.05"},
+    {"path_tracing:paths_per_pixel", "20"},
+    {"path_tracing:paths_per_pass", "4"},
+    {"path_tracing:relative_error", "0"},
+    {"path_tracing:min_paths_per_pixel", "8"},
+    {"path_tracing:max_paths_per_pixel", "256"},
+    {"path_tracing:time_limit", "0"},
+    {"path_tracing:path_count_map", ""},
+    {"statistics", "false"},
+    {"mesh:hierarchy", "median"},
+    {"mesh:hierarchy_bins", "16"},
+    {"mesh:hierarchy_max_leaf_size", "4"},
+    {"mesh:hierarchy_traversal_cost", "1"},
+    {"mesh:hierarchy_width", "2"},
+    {"mesh:hierarchy_threads", "0"},
+    {"mesh:hierarchy_quantization", "0"},
+    {"mesh:hierarchy_rebuild_threshold", "1.5"},
+    {"mesh:hierarchy_spatial_threshold", "1e-5"},
+    {"mesh:hierarchy_max_reference_growth", "0.3"},
+    {"mesh:hierarchy_cache", ""},
+    {"mesh:precompute_triangles", "false"},
+    {"mesh:paging_budget", "1024"}
   };
 } // end context::default_attributes()
 
 
+std::size_t context::count_attribute(const attributes_map &attributes, const std::string &name)
+{
+  const std::string& value = attributes.at(name);
+
+  // std::stoul negates a leading minus sign, which would wrap a negative count around, so reject one before parsing
+  std::size_t length = 0;
+  unsigned long result = 0;
+  if(value.find('-') == std::string::npos)
+  {
+    try
+    {
+      result = std::stoul(value, &length);
+    }
+    catch(const std::exception&)
+    {
+      length = 0;
+    }
+  }
+
+  if(length == 0 || length != value.size())
+  {
+    throw std::runtime_error("context::count_attribute(): " + name + " must be a nonnegative integer, not \"" + value + "\"");
+  }
+
+  return result;
+} // end context::count_attribute()
+
+
 void context::translate(float tx, float ty, float tz)
 {
   mult_matrix_(transform::translate(tx,ty,tz));
@@ -113,33 +170,312 @@ void context::material(std::unique_ptr<igloo::material>&& m, const std::string n
 }
 
 
-void context::surface(std::unique_ptr<igloo::surface>&& surf)
+scene::handle context::surface(std::unique_ptr<igloo::surface>&& surf)
+{
+  if(!m_current_prototype.empty())
+  {
+    m_prototypes[m_current_prototype].emplace_back(std::move(surf));
+    return scene::null_handle;
+  }
+
+  return m_scene.add_surface(std::move(surf), current_material());
+}
+
+
+void context::begin_prototype(const std::string &name)
+{
+  if(!m_current_prototype.empty())
+  {
+    throw std::logic_error("context::begin_prototype(): prototype definitions may not be nested");
+  }
+
+  if(name.empty())
+  {
+    throw std::logic_error("context::begin_prototype(): name must not be empty");
+  }
+
+  if(m_prototypes.count(name) > 0)
+  {
+    throw std::runtime_error("context::begin_prototype(): duplicate prototype name");
+  }
+
+  m_prototypes[name];
+  m_current_prototype = name;
+} // end context::begin_prototype()
+
+
+void context::end_prototype()
+{
+  if(m_current_prototype.empty())
+  {
+    throw std::logic_error("context::end_prototype(): no prototype is being defined");
+  }
+
+  m_current_prototype.clear();
+} // end context::end_prototype()
+
+
+std::vector<scene::handle> context::instance(const std::string &name)
+{
+  auto iter = m_prototypes.find(name);
+  if(iter == m_prototypes.end())
+  {
+    std::string what = "context::instance(): prototype \"" + name + "\" not found";
+    throw std::runtime_error(what);
+  }
+
+  if(name == m_current_prototype)
+  {
+    throw std::logic_error("context::instance(): a prototype may not instance itself");
+  }
+
+  std::vector<scene::handle> result;
+  for(const auto& prototype : iter->second)
+  {
+    result.push_back(surface(std::make_unique<igloo::instance>(prototype, m_transform_stack.top())));
+  }
+
+  return result;
+} // end context::instance()
+
+
+const igloo::material& context::current_material() const
 {
   std::string material_name = m_attributes_stack.top().at("material");
 
   auto iter = m_materials.find(material_name);
   if(iter == m_materials.end())
   {
-    std::string what = "context::surface(): material \"" + material_name + "\" not found";
+    std::string what = "context::current_material(): material \"" + material_name + "\" not found";
     throw std::runtime_error(what);
   }
 
-  const igloo::material& m = *iter->second;
+  return *iter->second;
+} // end context::current_material()
 
-  m_scene.emplace_back(std::move(surf), m);
-}
+
+void context::remove_surface(scene::handle h)
+{
+  m_scene.remove_surface(h);
+} // end context::remove_surface()
+
+
+void context::transform_surface(scene::handle h)
+{
+  m_scene.transform_surface(h, m_transform_stack.top());
+} // end context::transform_surface()
 
 
-void context::sphere(float cx, float cy, float cz, float radius)
+void context::update_points(scene::handle h, array_ref<const float> vertices_)
+{
+  if(vertices_.size() % 3 > 0)
+  {
+    throw std::logic_error("context::update_points(): vertices.size() must be a multiple of 3");
+  } // end if
+
+  std::vector<point> vertices(reinterpret_cast<const point*>(vertices_.data()),
+                              reinterpret_cast<const point*>(vertices_.data() + vertices_.size()));
+
+  std::transform(vertices.begin(), vertices.end(), vertices.begin(), [&](const point &p)
+  {
+    return m_transform_stack.top()(p);
+  });
+
+  m_scene.update_points(h, vertices);
+} // end context::update_points()
+
+
+void context::update_points(scene::handle h, array_ref<const float> vertices_, array_ref<const float> normals_)
+{
+  if(vertices_.size() % 3 > 0)
+  {
+    throw std::logic_error("context::update_points(): vertices.size() must be a multiple of 3");
+  } // end if
+
+  if(normals_.size() != vertices_.size())
+  {
+    throw std::logic_error("context::update_points(): normals.size() must equal vertices.size()");
+  } // end if
+
+  std::vector<point> vertices(reinterpret_cast<const point*>(vertices_.data()),
+                              reinterpret_cast<const point*>(vertices_.data() + vertices_.size()));
+  std::vector<normal> normals(reinterpret_cast<const normal*>(normals_.data()),
+                              reinterpret_cast<const normal*>(normals_.data() + normals_.size()));
+
+  std::transform(vertices.begin(), vertices.end(), vertices.begin(), [&](const point &p)
+  {
+    return m_transform_stack.top()(p);
+  });
+
+  std::transform(normals.begin(), normals.end(), normals.begin(), [&](const normal &n)
+  {
+    return m_transform_stack.top()(n);
+  });
+
+  m_scene.update_points(h, vertices, normals);
+} // end context::update_points()
+
+
+void context::bind_material(scene::handle h)
+{
+  m_scene.bind_material(h, current_material());
+} // end context::bind_material()
+
+
+bounding_volume_hierarchy_options context::hierarchy_options() const
+{
+  const attributes_map& attributes = m_attributes_stack.top();
+
+  bounding_volume_hierarchy_options result;
+
+  std::string method = attributes.at("mesh:hierarchy");
+  if(method == "median")
+  {
+    result.method = bounding_volume_hierarchy_options::split_method::median;
+  }
+  else if(method == "sah")
+  {
+    result.method = bounding_volume_hierarchy_options::split_method::binned_sah;
+  }
+  else if(method == "spatial")
+  {
+    result.method = bounding_volume_hierarchy_options::split_method::spatial;
+  }
+  else
+  {
+    std::string what = "context::hierarchy_options(): unknown mesh:hierarchy \"" + method + "\"";
+    throw std::runtime_error(what);
+  }
+
+  result.num_bins       = count_attribute(attributes, "mesh:hierarchy_bins");
+  result.max_leaf_size  = count_attribute(attributes, "mesh:hierarchy_max_leaf_size");
+  result.traversal_cost = std::atof(attributes.at("mesh:hierarchy_traversal_cost").c_str());
+  result.width          = count_attribute(attributes, "mesh:hierarchy_width");
+  result.num_threads    = count_attribute(attributes, "mesh:hierarchy_threads");
+  result.quantization_bits = count_attribute(attributes, "mesh:hierarchy_quantization");
+  result.rebuild_threshold = std::atof(attributes.at("mesh:hierarchy_rebuild_threshold").c_str());
+  result.spatial_split_threshold = std::atof(attributes.at("mesh:hierarchy_spatial_threshold").c_str());
+  result.max_reference_growth = std::atof(attributes.at("mesh:hierarchy_max_reference_growth").c_str());
+  result.cache_directory = attributes.at("mesh:hierarchy_cache");
+  result.precompute_leaves = attributes.at("mesh:precompute_triangles") == "true";
+
+  if(result.width != 2 && result.width != 4 && result.width != 8)
+  {
+    throw std::runtime_error("context::hierarchy_options(): mesh:hierarchy_width must be 2, 4, or 8");
+  }
+
+  if(result.quantization_bits != 0 && result.quantization_bits != 8 && result.quantization_bits != 16)
+  {
+    throw std::runtime_error("context::hierarchy_options(): mesh:hierarchy_quantization must be 0, 8, or 16");
+  }
+
+  if(result.quantization_bits != 0 && result.width == 2)
+  {
+    throw std::runtime_error("context::hierarchy_options(): mesh:hierarchy_quantization requires mesh:hierarchy_width of 4 or 8");
+  }
+
+  return result;
+} // end context::hierarchy_options()
+
+
+path_tracing_options context::path_tracer_options() const
+{
+  const attributes_map& attributes = m_attributes_stack.top();
+
+  path_tracing_options result;
+
+  result.max_path_length = count_attribute(attributes, "path_tracing:max_path_length");
+  result.roulette_path_length  = count_attribute(attributes, "path_tracing:roulette_path_length");
+  result.roulette_min_survival = std::atof(attributes.at("path_tracing:roulette_min_survival").c_str());
+  result.paths_per_pixel = count_attribute(attributes, "path_tracing:paths_per_pixel");
+  result.paths_per_pass  = count_attribute(attributes, "path_tracing:paths_per_pass");
+  result.relative_error  = std::atof(attributes.at("path_tracing:relative_error").c_str());
+  result.min_paths_per_pixel = count_attribute(attributes, "path_tracing:min_paths_per_pixel");
+  result.max_paths_per_pixel = count_attribute(attributes, "path_tracing:max_paths_per_pixel");
+  result.time_limit      = std::atof(attributes.at("path_tracing:time_limit").c_str());
+  result.num_threads     = count_attribute(attributes, "renderer:threads");
+
+  return result;
+} // end context::path_tracer_options()
+
+
+scene::handle context::mesh_(std::unique_ptr<igloo::mesh>&& m)
+{
+  if(m_attributes_stack.top()["statistics"] == "true")
+  {
+    // the binary hierarchy keeps only the record of its construction once collapsed into a wide one, so describe the traversed one
+    m->with_traversed_hierarchy([&](const auto& hierarchy)
+    {
+      std::clog << "context::mesh(): hierarchy over " << m->hierarchy().size() << " triangles has "
+                << hierarchy.nodes().size() << " nodes, " << hierarchy.elements().size() << " triangle references, and SAH cost "
+                << hierarchy.sah_cost() << std::endl;
+    });
+
+    double seconds = m->hierarchy().build_time();
+    double millions = m->hierarchy().size() / 1000000.0;
+    if(m->hierarchy().is_mapped())
+    {
+      std::clog << "context::mesh(): mapped from cache in " << seconds << " s";
+    }
+    else
+    {
+      std::clog << "context::mesh(): built in " << seconds << " s using " << m->hierarchy().options().num_threads << " threads";
+    }
+
+    if(millions > 0)
+    {
+      std::clog << " (" << seconds / millions << " s per million triangles)";
+    }
+    std::clog << std::endl;
+
+    std::clog << "context::mesh(): traversed hierarchy occupies " << m->traversed_hierarchy_memory_size() << " bytes" << std::endl;
+  }
+
+  return surface(std::move(m));
+} // end context::mesh_()
+
+
+scene::handle context::sphere(float cx, float cy, float cz, float radius)
 {
   // XXX should we scale the radius as well? not really clear how to do so
   point center = m_transform_stack.top()(point(cx,cy,cz));
 
-  surface(std::make_unique<igloo::sphere>(center, radius));
+  return surface(std::make_unique<igloo::sphere>(center, radius));
 } // end context::sphere()
 
 
-void context::mesh(array_ref<const float> vertices_,
+scene::handle context::spheres(array_ref<const float> centers_, array_ref<const float> radii_)
+{
+  if(centers_.size() % 3 > 0)
+  {
+    throw std::logic_error("context::spheres(): centers.size() must be a multiple of 3");
+  } // end if
+
+  if(radii_.size() != centers_.size() / 3)
+  {
+    throw std::logic_error("context::spheres(): radii.size() must equal centers.size() / 3");
+  } // end if
+
+  if(radii_.empty())
+  {
+    throw std::logic_error("context::spheres(): centers must not be empty");
+  } // end if
+
+  std::vector<point> centers(reinterpret_cast<const point*>(centers_.data()),
+                             reinterpret_cast<const point*>(centers_.data() + centers_.size()));
+  std::vector<float> radii(radii_.begin(), radii_.end());
+
+  // XXX like sphere(), this transforms centers but not radii
+  std::transform(centers.begin(), centers.end(), centers.begin(), [&](const point &p)
+  {
+    return m_transform_stack.top()(p);
+  });
+
+  return surface(std::make_unique<igloo::sphere_set>(centers, radii, hierarchy_options()));
+} // end context::spheres()
+
+
+scene::handle context::mesh(array_ref<const float> vertices_,
                    array_ref<const unsigned int> triangles_)
 {
   if(vertices_.size() % 3 > 0)
@@ -170,11 +506,11 @@ void context::mesh(array_ref<const float> vertices_,
     });
   } // end if
 
-  surface(std::make_unique<igloo::mesh>(vertices, triangles));
+  return mesh_(std::make_unique<igloo::mesh>(vertices, triangles, hierarchy_options()));
 } // end context::mesh()
 
 
-void context::mesh(array_ref<const float> vertices_,
+scene::handle context::mesh(array_ref<const float> vertices_,
                    array_ref<const float> parametrics_,
                    array_ref<const unsigned int> triangles_)
 {
@@ -219,11 +555,11 @@ void context::mesh(array_ref<const float> vertices_,
     });
   } // end if
 
-  surface(std::make_unique<igloo::mesh>(vertices, parametrics, triangles));
+  return mesh_(std::make_unique<igloo::mesh>(vertices, parametrics, triangles, hierarchy_options()));
 } // end context::mesh()
 
        
-void context::mesh(array_ref<const float> vertices_,
+scene::handle context::mesh(array_ref<const float> vertices_,
                    array_ref<const float> parametrics_,
                    array_ref<const float> normals_,
                    array_ref<const unsigned int> triangles_)
@@ -282,26 +618,66 @@ void context::mesh(array_ref<const float> vertices_,
     });
   } // end if
 
-  surface(std::make_unique<igloo::mesh>(vertices, parametrics, normals, triangles));
+  return mesh_(std::make_unique<igloo::mesh>(vertices, parametrics, normals, triangles, hierarchy_options()));
 } // end context::mesh()
 
 
+scene::handle context::paged_mesh(const std::string &filename)
+{
+  std::size_t budget = static_cast<std::size_t>(std::atof(m_attributes_stack.top()["mesh:paging_budget"].c_str()) * (1 << 20));
+
+  auto m = std::make_shared<const igloo::paged_mesh>(filename, budget, hierarchy_options());
+  m_paged_meshes.push_back(m);
+
+  if(m_attributes_stack.top()["statistics"] == "true")
+  {
+    std::clog << "context::paged_mesh(): " << m->size() << " triangles in " << m->num_clusters() << " clusters, with a budget of "
+              << budget << " bytes" << std::endl;
+  }
+
+  return surface(std::make_unique<igloo::instance>(m, m_transform_stack.top()));
+} // end context::paged_mesh()
+
+
+// writes the number of paths traced through each pixel as a binary PGM, scaled so that the greatest count is white
+static bool write_path_count_map(const std::string& filename, const array2<std::uint32_t>& counts)
+{
+  std::uint32_t max_count = std::max<std::uint32_t>(1, *std::max_element(counts.begin(), counts.end()));
+  std::uint32_t max_value = std::min<std::uint32_t>(max_count, 65535);
+
+  std::ofstream os(filename, std::ios::binary);
+  os << "P5\n" << counts.width() << " " << counts.height() << "\n" << max_value << "\n";
+
+  for(std::uint32_t count : counts)
+  {
+    std::uint32_t value = static_cast<std::uint32_t>(std::uint64_t(count) * max_value / max_count);
+
+    // samples wider than a byte are big-endian
+    if(max_value > 255) os.put(static_cast<char>(value >> 8));
+    os.put(static_cast<char>(value & 255));
+  }
+
+  return static_cast<bool>(os);
+} // end write_path_count_map()
+
+
 // XXX should introduce a renderer factory into igloo/renderers
-static std::unique_ptr<renderer> make_renderer(const std::string& which_renderer, const scene& s, image& im)
+static std::unique_ptr<renderer> make_renderer(const std::string& which_renderer, const scene& s, image& im,
+                                               std::size_t num_threads, const path_tracing_options& options)
 {
   std::unique_ptr<renderer> result;
 
   if(which_renderer == "debug")
   {
-    result = std::make_unique<debug_renderer>(s, im);
+    result = std::make_unique<debug_renderer>(s, im, num_threads);
   }
   else if(which_renderer == "direct_lighting")
   {
-    result = std::make_unique<direct_lighting_renderer>(s, im);
+    result = std::make_unique<direct_lighting_renderer>(s, im, num_threads);
   }
   else if(which_renderer == "path_tracing")
   {
-    result = std::make_unique<path_tracing_renderer>(s, im);
+    result = std::make_unique<path_tracing_renderer>(s, im, options);
   }
 
   return result;
@@ -319,7 +695,11 @@ void context::render()
 
   progress_snapshot progress(im);
 
-  auto renderer = make_renderer(m_attributes_stack.top()["renderer"], m_scene, im);
+  m_scene.commit();
+
+  std::size_t num_threads = count_attribute(m_attributes_stack.top(), "renderer:threads");
+
+  auto renderer = make_renderer(m_attributes_stack.top()["renderer"], m_scene, im, num_threads, path_tracer_options());
 
   auto render_task = std::async(std::launch::async, [&]
   {
@@ -332,6 +712,34 @@ void context::render()
     double seconds = double(duration_cast<milliseconds>(elapsed).count()) / 1000;
 
     std::cout << "Render time: " << seconds << "s" << std::endl;
+
+    if(m_attributes_stack.top()["statistics"] == "true")
+    {
+      renderer->print_statistics(std::clog);
+
+      for(const auto& weak : m_paged_meshes)
+      {
+        if(auto m = weak.lock())
+        {
+          igloo::paged_mesh::cache_statistics stats = m->statistics();
+          std::uint64_t requests = stats.hits + stats.misses;
+
+          std::clog << "context::render(): paged mesh cache hits " << stats.hits << ", misses " << stats.misses
+                    << " (hit rate " << (requests ? double(stats.hits) / requests : 0.0) << "), evictions " << stats.evictions
+                    << ", peak resident bytes " << stats.peak_resident_bytes << std::endl;
+        }
+      }
+    }
+
+    const std::string& path_count_map = m_attributes_stack.top()["path_tracing:path_count_map"];
+    if(!path_count_map.empty())
+    {
+      auto path_tracer = dynamic_cast<const path_tracing_renderer*>(renderer.get());
+      if(path_tracer && !write_path_count_map(path_count_map, path_tracer->path_counts()))
+      {
+        std::cerr << "context::render(): couldn't write path_tracing:path_count_map \"" << path_count_map << "\"" << std::endl;
+      }
+    }
   });
 
   test_viewer v(progress, m_scene, m);
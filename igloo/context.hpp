@@ -4,15 +4,22 @@
 #include <stack>
 #include <string>
 #include <map>
+#include <memory>
 #include <igloo/utility/array_ref.hpp>
 #include <igloo/primitives/scene.hpp>
 #include <igloo/primitives/surface_primitive.hpp>
 #include <igloo/geometry/transform.hpp>
+#include <igloo/geometry/bounding_volume_hierarchy.hpp>
+#include <igloo/renderers/path_tracing_renderer.hpp>
 
 namespace igloo
 {
 
 
+class mesh;
+class paged_mesh;
+
+
 class context
 {
   public:
@@ -75,21 +82,32 @@ class context
      *  \param cy The y-coordinate of the center of the Sphere.
      *  \param cz The z-coordinate of the center of the Sphere.
      *  \param radius The radius of the Sphere.
+     *  \return A handle to the new surface, or scene::null_handle within a prototype definition.
+     */
+    scene::handle sphere(float cx, float cy, float cz, float radius);
+
+    /*! Creates a new set of spheres, which is a single surface sharing a single hierarchy.
+     *  This is far more compact than a sphere per call to sphere() when there are very many spheres.
+     *  \param centers An array of sphere centers, which must not be empty; centers.size() must be a multiple of 3.
+     *  \param radii An array of sphere radii; radii.size() must equal centers.size() / 3.
+     *  \return A handle to the new surface, or scene::null_handle within a prototype definition.
      */
-    void sphere(float cx, float cy, float cz, float radius);
+    scene::handle spheres(array_ref<const float> centers, array_ref<const float> radii);
 
     /*! Creates a new mesh.
      *  \param vertices An array of triangle vertices; size must be a multiple of 3.
      *  \param triangles An array of vertex index triples; size must be a multiple of 3.
+     *  \return A handle to the new surface, or scene::null_handle within a prototype definition.
      */
-    void mesh(array_ref<const float> vertices, array_ref<const unsigned int> triangles);
+    scene::handle mesh(array_ref<const float> vertices, array_ref<const unsigned int> triangles);
 
     /*! Creates a new mesh.
      *  \param vertices An array of triangle vertices; vertices.size() must be a multiple of 3.
      *  \param parametrics An array of parametric triangle vertex positions; parametrics.size() must be a multiple of 2; parametrics.size() / 2 must equal size of vertices.size() / 3.
      *  \param triangles An array of vertex index triples; triangles.size() must be a multiple of 3.
+     *  \return A handle to the new surface, or scene::null_handle within a prototype definition.
      */
-    void mesh(array_ref<const float> vertices,
+    scene::handle mesh(array_ref<const float> vertices,
               array_ref<const float> parametrics,
               array_ref<const unsigned int> triangles);
 
@@ -98,12 +116,69 @@ class context
      *  \param parametrics An array of parametric triangle vertex positions; parametric.size() must be a multiple of 2; parametrics.size() / 2 must equal size of vertices.size() / 3.
      *  \param normals An array of vertex normals; normals.size() must equal vertices.size().
      *  \param triangles An array of vertex index triples; triangles.size() must be a multiple of 3.
+     *  \return A handle to the new surface, or scene::null_handle within a prototype definition.
      */
-    void mesh(array_ref<const float> vertices,
+    scene::handle mesh(array_ref<const float> vertices,
               array_ref<const float> parametrics,
               array_ref<const float> normals,
               array_ref<const unsigned int> triangles);
 
+    /*! Creates a new mesh paged from a file written by paged_mesh::write(), for meshes too large to keep in memory.
+     *  Its clusters are cached within the budget given by the mesh:paging_budget attribute, in megabytes,
+     *  and the mesh is placed by the top of the matrix stack.
+     *  \param filename The name of the file.
+     *  \return A handle to the new surface, or scene::null_handle within a prototype definition.
+     */
+    scene::handle paged_mesh(const std::string &filename);
+
+    /*! Begins the definition of a prototype, which may be instanced many times with instance().
+     *  Until end_prototype(), created surfaces are added to the prototype rather than to the scene.
+     *  Their vertices are transformed by the matrix stack as usual, into the prototype's object space.
+     *  \param name The name of the prototype.
+     */
+    void begin_prototype(const std::string &name);
+
+    /*! Ends the definition of the prototype begun by begin_prototype().
+     */
+    void end_prototype();
+
+    /*! Creates an instance of each surface of a prototype, sharing the prototype's geometry.
+     *  The instances are transformed from the prototype's object space by the top of the matrix stack,
+     *  and take the current material.
+     *  \param name The name of a prototype defined with begin_prototype().
+     *  \return Handles to the new instances, one per surface of the prototype.
+     */
+    std::vector<scene::handle> instance(const std::string &name);
+
+    /*! Removes a surface from the scene, e.g. between renders.
+     *  \param h A handle returned when the surface was created.
+     */
+    void remove_surface(scene::handle h);
+
+    /*! Moves a surface of the scene by the top of the matrix stack, applied after its current placement.
+     *  \param h A handle returned when the surface was created.
+     */
+    void transform_surface(scene::handle h);
+
+    /*! Moves the vertices of a mesh of the scene, keeping its triangles, e.g. between the frames of an animation.
+     *  The vertices are transformed by the top of the matrix stack, as when the mesh was created.
+     *  \param h A handle returned when the mesh was created.
+     *  \param vertices An array of triangle vertices; vertices.size() must equal the size of the array the mesh was created with.
+     */
+    void update_points(scene::handle h, array_ref<const float> vertices);
+
+    /*! Moves the vertices of a mesh of the scene and replaces its vertex normals, keeping its triangles.
+     *  \param h A handle returned when the mesh was created.
+     *  \param vertices An array of triangle vertices; vertices.size() must equal the size of the array the mesh was created with.
+     *  \param normals An array of vertex normals; normals.size() must equal vertices.size().
+     */
+    void update_points(scene::handle h, array_ref<const float> vertices, array_ref<const float> normals);
+
+    /*! Binds the current material to a surface of the scene.
+     *  \param h A handle returned when the surface was created.
+     */
+    void bind_material(scene::handle h);
+
     /*! Introduces a new material and sets the current material to track this newly created material.
      *  \param m A material to take ownership of.
      *  \param name The of the material.
@@ -115,7 +190,15 @@ class context
     void render();
 
   private:
-    void surface(std::unique_ptr<surface>&& surf);
+    scene::handle surface(std::unique_ptr<surface>&& surf);
+
+    scene::handle mesh_(std::unique_ptr<igloo::mesh>&& m);
+
+    const igloo::material& current_material() const;
+
+    bounding_volume_hierarchy_options hierarchy_options() const;
+
+    path_tracing_options path_tracer_options() const;
 
     scene m_scene;
 
@@ -126,10 +209,22 @@ class context
 
     static attributes_map default_attributes();
 
+    // parses the attribute of the given name as a count, throwing std::runtime_error unless it is a nonnegative integer
+    static std::size_t count_attribute(const attributes_map &attributes, const std::string &name);
+
     void mult_matrix_(const transform &xfrm);
 
     using materials_map = std::map<std::string, std::unique_ptr<igloo::material>>;
     materials_map m_materials;
+
+    using prototypes_map = std::map<std::string, std::vector<std::shared_ptr<const igloo::surface>>>;
+    prototypes_map m_prototypes;
+
+    // the paged meshes whose cache statistics render() reports
+    std::vector<std::weak_ptr<const igloo::paged_mesh>> m_paged_meshes;
+
+    // the name of the prototype being defined, if any
+    std::string m_current_prototype;
 }; // end context
 
 
@@ -1,13 +1,16 @@
 #pragma once
 
 #include <igloo/geometry/bounding_box.hpp>
+#include <igloo/geometry/bounding_volume_hierarchy.hpp>
 #include <igloo/geometry/differential_geometry.hpp>
 #include <igloo/geometry/normal.hpp>
 #include <igloo/geometry/parametric.hpp>
 #include <igloo/geometry/pi.hpp>
 #include <igloo/geometry/point.hpp>
+#include <igloo/geometry/precomputed_triangles.hpp>
 #include <igloo/geometry/ray.hpp>
 #include <igloo/geometry/transform.hpp>
 #include <igloo/geometry/triangle_mesh.hpp>
 #include <igloo/geometry/vector.hpp>
+#include <igloo/geometry/wide_bounding_volume_hierarchy.hpp>
 
@@ -99,6 +99,63 @@ class bounding_box : public std::array<point,2>
       return result;
     }
 
+    /// Expands this bounding_box to bound the given bounding_box.
+    void expand_to_bound(const bounding_box& other)
+    {
+      for(int i = 0; i < 3; ++i)
+      {
+        min()[i] = std::min(min()[i], other.min()[i]);
+        max()[i] = std::max(max()[i], other.max()[i]);
+      }
+    }
+
+    /// Expands this bounding_box to bound the given bounding_box.
+    bounding_box& operator+=(const bounding_box& other)
+    {
+      expand_to_bound(other);
+      return *this;
+    }
+
+    /// Returns a bounding_box bounding all the points bounded by this one as well as other.
+    bounding_box operator+(const bounding_box& other) const
+    {
+      bounding_box result = *this;
+      result += other;
+      return result;
+    }
+
+    /// Returns the bounding_box bounding the points bounded by both this bounding_box and other.
+    bounding_box overlap(const bounding_box& other) const
+    {
+      bounding_box result;
+
+      for(int i = 0; i < 3; ++i)
+      {
+        result.min()[i] = std::max(min()[i], other.min()[i]);
+        result.max()[i] = std::min(max()[i], other.max()[i]);
+      }
+
+      return result;
+    }
+
+    /// Returns true if this bounding_box bounds no points.
+    bool empty() const
+    {
+      return min()[0] > max()[0] || min()[1] > max()[1] || min()[2] > max()[2];
+    }
+
+    /// Returns the surface area of this bounding_box, or 0 if it is empty.
+    float surface_area() const
+    {
+      if(empty()) return 0.f;
+
+      float dx = max()[0] - min()[0];
+      float dy = max()[1] - min()[1];
+      float dz = max()[2] - min()[2];
+
+      return 2.f * (dx * dy + dy * dz + dz * dx);
+    }
+
     /// Returns true if the given point is bounded by this bounding_box.
     bool bounds(const point& x) const
     {
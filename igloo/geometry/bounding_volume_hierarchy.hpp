@@ -0,0 +1,1597 @@
+#pragma once
+
+#include <igloo/geometry/bounding_box.hpp>
+#include <igloo/geometry/point.hpp>
+#include <igloo/geometry/vector.hpp>
+#include <igloo/geometry/ray.hpp>
+#include <igloo/geometry/ray_packet.hpp>
+#include <igloo/geometry/ray_stream.hpp>
+#include <igloo/utility/array_ref.hpp>
+#include <igloo/utility/mapped_file.hpp>
+#include <igloo/utility/optional.hpp>
+#include <igloo/utility/hash.hpp>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <limits>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace igloo
+{
+
+
+/*! Parameters controlling the construction of a bounding_volume_hierarchy.
+ */
+struct bounding_volume_hierarchy_options
+{
+  enum class split_method
+  {
+    // split each node at the median element along its longest axis
+    median,
+
+    // split each node where the binned surface area heuristic estimates the lowest traversal cost
+    binned_sah,
+
+    // like binned_sah, but also consider splitting space rather than the set of elements,
+    // which references elements straddling a split plane from both children
+    // this reduces the overlap of children bounding long, thin elements, at the cost of memory and build time
+    spatial
+  };
+
+  split_method method = split_method::median;
+
+  // the number of bins the binned_sah and spatial methods evaluate along each axis
+  std::size_t num_bins = 16;
+
+  // the maximum number of elements in a leaf
+  std::size_t max_leaf_size = 4;
+
+  // the cost of traversing a node relative to the cost of intersecting an element
+  float traversal_cost = 1.f;
+
+  // the spatial method considers a spatial split of a node only when the children of its best object split
+  // overlap by more than this fraction of the root's surface area
+  float spatial_split_threshold = 1e-5f;
+
+  // the spatial method references at most this fraction of the elements more than once,
+  // which caps the growth of elements() and thus the memory of the hierarchy
+  float max_reference_growth = 0.3f;
+
+  // the number of children of each node traversed: 2 traverses the binary hierarchy directly,
+  // while 4 and 8 collapse it into a wide_bounding_volume_hierarchy
+  std::size_t width = 2;
+
+  // when width is 4 or 8, the number of bits to which each child bound of a wide node is quantized, 8 or 16,
+  // or 0 to store child bounds exactly
+  std::size_t quantization_bits = 0;
+
+  // refit() keeps a hierarchy's structure, which degrades as its elements move
+  // needs_rebuild() reports when a refit hierarchy's sah_cost() exceeds this multiple of its cost when built
+  float rebuild_threshold = 1.5f;
+
+  // the number of threads which may build the hierarchy concurrently; 0 uses every hardware thread
+  std::size_t num_threads = 0;
+
+  // whether the hierarchy's owner should store a precomputed copy of its elements' geometry in leaf order,
+  // trading memory for faster intersection
+  bool precompute_leaves = false;
+
+  // the directory in which the hierarchy's owner caches the hierarchy, keyed by the content of its elements,
+  // for later runs to map rather than build; empty disables caching
+  std::string cache_directory;
+};
+
+
+/*! A bounding_volume_hierarchy is a binary tree of bounding_boxes built over a collection of elements.
+ *  Elements are identified by their index into the collection; the hierarchy never stores the elements themselves,
+ *  so it remains valid when the collection is copied or moved.
+ */
+class bounding_volume_hierarchy
+{
+  public:
+    using index_type = std::uint32_t;
+
+    // the maximum depth of a leaf below the root
+    // build() splits at the median below depth 64, which adds at most 32 levels over 2^32 elements
+    static constexpr std::size_t max_depth = 64 + 32;
+
+    struct node
+    {
+      igloo::bounding_box bounding_box;
+
+      // for interior nodes, the index of the right child; the left child immediately follows its parent
+      // for leaves, the position of the leaf's first element in elements()
+      index_type offset;
+
+      // the number of elements in a leaf; 0 for interior nodes
+      std::uint16_t size;
+
+      // the axis along which an interior node's children were split
+      std::uint16_t axis;
+
+      inline bool is_leaf() const
+      {
+        return size > 0;
+      }
+    };
+
+    /*! Creates an empty bounding_volume_hierarchy.
+     */
+    inline bounding_volume_hierarchy()
+      : m_size(0),
+        m_build_time(0),
+        m_built_sah_cost(0),
+        m_is_mapped(false)
+    {}
+
+    /*! Creates a new bounding_volume_hierarchy.
+     *  \param num_elements The number of elements to build the hierarchy over.
+     *  \param bounding_box_of A function mapping an element's index to its bounding_box.
+     *  \param options Parameters controlling the construction of the hierarchy.
+     *  \note Spatial splits clip elements' bounding_boxes rather than the elements themselves.
+     */
+    template<class Function>
+    inline bounding_volume_hierarchy(std::size_t num_elements, Function bounding_box_of,
+                                     const bounding_volume_hierarchy_options& options = bounding_volume_hierarchy_options())
+      : bounding_volume_hierarchy(num_elements, bounding_box_of, [bounding_box_of](std::size_t i, const igloo::bounding_box& box)
+        {
+          return bounding_box_of(i).overlap(box);
+        },
+        options)
+    {}
+
+    /*! Creates a new bounding_volume_hierarchy.
+     *  \param num_elements The number of elements to build the hierarchy over.
+     *  \param bounding_box_of A function mapping an element's index to its bounding_box.
+     *  \param clipped_bounding_box_of A function mapping an element's index and a bounding_box to the bounding_box
+     *                                 of the part of the element within it, used by spatial splits.
+     *  \param options Parameters controlling the construction of the hierarchy.
+     */
+    template<class Function1, class Function2>
+    inline bounding_volume_hierarchy(std::size_t num_elements, Function1 bounding_box_of, Function2 clipped_bounding_box_of,
+                                     const bounding_volume_hierarchy_options& options)
+      : m_size(num_elements),
+        m_options(clamped_options(options)),
+        m_build_time(0),
+        m_built_sah_cost(0),
+        m_is_mapped(false)
+    {
+      auto start = std::chrono::steady_clock::now();
+
+      std::vector<igloo::bounding_box> boxes(num_elements);
+      std::vector<point> centroids(num_elements);
+      map_chunks(0, num_elements, [&](std::size_t begin, std::size_t end)
+      {
+        for(std::size_t i = begin; i < end; ++i)
+        {
+          boxes[i] = bounding_box_of(i);
+          centroids[i] = centroid(boxes[i]);
+        }
+
+        return 0;
+      });
+
+      if(num_elements > 0 && m_options.method == bounding_volume_hierarchy_options::split_method::spatial)
+      {
+        std::vector<reference> references(num_elements);
+        for(std::size_t i = 0; i < num_elements; ++i)
+        {
+          references[i] = reference{boxes[i], static_cast<index_type>(i)};
+        }
+
+        boxes.clear();
+        boxes.shrink_to_fit();
+        centroids.clear();
+        centroids.shrink_to_fit();
+
+        std::size_t budget = static_cast<std::size_t>(std::max(0.f, m_options.max_reference_growth) * num_elements);
+        m_elements.reserve(num_elements + budget);
+        m_nodes.reserve(2 * num_elements);
+
+        float root_area = std::accumulate(references.begin(), references.end(), igloo::bounding_box(), [](const igloo::bounding_box& partial, const reference& ref)
+        {
+          return partial + ref.bounding_box;
+        }).surface_area();
+
+        build_spatial(std::move(references), clipped_bounding_box_of, 0, root_area, budget);
+      }
+      else if(num_elements > 0)
+      {
+        m_elements.resize(num_elements);
+        std::iota(m_elements.begin(), m_elements.end(), index_type(0));
+
+        m_nodes.reserve(2 * num_elements);
+        build(boxes, centroids, 0, num_elements, 0, m_options.num_threads, m_nodes);
+      }
+
+      m_build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      m_built_sah_cost = sah_cost();
+    }
+
+    /*! Recomputes the bounding_box of every node from its elements' new bounding_boxes, bottom-up,
+     *  keeping the hierarchy's structure.
+     *  \param bounding_box_of A function mapping an element index to the element's bounding_box.
+     *  \note The hierarchy remains correct however far its elements move, but its quality degrades; see needs_rebuild().
+     *        Leaves bound the whole of elements referenced by spatial splits, so refitting discards their clipping.
+     */
+    template<class Function>
+    inline void refit(Function bounding_box_of)
+    {
+      // a mapped hierarchy is read-only, so copy it before modifying it
+      if(m_mapping)
+      {
+        m_nodes.assign(m_mapped_nodes.begin(), m_mapped_nodes.end());
+        m_elements.assign(m_mapped_elements.begin(), m_mapped_elements.end());
+        m_mapping.reset();
+        m_mapped_nodes = array_ref<const node>();
+        m_mapped_elements = array_ref<const index_type>();
+        m_is_mapped = false;
+      }
+
+      // bound the leaves in parallel
+      map_chunks(0, m_nodes.size(), [&](std::size_t begin, std::size_t end)
+      {
+        for(std::size_t i = begin; i < end; ++i)
+        {
+          node& n = m_nodes[i];
+          if(n.is_leaf())
+          {
+            n.bounding_box = igloo::bounding_box();
+            for(std::size_t j = n.offset; j < n.offset + n.size; ++j)
+            {
+              n.bounding_box += bounding_box_of(std::size_t(m_elements[j]));
+            }
+          }
+        }
+
+        return 0;
+      });
+
+      // children follow their parent, so a reverse sweep visits both children of a node before the node itself
+      for(std::size_t i = m_nodes.size(); i-- > 0;)
+      {
+        node& n = m_nodes[i];
+        if(!n.is_leaf())
+        {
+          n.bounding_box = m_nodes[i + 1].bounding_box + m_nodes[n.offset].bounding_box;
+        }
+      }
+    }
+
+    /*! Releases this hierarchy's nodes and elements, e.g. once its owner has collapsed it into a wide_bounding_volume_hierarchy,
+     *  keeping the record of its construction: size(), options(), build_time(), and is_mapped().
+     */
+    inline void clear()
+    {
+      m_nodes = std::vector<node>();
+      m_elements = std::vector<index_type>();
+      m_mapping.reset();
+      m_mapped_nodes = array_ref<const node>();
+      m_mapped_elements = array_ref<const index_type>();
+    }
+
+    /*! \return true if refit() has degraded this hierarchy's sah_cost() past options().rebuild_threshold
+     *          times its cost when built; false, otherwise.
+     */
+    inline bool needs_rebuild() const
+    {
+      return sah_cost() > m_options.rebuild_threshold * m_built_sah_cost;
+    }
+
+    /*! Writes this hierarchy to a file which map() can later map.
+     *  \param filename The name of the file to write.
+     *  \param key A hash of the elements this hierarchy was built over, which map() checks.
+     *  \return true if the file was written; false, otherwise.
+     *  \note The file is written under a temporary name and then renamed, so concurrent readers never map a partial file.
+     */
+    inline bool write(const std::string& filename, std::uint64_t key) const
+    {
+      file_header header = make_header(key, m_options);
+      header.size = m_size;
+      header.num_nodes = nodes().size();
+      header.num_elements = elements().size();
+      header.built_sah_cost = m_built_sah_cost;
+      header.checksum = checksum(header, nodes(), elements());
+
+      std::string temporary = filename + "." + std::to_string(std::random_device()()) + ".partial";
+
+      bool written = false;
+      {
+        std::ofstream os(temporary, std::ios::binary);
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        os.write(reinterpret_cast<const char*>(nodes().data()), nodes().size() * sizeof(node));
+        os.write(reinterpret_cast<const char*>(elements().data()), elements().size() * sizeof(index_type));
+        written = bool(os);
+      }
+
+      if(!written || std::rename(temporary.c_str(), filename.c_str()) != 0)
+      {
+        std::remove(temporary.c_str());
+        return false;
+      }
+
+      return true;
+    }
+
+    /*! \return A hash of the options which affect the structure of a hierarchy built with options,
+     *          which distinguishes hierarchies built over the same elements.
+     */
+    inline static std::uint64_t options_key(const bounding_volume_hierarchy_options& options)
+    {
+      bounding_volume_hierarchy_options clamped = clamped_options(options);
+
+      float parameters[] =
+      {
+        float(clamped.method),
+        float(clamped.num_bins),
+        float(clamped.max_leaf_size),
+        clamped.traversal_cost,
+        clamped.spatial_split_threshold,
+        clamped.max_reference_growth
+      };
+
+      return hash_bytes(parameters, sizeof(parameters));
+    }
+
+    /*! Maps a hierarchy written by write() read-only, using the file's contents in place without deserializing them.
+     *  Processes mapping the same file share its physical pages.
+     *  Before the hierarchy is used, its contents are checked against the checksum write() recorded, and every node's
+     *  children and elements against the sizes of its arrays; a file failing either check is removed, so that a
+     *  corrupt file shared by many processes is rebuilt rather than mapped again by each.
+     *  \param filename The name of the file to map.
+     *  \param key The hash of the elements the hierarchy must have been built over.
+     *  \param size The number of elements the hierarchy must have been built over.
+     *  \param options The options the hierarchy must have been built with.
+     *  \return nullopt if the file does not exist, was written for other elements, other options, or by an
+     *          incompatible build, or is corrupt; otherwise, the mapped hierarchy.
+     */
+    inline static optional<bounding_volume_hierarchy> map(const std::string& filename, std::uint64_t key, std::size_t size,
+                                                          const bounding_volume_hierarchy_options& options)
+    {
+      auto start = std::chrono::steady_clock::now();
+
+      std::shared_ptr<const mapped_file> mapping;
+      try
+      {
+        mapping = std::make_shared<const mapped_file>(filename);
+      }
+      catch(const std::runtime_error&)
+      {
+        return nullopt;
+      }
+
+      if(mapping->size() < sizeof(file_header)) return nullopt;
+
+      bounding_volume_hierarchy result;
+      result.m_options = clamped_options(options);
+
+      // the header's identifying fields must match exactly
+      file_header expected = make_header(key, result.m_options);
+      file_header header;
+      std::memcpy(&header, mapping->data(), sizeof(file_header));
+      if(std::memcmp(&header, &expected, offsetof(file_header, size)) != 0) return nullopt;
+
+      // the file was written for these elements and options, so any mismatch below means it is corrupt
+      auto remove_corrupt_file = [&]
+      {
+        mapping.reset();
+        std::remove(filename.c_str());
+        return nullopt;
+      };
+
+      // bound the counts by the file's size before multiplying them, so that the products can't overflow
+      if(header.size != size ||
+         header.num_nodes > mapping->size() / sizeof(node) ||
+         header.num_elements > mapping->size() / sizeof(index_type) ||
+         mapping->size() != sizeof(file_header) + header.num_nodes * sizeof(node) + header.num_elements * sizeof(index_type))
+      {
+        return remove_corrupt_file();
+      }
+
+      const char* nodes = static_cast<const char*>(mapping->data()) + sizeof(file_header);
+      const char* elements = nodes + header.num_nodes * sizeof(node);
+
+      array_ref<const node> mapped_nodes(reinterpret_cast<const node*>(nodes), header.num_nodes);
+      array_ref<const index_type> mapped_elements(reinterpret_cast<const index_type*>(elements), header.num_elements);
+
+      if(header.checksum != checksum(header, mapped_nodes, mapped_elements) ||
+         !is_well_formed(mapped_nodes, mapped_elements, header.size))
+      {
+        return remove_corrupt_file();
+      }
+
+      result.m_size = header.size;
+      result.m_mapped_nodes = mapped_nodes;
+      result.m_mapped_elements = mapped_elements;
+      result.m_mapping = std::move(mapping);
+      result.m_is_mapped = true;
+      result.m_built_sah_cost = header.built_sah_cost;
+      result.m_build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      return result;
+    }
+
+    /*! \return The number of seconds it took to build this hierarchy.
+     */
+    inline double build_time() const
+    {
+      return m_build_time;
+    }
+
+    /*! \return The options this hierarchy was built with.
+     */
+    inline const bounding_volume_hierarchy_options& options() const
+    {
+      return m_options;
+    }
+
+    /*! Estimates the expected cost of intersecting a random ray with this hierarchy using the surface area heuristic.
+     *  \return The sum over nodes of each node's cost weighted by the ratio of its surface area to the root's,
+     *          where interior nodes cost options().traversal_cost and leaves cost the number of their elements.
+     */
+    inline float sah_cost() const
+    {
+      array_ref<const node> nodes = this->nodes();
+      if(nodes.empty()) return 0.f;
+
+      float root_area = nodes.front().bounding_box.surface_area();
+      if(root_area <= 0.f) return 0.f;
+
+      float result = 0.f;
+      for(const node& n : nodes)
+      {
+        float cost = n.is_leaf() ? float(n.size) : m_options.traversal_cost;
+        result += cost * n.bounding_box.surface_area() / root_area;
+      }
+
+      return result;
+    }
+
+    /*! \return The number of elements in this hierarchy.
+     */
+    inline std::size_t size() const
+    {
+      return m_size;
+    }
+
+    /*! \return The number of bytes occupied by this hierarchy's nodes and elements.
+     */
+    inline std::size_t memory_size() const
+    {
+      return nodes().size() * sizeof(node) + elements().size() * sizeof(index_type);
+    }
+
+    /*! \return This hierarchy's nodes; the root is the first node.
+     */
+    inline array_ref<const node> nodes() const
+    {
+      return m_mapping ? m_mapped_nodes : array_ref<const node>(m_nodes);
+    }
+
+    /*! \return This hierarchy's element indices in leaf order.
+     *  \note When built with spatial splits, an element may appear more than once.
+     */
+    inline array_ref<const index_type> elements() const
+    {
+      return m_mapping ? m_mapped_elements : array_ref<const index_type>(m_elements);
+    }
+
+    /*! \return true if this hierarchy was mapped from a file by map(); false, otherwise.
+     */
+    inline bool is_mapped() const
+    {
+      return m_is_mapped;
+    }
+
+    /*! \return A bounding_box bounding every element of this hierarchy.
+     */
+    inline igloo::bounding_box bounding_box() const
+    {
+      return nodes().empty() ? igloo::bounding_box() : nodes().front().bounding_box;
+    }
+
+    /*! Visits the elements whose bounding_boxes are pierced by a ray in approximately front-to-back order,
+     *  skipping subtrees which lie beyond the nearest hit found so far.
+     *  \param r The ray of interest.
+     *  \param intersector A function of (element index, max_t) returning the ray parameter of the nearest
+     *                     intersection with the element if it is nearer than max_t; otherwise, max_t.
+     *  \return The ray parameter of the nearest intersection found, or r.end() if none exists.
+     */
+    template<class Function>
+    inline float intersect(const ray& r, Function intersector) const
+    {
+      array_ref<const index_type> elements = this->elements();
+
+      return intersect_leaves(r, [&](std::size_t begin, std::size_t end, float max_t)
+      {
+        for(std::size_t i = begin; i < end; ++i)
+        {
+          max_t = intersector(elements[i], max_t);
+        }
+
+        return max_t;
+      });
+    }
+
+    /*! Visits the leaves pierced by a ray in approximately front-to-back order,
+     *  skipping subtrees which lie beyond the nearest hit found so far.
+     *  \param r The ray of interest.
+     *  \param intersector A function of (begin, end, max_t) returning the ray parameter of the nearest intersection
+     *                     with the leaf's elements, elements()[begin, end), if it is nearer than max_t; otherwise, max_t.
+     *  \return The ray parameter of the nearest intersection found, or r.end() if none exists.
+     */
+    template<class Function>
+    inline float intersect_leaves(const ray& r, Function intersector) const
+    {
+      float max_t = r.end();
+
+      traverse(r, [&]
+      {
+        return max_t;
+      },
+      [&](std::size_t begin, std::size_t end)
+      {
+        max_t = intersector(begin, end, max_t);
+        return false;
+      });
+
+      return max_t;
+    }
+
+    /*! Tests whether any element pierced by a ray satisfies a predicate, terminating at the first that does.
+     *  \param r The ray of interest.
+     *  \param pred A function of (element index) returning true if the element is intersected by r.
+     *  \return true if pred returned true for some element; false, otherwise.
+     */
+    template<class Predicate>
+    inline bool any_of(const ray& r, Predicate pred) const
+    {
+      array_ref<const index_type> elements = this->elements();
+
+      return any_of_leaves(r, [&](std::size_t begin, std::size_t end)
+      {
+        for(std::size_t i = begin; i < end; ++i)
+        {
+          if(pred(elements[i])) return true;
+        }
+
+        return false;
+      });
+    }
+
+    /*! Tests whether any leaf pierced by a ray satisfies a predicate, terminating at the first that does.
+     *  \param r The ray of interest.
+     *  \param pred A function of (begin, end) returning true if any of the leaf's elements, elements()[begin, end), is intersected by r.
+     *  \return true if pred returned true for some leaf; false, otherwise.
+     */
+    template<class Predicate>
+    inline bool any_of_leaves(const ray& r, Predicate pred) const
+    {
+      return traverse(r, [&]
+      {
+        return r.end();
+      },
+      [&](std::size_t begin, std::size_t end)
+      {
+        return pred(begin, end);
+      });
+    }
+
+    /*! Visits the leaves pierced by any of a packet's rays, sharing a single traversal among the rays.
+     *  \param packet The rays of interest. intersector shortens each ray's interval as it finds intersections,
+     *                which culls subtrees beyond them.
+     *  \param mask The lanes of packet to trace.
+     *  \param intersector A function of (begin, end, mask) which intersects the rays of packet in mask with the leaf's
+     *                     elements, elements()[begin, end), and sets the end of each ray it finds a nearer intersection for.
+     */
+    template<class Function>
+    inline void intersect_leaves(ray_packet& packet, ray_packet::mask_type mask, Function intersector) const
+    {
+      traverse(packet, mask, [&](std::size_t begin, std::size_t end, ray_packet::mask_type leaf_mask)
+      {
+        intersector(begin, end, leaf_mask);
+        return ray_packet::mask_type(0);
+      });
+    }
+
+    /*! Tests which of a packet's rays pierce a leaf satisfying a predicate, sharing a single traversal among the rays.
+     *  Each ray retires from the traversal at the first leaf for which it satisfies the predicate.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to trace.
+     *  \param pred A function of (begin, end, mask) returning the lanes of mask whose rays intersect any of the leaf's
+     *              elements, elements()[begin, end).
+     *  \return The lanes of mask for which pred returned true at some leaf.
+     */
+    template<class Predicate>
+    inline ray_packet::mask_type any_of_leaves(const ray_packet& packet, ray_packet::mask_type mask, Predicate pred) const
+    {
+      ray_packet::mask_type result = 0;
+
+      traverse(packet, mask, [&](std::size_t begin, std::size_t end, ray_packet::mask_type leaf_mask)
+      {
+        ray_packet::mask_type hits = pred(begin, end, leaf_mask) & leaf_mask;
+        result |= hits;
+        return hits;
+      });
+
+      return result;
+    }
+
+    /*! Visits the leaves pierced by any of a stream's rays, filtering the stream at each node
+     *  so that each node is fetched once for all of the rays which reach it.
+     *  \param stream The rays of interest. intersector shortens each ray's interval as it finds intersections,
+     *                which culls subtrees beyond them, and may retire rays which need no further traversal.
+     *  \param indices The indices of the rays of stream to trace, e.g. as ordered by ray_stream::sorted_indices().
+     *  \param intersector A function of (begin, end, indices) which intersects the rays of stream in indices with the
+     *                     leaf's elements, elements()[begin, end).
+     */
+    template<class Function>
+    inline void intersect_leaves(ray_stream& stream, array_ref<const ray_stream::index_type> indices, Function intersector) const
+    {
+      array_ref<const node> nodes = this->nodes();
+      if(nodes.empty() || indices.empty()) return;
+
+      // the rays reaching each node on the stack occupy a segment of this buffer
+      std::vector<ray_stream::index_type> buffer(indices.begin(), indices.end());
+
+      struct entry
+      {
+        index_type node;
+        std::size_t begin, end;
+      };
+
+      // build() bounds the depth of the hierarchy, and each level adds at most one entry to the stack
+      entry stack[max_depth + 1];
+      int top = 0;
+      stack[top++] = entry{0, 0, buffer.size()};
+
+      while(top > 0)
+      {
+        entry e = stack[--top];
+        const node& n = nodes[e.node];
+
+        // the segments following e's were filtered for subtrees which have been traversed completely
+        buffer.resize(e.end);
+
+        // filter the rays reaching n's parent down to those which intersect n
+        std::size_t begin = buffer.size();
+        for(std::size_t i = e.begin; i < e.end; ++i)
+        {
+          ray_stream::index_type ray_index = buffer[i];
+
+          if(stream.intersects(n.bounding_box, ray_index))
+          {
+            buffer.push_back(ray_index);
+          }
+        }
+
+        std::size_t end = buffer.size();
+        if(begin == end) continue;
+
+        if(n.is_leaf())
+        {
+          intersector(n.offset, n.offset + n.size, array_ref<const ray_stream::index_type>(buffer.data() + begin, end - begin));
+          continue;
+        }
+
+        index_type left  = e.node + 1;
+        index_type right = n.offset;
+
+        // order the children by the direction of most of the rays, and push the far child first
+        std::size_t num_negative = 0;
+        for(std::size_t i = begin; i < end; ++i)
+        {
+          num_negative += stream.direction(buffer[i], n.axis) < 0.f;
+        }
+
+        if(2 * num_negative > end - begin)
+        {
+          stack[top++] = entry{left, begin, end};
+          stack[top++] = entry{right, begin, end};
+        }
+        else
+        {
+          stack[top++] = entry{right, begin, end};
+          stack[top++] = entry{left, begin, end};
+        }
+      }
+    }
+
+    /*! Tests a ray against a bounding_box.
+     *  \param box The bounding_box of interest.
+     *  \param origin The origin of the ray.
+     *  \param inv_direction The reciprocal of the ray's direction.
+     *  \param t0 The beginning of the ray's interval.
+     *  \param t1 The end of the ray's interval.
+     *  \return true if the ray's interval overlaps box; false, otherwise.
+     */
+    inline static bool intersects(const igloo::bounding_box& box, const point& origin, const vector& inv_direction, float t0, float t1)
+    {
+      for(int i = 0; i < 3; ++i)
+      {
+        float t_near = (box.min()[i] - origin[i]) * inv_direction[i];
+        float t_far  = (box.max()[i] - origin[i]) * inv_direction[i];
+
+        if(t_near > t_far) std::swap(t_near, t_far);
+
+        // comparisons against NaN fail, so a ray lying in a slab's plane leaves the interval unchanged
+        t0 = t_near > t0 ? t_near : t0;
+        t1 = t_far  < t1 ? t_far  : t1;
+
+        if(t0 > t1) return false;
+      }
+
+      return true;
+    }
+
+  private:
+    // returns options with its parameters clamped to their supported ranges and num_threads resolved
+    inline static bounding_volume_hierarchy_options clamped_options(bounding_volume_hierarchy_options options)
+    {
+      options.num_bins = std::max<std::size_t>(options.num_bins, 2);
+      options.max_leaf_size = std::min<std::size_t>(std::max<std::size_t>(options.max_leaf_size, 1), std::size_t(max_leaf_size_limit));
+      if(options.num_threads == 0)
+      {
+        options.num_threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+      }
+
+      return options;
+    }
+
+    // the layout of the beginning of a file written by write(), followed by the nodes and then the elements
+    struct file_header
+    {
+      // these fields identify the hierarchy and the build which wrote it
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t byte_order;
+      std::uint32_t node_size;
+      std::uint32_t index_size;
+      std::uint64_t key;
+      std::uint64_t options_key;
+
+      // these fields describe the hierarchy
+      std::uint64_t size;
+      std::uint64_t num_nodes;
+      std::uint64_t num_elements;
+      float built_sah_cost;
+      std::uint32_t reserved;
+
+      // a hash of the header, with this field zeroed, followed by the nodes and elements
+      std::uint64_t checksum;
+    };
+
+    // returns the checksum of a file consisting of header and the given nodes and elements
+    inline static std::uint64_t checksum(file_header header, array_ref<const node> nodes, array_ref<const index_type> elements)
+    {
+      header.checksum = 0;
+
+      std::uint64_t result = hash_bytes(&header, sizeof(header));
+      result = hash_bytes(nodes.data(), nodes.size() * sizeof(node), result);
+      return hash_bytes(elements.data(), elements.size() * sizeof(index_type), result);
+    }
+
+    // checks with one pass over nodes that each interior node's children follow it and lie within nodes, that each node
+    // but the root is the child of exactly one node no deeper than max_depth, and that each leaf's elements lie within
+    // elements, whose indices lie within [0, size), so that traversing a hierarchy read from a file stays in bounds
+    inline static bool is_well_formed(array_ref<const node> nodes, array_ref<const index_type> elements, std::size_t size)
+    {
+      for(index_type e : elements)
+      {
+        if(e >= size) return false;
+      }
+
+      if(nodes.empty()) return elements.empty();
+
+      // the depth of each node below the root, or unreached for nodes which are no node's child
+      const std::uint8_t unreached = std::numeric_limits<std::uint8_t>::max();
+      std::vector<std::uint8_t> depth(nodes.size(), unreached);
+      depth[0] = 0;
+
+      for(std::size_t i = 0; i < nodes.size(); ++i)
+      {
+        const node& n = nodes[i];
+
+        // children follow their parent, so every node's parent was visited before it
+        if(depth[i] == unreached) return false;
+
+        if(n.is_leaf())
+        {
+          if(n.size > max_leaf_size_limit || n.offset > elements.size() || n.size > elements.size() - n.offset) return false;
+          continue;
+        }
+
+        std::size_t left = i + 1;
+        std::size_t right = n.offset;
+        if(n.axis > 2 || right <= left || right >= nodes.size() || depth[i] >= max_depth) return false;
+
+        if(depth[left] != unreached || depth[right] != unreached) return false;
+
+        depth[left] = depth[i] + 1;
+        depth[right] = depth[i] + 1;
+      }
+
+      return true;
+    }
+
+    // returns a file_header whose identifying fields describe a hierarchy over elements hashing to key, built with options
+    inline static file_header make_header(std::uint64_t key, const bounding_volume_hierarchy_options& options)
+    {
+      file_header result;
+      std::memset(&result, 0, sizeof(result));
+
+      std::memcpy(result.magic, "iglobvh", 8);
+      result.version = 2;
+      result.byte_order = 0x01020304;
+      result.node_size = sizeof(node);
+      result.index_size = sizeof(index_type);
+      result.key = key;
+      result.options_key = options_key(options);
+
+      return result;
+    }
+
+    inline static point centroid(const igloo::bounding_box& box)
+    {
+      return point(0.5f * (box.min().x + box.max().x),
+                   0.5f * (box.min().y + box.max().y),
+                   0.5f * (box.min().z + box.max().z));
+    }
+
+    // the maximum depth at which build() may split by the surface area heuristic
+    // below this depth, nodes are split at the median, which bounds the depth of the hierarchy and
+    // thereby the size of the traversal stack
+    static constexpr std::size_t max_sah_depth = 64;
+    static constexpr std::size_t max_leaf_size_limit = 255;
+
+    // ranges smaller than this are processed by a single thread
+    static constexpr std::size_t min_parallel_size = 1 << 14;
+
+    // applies f to contiguous chunks of [begin, end) concurrently, one chunk per thread,
+    // and returns the results in order
+    template<class Function>
+    inline auto map_chunks(std::size_t begin, std::size_t end, Function f, std::size_t num_threads = 0) const
+      -> std::vector<decltype(f(begin, end))>
+    {
+      using result_type = decltype(f(begin, end));
+
+      if(num_threads == 0) num_threads = m_options.num_threads;
+
+      std::size_t n = end - begin;
+      std::size_t num_chunks = std::min(num_threads, std::max<std::size_t>(n / min_parallel_size, 1));
+
+      std::vector<result_type> result;
+      if(num_chunks == 1)
+      {
+        result.push_back(f(begin, end));
+        return result;
+      }
+
+      std::size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+
+      std::vector<std::future<result_type>> futures;
+      for(std::size_t chunk_begin = begin + chunk_size; chunk_begin < end; chunk_begin += chunk_size)
+      {
+        std::size_t chunk_end = std::min(chunk_begin + chunk_size, end);
+        futures.push_back(std::async(std::launch::async, f, chunk_begin, chunk_end));
+      }
+
+      result.push_back(f(begin, std::min(begin + chunk_size, end)));
+      for(auto& future : futures)
+      {
+        result.push_back(future.get());
+      }
+
+      return result;
+    }
+
+    struct bins
+    {
+      // the bounds and number of the elements whose centroids fall into each bin along each axis
+      std::vector<igloo::bounding_box> bounds[3];
+      std::vector<std::size_t> counts[3];
+
+      inline bins(std::size_t num_bins)
+      {
+        for(int axis = 0; axis < 3; ++axis)
+        {
+          bounds[axis].resize(num_bins);
+          counts[axis].resize(num_bins, 0);
+        }
+      }
+
+      inline bins& operator+=(const bins& other)
+      {
+        for(int axis = 0; axis < 3; ++axis)
+        {
+          for(std::size_t b = 0; b < bounds[axis].size(); ++b)
+          {
+            bounds[axis][b] += other.bounds[axis][b];
+            counts[axis][b] += other.counts[axis][b];
+          }
+        }
+
+        return *this;
+      }
+    };
+
+    struct split
+    {
+      int axis;
+      float cost;
+      std::size_t bin;
+    };
+
+    // finds the split of m_elements[begin, end) with the least estimated cost
+    inline split find_binned_sah_split(const std::vector<igloo::bounding_box>& boxes,
+                                       const std::vector<point>& centroids,
+                                       std::size_t begin, std::size_t end,
+                                       const igloo::bounding_box& bounds,
+                                       const igloo::bounding_box& centroid_bounds,
+                                       std::size_t num_threads) const
+    {
+      const std::size_t num_bins = m_options.num_bins;
+
+      float lo[3], scale[3];
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        float extent = centroid_bounds.max()[axis] - centroid_bounds.min()[axis];
+        lo[axis] = centroid_bounds.min()[axis];
+        scale[axis] = extent > 0.f ? num_bins / extent : 0.f;
+      }
+
+      // bin the elements along all three axes, in parallel for large ranges
+      auto partial_bins = map_chunks(begin, end, [&](std::size_t chunk_begin, std::size_t chunk_end)
+      {
+        bins result(num_bins);
+
+        for(std::size_t i = chunk_begin; i < chunk_end; ++i)
+        {
+          index_type e = m_elements[i];
+
+          for(int axis = 0; axis < 3; ++axis)
+          {
+            std::size_t b = bin_of(centroids[e][axis], lo[axis], scale[axis], num_bins);
+            result.bounds[axis][b] += boxes[e];
+            ++result.counts[axis][b];
+          }
+        }
+
+        return result;
+      },
+      num_threads);
+
+      bins& total = partial_bins.front();
+      for(std::size_t i = 1; i < partial_bins.size(); ++i)
+      {
+        total += partial_bins[i];
+      }
+
+      split result{-1, std::numeric_limits<float>::infinity(), 0};
+
+      float inv_area = 1.f / bounds.surface_area();
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        if(!(scale[axis] > 0.f)) continue;
+
+        sweep(axis, total.bounds[axis], total.counts[axis], total.counts[axis], inv_area, result);
+      }
+
+      return result;
+    }
+
+    // evaluates the planes between adjacent bins along axis and updates best with the plane of least estimated cost
+    // entries[b] counts the elements whose first bin is b, and exits[b] the elements whose last bin is b
+    inline void sweep(int axis,
+                      const std::vector<igloo::bounding_box>& bin_bounds,
+                      const std::vector<std::size_t>& entries,
+                      const std::vector<std::size_t>& exits,
+                      float inv_area,
+                      split& best) const
+    {
+      const std::size_t num_bins = bin_bounds.size();
+
+      std::vector<float> right_areas(num_bins);
+      std::vector<std::size_t> right_counts(num_bins);
+
+      // sweep from the right to accumulate the bounds of the right side of each candidate plane
+      igloo::bounding_box right;
+      std::size_t right_count = 0;
+      for(std::size_t b = num_bins - 1; b > 0; --b)
+      {
+        right += bin_bounds[b];
+        right_count += exits[b];
+        right_areas[b] = right.surface_area();
+        right_counts[b] = right_count;
+      }
+
+      // sweep from the left, evaluating the plane between bins b - 1 and b
+      igloo::bounding_box left;
+      std::size_t left_count = 0;
+      for(std::size_t b = 1; b < num_bins; ++b)
+      {
+        left += bin_bounds[b - 1];
+        left_count += entries[b - 1];
+
+        if(left_count == 0 || right_counts[b] == 0) continue;
+
+        float cost = m_options.traversal_cost +
+                     inv_area * (left_count * left.surface_area() + right_counts[b] * right_areas[b]);
+
+        if(cost < best.cost)
+        {
+          best = split{axis, cost, b};
+        }
+      }
+    }
+
+    inline static std::size_t bin_of(float x, float lo, float scale, std::size_t num_bins)
+    {
+      std::size_t result = static_cast<std::size_t>(scale * (x - lo));
+      return std::min(result, num_bins - 1);
+    }
+
+    // chooses where to split m_elements[begin, end), partitions it, and returns the split's axis and position
+    // returns an axis of -1 if the range should become a leaf instead
+    inline std::pair<int,std::size_t> partition(const std::vector<igloo::bounding_box>& boxes,
+                                                const std::vector<point>& centroids,
+                                                std::size_t begin, std::size_t end,
+                                                std::size_t depth,
+                                                const igloo::bounding_box& bounds,
+                                                const igloo::bounding_box& centroid_bounds,
+                                                std::size_t num_threads)
+    {
+      std::size_t n = end - begin;
+
+      if(n > 1 && m_options.method == bounding_volume_hierarchy_options::split_method::binned_sah && depth < max_sah_depth && bounds.surface_area() > 0.f)
+      {
+        split s = find_binned_sah_split(boxes, centroids, begin, end, bounds, centroid_bounds, num_threads);
+
+        // create a leaf if intersecting all of its elements is expected to be cheaper than splitting
+        if(s.axis < 0 || (n <= m_options.max_leaf_size && float(n) <= s.cost))
+        {
+          if(n <= m_options.max_leaf_size)
+          {
+            return std::make_pair(-1, begin);
+          }
+        }
+        else
+        {
+          float lo = centroid_bounds.min()[s.axis];
+          float scale = m_options.num_bins / (centroid_bounds.max()[s.axis] - lo);
+
+          auto partition_point = std::partition(m_elements.begin() + begin, m_elements.begin() + end, [&](index_type e)
+          {
+            return bin_of(centroids[e][s.axis], lo, scale, m_options.num_bins) < s.bin;
+          });
+
+          return std::make_pair(s.axis, std::size_t(partition_point - m_elements.begin()));
+        }
+      }
+      else if(n <= m_options.max_leaf_size)
+      {
+        return std::make_pair(-1, begin);
+      }
+
+      // split at the median centroid along the axis of greatest centroid extent
+      vector extent = centroid_bounds.max() - centroid_bounds.min();
+      int axis = 0;
+      if(extent[1] > extent[axis]) axis = 1;
+      if(extent[2] > extent[axis]) axis = 2;
+
+      std::size_t middle = begin + n / 2;
+      std::nth_element(m_elements.begin() + begin, m_elements.begin() + middle, m_elements.begin() + end, [&](index_type a, index_type b)
+      {
+        return centroids[a][axis] < centroids[b][axis];
+      });
+
+      return std::make_pair(axis, middle);
+    }
+
+    // builds the subtree over m_elements[begin, end) into nodes and returns the index of its root
+    // subtrees over large ranges are built concurrently by up to num_threads threads
+    inline index_type build(const std::vector<igloo::bounding_box>& boxes,
+                            const std::vector<point>& centroids,
+                            std::size_t begin, std::size_t end,
+                            std::size_t depth,
+                            std::size_t num_threads,
+                            std::vector<node>& nodes)
+    {
+      index_type result = static_cast<index_type>(nodes.size());
+      nodes.emplace_back();
+
+      auto partial_bounds = map_chunks(begin, end, [&](std::size_t chunk_begin, std::size_t chunk_end)
+      {
+        std::pair<igloo::bounding_box,igloo::bounding_box> result;
+        for(std::size_t i = chunk_begin; i < chunk_end; ++i)
+        {
+          result.first  += boxes[m_elements[i]];
+          result.second += centroids[m_elements[i]];
+        }
+
+        return result;
+      },
+      num_threads);
+
+      igloo::bounding_box bounds;
+      igloo::bounding_box centroid_bounds;
+      for(const auto& partial : partial_bounds)
+      {
+        bounds += partial.first;
+        centroid_bounds += partial.second;
+      }
+
+      nodes[result].bounding_box = bounds;
+
+      int axis;
+      std::size_t middle;
+      std::tie(axis, middle) = partition(boxes, centroids, begin, end, depth, bounds, centroid_bounds, num_threads);
+
+      if(axis < 0)
+      {
+        nodes[result].offset = static_cast<index_type>(begin);
+        nodes[result].size = static_cast<std::uint16_t>(end - begin);
+        nodes[result].axis = 0;
+        return result;
+      }
+
+      index_type right;
+
+      if(num_threads > 1 && end - begin >= min_parallel_size)
+      {
+        // build the left subtree on another thread, then splice both subtrees after this node
+        std::size_t left_threads = num_threads / 2;
+
+        std::vector<node> left_nodes, right_nodes;
+        auto left = std::async(std::launch::async, [&]
+        {
+          build(boxes, centroids, begin, middle, depth + 1, left_threads, left_nodes);
+        });
+
+        build(boxes, centroids, middle, end, depth + 1, num_threads - left_threads, right_nodes);
+        left.get();
+
+        splice(nodes, left_nodes);
+        right = splice(nodes, right_nodes);
+      }
+      else
+      {
+        build(boxes, centroids, begin, middle, depth + 1, 1, nodes);
+        right = build(boxes, centroids, middle, end, depth + 1, 1, nodes);
+      }
+
+      nodes[result].offset = right;
+      nodes[result].size = 0;
+      nodes[result].axis = static_cast<std::uint16_t>(axis);
+
+      return result;
+    }
+
+    // appends a subtree built into its own vector to nodes and returns the index of its root
+    inline static index_type splice(std::vector<node>& nodes, const std::vector<node>& subtree)
+    {
+      index_type result = static_cast<index_type>(nodes.size());
+
+      for(node n : subtree)
+      {
+        // relocate interior nodes' child indices; leaves' offsets index elements and are unchanged
+        if(!n.is_leaf()) n.offset += result;
+        nodes.push_back(n);
+      }
+
+      return result;
+    }
+
+    // a reference to an element, bounding the part of it within a node built by build_spatial()
+    struct reference
+    {
+      igloo::bounding_box bounding_box;
+      index_type element;
+    };
+
+    // builds the subtree over refs into m_nodes, appending its leaves' elements to m_elements, and returns the index of its root
+    // straddling references may be duplicated into both children of a spatial split while budget remains
+    template<class Function>
+    inline index_type build_spatial(std::vector<reference> refs,
+                                    Function clipped_bounding_box_of,
+                                    std::size_t depth,
+                                    float root_area,
+                                    std::size_t& budget)
+    {
+      index_type result = static_cast<index_type>(m_nodes.size());
+      m_nodes.emplace_back();
+
+      igloo::bounding_box bounds;
+      igloo::bounding_box centroid_bounds;
+      for(const reference& ref : refs)
+      {
+        bounds += ref.bounding_box;
+        centroid_bounds += centroid(ref.bounding_box);
+      }
+
+      m_nodes[result].bounding_box = bounds;
+
+      std::size_t n = refs.size();
+      std::vector<reference> left, right;
+      int axis = -1;
+
+      if(n > 1 && depth < max_sah_depth && bounds.surface_area() > 0.f)
+      {
+        const std::size_t num_bins = m_options.num_bins;
+        float inv_area = 1.f / bounds.surface_area();
+
+        // find the best object split, binning references by centroid
+        float lo[3], scale[3];
+        for(int a = 0; a < 3; ++a)
+        {
+          float extent = centroid_bounds.max()[a] - centroid_bounds.min()[a];
+          lo[a] = centroid_bounds.min()[a];
+          scale[a] = extent > 0.f ? num_bins / extent : 0.f;
+        }
+
+        bins object_bins(num_bins);
+        for(const reference& ref : refs)
+        {
+          point c = centroid(ref.bounding_box);
+          for(int a = 0; a < 3; ++a)
+          {
+            std::size_t b = bin_of(c[a], lo[a], scale[a], num_bins);
+            object_bins.bounds[a][b] += ref.bounding_box;
+            ++object_bins.counts[a][b];
+          }
+        }
+
+        split object{-1, std::numeric_limits<float>::infinity(), 0};
+        for(int a = 0; a < 3; ++a)
+        {
+          if(!(scale[a] > 0.f)) continue;
+
+          sweep(a, object_bins.bounds[a], object_bins.counts[a], object_bins.counts[a], inv_area, object);
+        }
+
+        // find the best spatial split, but only where the object split's children overlap substantially
+        split spatial{-1, std::numeric_limits<float>::infinity(), 0};
+        if(budget > 0 && object.axis >= 0)
+        {
+          igloo::bounding_box object_left, object_right;
+          for(std::size_t b = 0; b < num_bins; ++b)
+          {
+            (b < object.bin ? object_left : object_right) += object_bins.bounds[object.axis][b];
+          }
+
+          if(object_left.overlap(object_right).surface_area() > m_options.spatial_split_threshold * root_area)
+          {
+            spatial = find_spatial_split(refs, clipped_bounding_box_of, bounds, inv_area);
+          }
+        }
+
+        bool is_spatial = spatial.cost < object.cost;
+        split s = is_spatial ? spatial : object;
+
+        // create a leaf if intersecting all of its elements is expected to be cheaper than splitting
+        if(s.axis < 0 || (n <= m_options.max_leaf_size && float(n) <= s.cost))
+        {
+          if(n <= m_options.max_leaf_size)
+          {
+            return make_leaf(result, refs);
+          }
+        }
+        else if(is_spatial)
+        {
+          float width = (bounds.max()[s.axis] - bounds.min()[s.axis]) / num_bins;
+          float plane = bounds.min()[s.axis] + s.bin * width;
+
+          for(const reference& ref : refs)
+          {
+            if(ref.bounding_box.max()[s.axis] <= plane)
+            {
+              left.push_back(ref);
+            }
+            else if(ref.bounding_box.min()[s.axis] >= plane)
+            {
+              right.push_back(ref);
+            }
+            else
+            {
+              // clip a straddling reference to each side of the plane
+              igloo::bounding_box left_half = ref.bounding_box, right_half = ref.bounding_box;
+              left_half.max()[s.axis] = plane;
+              right_half.min()[s.axis] = plane;
+
+              igloo::bounding_box left_box  = clipped_bounding_box_of(std::size_t(ref.element), left_half).overlap(left_half);
+              igloo::bounding_box right_box = clipped_bounding_box_of(std::size_t(ref.element), right_half).overlap(right_half);
+
+              if(left_box.empty())
+              {
+                right.push_back(ref);
+              }
+              else if(right_box.empty())
+              {
+                left.push_back(ref);
+              }
+              else if(budget > 0)
+              {
+                --budget;
+                left.push_back(reference{left_box, ref.element});
+                right.push_back(reference{right_box, ref.element});
+              }
+              else
+              {
+                // the budget is exhausted, so place the reference entirely on the side of its centroid
+                (centroid(ref.bounding_box)[s.axis] < plane ? left : right).push_back(ref);
+              }
+            }
+          }
+
+          axis = s.axis;
+        }
+        else
+        {
+          for(const reference& ref : refs)
+          {
+            bool is_left = bin_of(centroid(ref.bounding_box)[s.axis], lo[s.axis], scale[s.axis], num_bins) < s.bin;
+            (is_left ? left : right).push_back(ref);
+          }
+
+          axis = s.axis;
+        }
+      }
+      else if(n <= m_options.max_leaf_size)
+      {
+        return make_leaf(result, refs);
+      }
+
+      if(axis < 0 || left.empty() || right.empty())
+      {
+        // split at the median centroid along the axis of greatest centroid extent
+        vector extent = centroid_bounds.max() - centroid_bounds.min();
+        axis = 0;
+        if(extent[1] > extent[axis]) axis = 1;
+        if(extent[2] > extent[axis]) axis = 2;
+
+        std::size_t middle = n / 2;
+        std::nth_element(refs.begin(), refs.begin() + middle, refs.end(), [=](const reference& a, const reference& b)
+        {
+          return centroid(a.bounding_box)[axis] < centroid(b.bounding_box)[axis];
+        });
+
+        left.assign(refs.begin(), refs.begin() + middle);
+        right.assign(refs.begin() + middle, refs.end());
+      }
+
+      // release this node's references before descending
+      refs.clear();
+      refs.shrink_to_fit();
+
+      build_spatial(std::move(left), clipped_bounding_box_of, depth + 1, root_area, budget);
+      index_type right_child = build_spatial(std::move(right), clipped_bounding_box_of, depth + 1, root_area, budget);
+
+      m_nodes[result].offset = right_child;
+      m_nodes[result].size = 0;
+      m_nodes[result].axis = static_cast<std::uint16_t>(axis);
+
+      return result;
+    }
+
+    // finds the spatial split of refs with the least estimated cost, binning space uniformly within bounds
+    // a reference is clipped into each bin it straddles
+    template<class Function>
+    inline split find_spatial_split(const std::vector<reference>& refs,
+                                    Function clipped_bounding_box_of,
+                                    const igloo::bounding_box& bounds,
+                                    float inv_area) const
+    {
+      const std::size_t num_bins = m_options.num_bins;
+
+      split result{-1, std::numeric_limits<float>::infinity(), 0};
+
+      std::vector<igloo::bounding_box> bin_bounds(num_bins);
+      std::vector<std::size_t> entries(num_bins), exits(num_bins);
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        float lo = bounds.min()[axis];
+        float extent = bounds.max()[axis] - lo;
+        if(!(extent > 0.f)) continue;
+
+        float scale = num_bins / extent;
+        float width = extent / num_bins;
+
+        std::fill(bin_bounds.begin(), bin_bounds.end(), igloo::bounding_box());
+        std::fill(entries.begin(), entries.end(), 0);
+        std::fill(exits.begin(), exits.end(), 0);
+
+        for(const reference& ref : refs)
+        {
+          std::size_t first = bin_of(ref.bounding_box.min()[axis], lo, scale, num_bins);
+          std::size_t last  = std::max(first, bin_of(ref.bounding_box.max()[axis], lo, scale, num_bins));
+
+          ++entries[first];
+          ++exits[last];
+
+          if(first == last)
+          {
+            bin_bounds[first] += ref.bounding_box;
+            continue;
+          }
+
+          // chop the reference into each bin it spans
+          for(std::size_t b = first; b <= last; ++b)
+          {
+            igloo::bounding_box slab = ref.bounding_box;
+            if(b > first) slab.min()[axis] = lo + b * width;
+            if(b < last)  slab.max()[axis] = lo + (b + 1) * width;
+
+            igloo::bounding_box piece = clipped_bounding_box_of(std::size_t(ref.element), slab).overlap(slab);
+            if(!piece.empty())
+            {
+              bin_bounds[b] += piece;
+            }
+          }
+        }
+
+        sweep(axis, bin_bounds, entries, exits, inv_area, result);
+      }
+
+      return result;
+    }
+
+    // turns the node at index n into a leaf referencing refs' elements
+    inline index_type make_leaf(index_type n, const std::vector<reference>& refs)
+    {
+      m_nodes[n].offset = static_cast<index_type>(m_elements.size());
+      m_nodes[n].size = static_cast<std::uint16_t>(refs.size());
+      m_nodes[n].axis = 0;
+
+      for(const reference& ref : refs)
+      {
+        m_elements.push_back(ref.element);
+      }
+
+      return n;
+    }
+
+    // visits the element ranges of leaves pierced by r until visit returns true
+    // max_t() returns the current end of the ray's interval
+    template<class Function1, class Function2>
+    inline bool traverse(const ray& r, Function1 max_t, Function2 visit) const
+    {
+      array_ref<const node> nodes = this->nodes();
+      if(nodes.empty()) return false;
+
+      const point& origin = r.origin();
+      vector inv_direction(1.f / r.direction().x, 1.f / r.direction().y, 1.f / r.direction().z);
+      bool direction_is_negative[3] = {inv_direction.x < 0, inv_direction.y < 0, inv_direction.z < 0};
+
+      // build() bounds the depth of the hierarchy, and each level adds at most one entry to the stack
+      index_type stack[max_depth + 1];
+      int top = 0;
+      stack[top++] = 0;
+
+      while(top > 0)
+      {
+        const node& n = nodes[stack[--top]];
+
+        if(!intersects(n.bounding_box, origin, inv_direction, r.begin(), max_t()))
+        {
+          continue;
+        }
+
+        if(n.is_leaf())
+        {
+          if(visit(n.offset, n.offset + n.size)) return true;
+        }
+        else
+        {
+          index_type left  = static_cast<index_type>(&n - nodes.data()) + 1;
+          index_type right = n.offset;
+
+          // push the far child first so the near child is visited first
+          if(direction_is_negative[n.axis])
+          {
+            stack[top++] = left;
+            stack[top++] = right;
+          }
+          else
+          {
+            stack[top++] = right;
+            stack[top++] = left;
+          }
+        }
+      }
+
+      return false;
+    }
+
+    // visits the element ranges of leaves pierced by the rays of packet in mask
+    // visit returns the lanes which retire from the traversal
+    template<class Function>
+    inline void traverse(const ray_packet& packet, ray_packet::mask_type mask, Function visit) const
+    {
+      array_ref<const node> nodes = this->nodes();
+      if(nodes.empty()) return;
+
+      struct entry
+      {
+        index_type node;
+        ray_packet::mask_type mask;
+      };
+
+      // build() bounds the depth of the hierarchy, and each level adds at most one entry to the stack
+      entry stack[max_depth + 1];
+      int top = 0;
+      stack[top++] = entry{0, mask};
+
+      ray_packet::mask_type active = mask;
+
+      while(top > 0 && active)
+      {
+        entry e = stack[--top];
+        const node& n = nodes[e.node];
+
+        // cull the node for the whole packet at once if the packet's frustum misses it
+        ray_packet::mask_type node_mask = e.mask & active;
+        if(!node_mask || packet.frustum_misses(n.bounding_box)) continue;
+
+        if(n.is_leaf())
+        {
+          // visit a leaf with exactly the rays which intersect it
+          node_mask = packet.intersects(n.bounding_box, node_mask);
+          if(node_mask)
+          {
+            active &= ~visit(n.offset, n.offset + n.size, node_mask);
+          }
+
+          continue;
+        }
+
+        // descend into an interior node once any ray intersects it, dropping only the rays tested before that one
+        node_mask = packet.first_intersecting(n.bounding_box, node_mask);
+        if(!node_mask) continue;
+
+        index_type left  = e.node + 1;
+        index_type right = n.offset;
+
+        // order the children by the direction of the first active ray, and push the far child first
+        if(packet.direction(ray_packet::first_lane(node_mask), n.axis) < 0.f)
+        {
+          stack[top++] = entry{left, node_mask};
+          stack[top++] = entry{right, node_mask};
+        }
+        else
+        {
+          stack[top++] = entry{right, node_mask};
+          stack[top++] = entry{left, node_mask};
+        }
+      }
+    }
+
+    std::size_t                        m_size;
+    std::vector<node>                  m_nodes;
+    std::vector<index_type>            m_elements;
+    std::shared_ptr<const mapped_file> m_mapping;
+    array_ref<const node>              m_mapped_nodes;
+    array_ref<const index_type>        m_mapped_elements;
+    bounding_volume_hierarchy_options  m_options;
+    double                             m_build_time;
+    float                              m_built_sah_cost;
+    bool                               m_is_mapped;
+};
+
+
+} // end igloo
+
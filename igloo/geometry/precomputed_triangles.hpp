@@ -0,0 +1,209 @@
+#pragma once
+
+#include <igloo/geometry/point.hpp>
+#include <igloo/geometry/vector.hpp>
+#include <igloo/geometry/ray.hpp>
+#include <igloo/utility/math_vector.hpp>
+#include <igloo/utility/optional.hpp>
+#include <vector>
+#include <array>
+#include <tuple>
+#include <cstddef>
+#include <cstdint>
+
+namespace igloo
+{
+
+
+/*! precomputed_triangles stores a copy of a collection of triangles in structure-of-arrays layout,
+ *  as a vertex and two edges per triangle, in the order in which a hierarchy's leaves reference them.
+ *  A leaf's triangles are contiguous, so intersecting them requires no gathers through an index buffer,
+ *  and the intersection kernel processes block_size triangles at a time in a loop the compiler can vectorize.
+ */
+class precomputed_triangles
+{
+  public:
+    // the number of triangles the intersection kernel processes at a time
+    static constexpr std::size_t block_size = 8;
+
+    /*! Creates an empty precomputed_triangles.
+     */
+    inline precomputed_triangles() = default;
+
+    /*! Creates a new precomputed_triangles.
+     *  \param points The points indexed by triangles.
+     *  \param triangles The triangles to precompute.
+     *  \param order The order in which to store triangles, e.g. a hierarchy's elements().
+     */
+    template<class Range>
+    inline precomputed_triangles(const std::vector<point>& points,
+                                 const std::vector<uint3>& triangles,
+                                 const Range& order)
+    {
+      // pad each array so that the kernel may read a whole block past any position
+      std::size_t n = order.size();
+      for(auto& component : m_components)
+      {
+        component.resize(n + block_size, 0.f);
+      }
+
+      for(std::size_t i = 0; i < n; ++i)
+      {
+        const uint3& tri = triangles[order[i]];
+
+        const point& p0 = points[tri.x];
+        vector e1 = points[tri.y] - p0;
+        vector e2 = points[tri.z] - p0;
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+          m_components[p0_x + axis][i] = p0[axis];
+          m_components[e1_x + axis][i] = e1[axis];
+          m_components[e2_x + axis][i] = e2[axis];
+        }
+      }
+    }
+
+    /*! \return The number of triangles stored.
+     */
+    inline std::size_t size() const
+    {
+      return m_components[0].empty() ? 0 : m_components[0].size() - block_size;
+    }
+
+    /*! Finds the nearest intersection between a ray and the triangles stored at positions [begin, end).
+     *  \param r The ray of interest.
+     *  \param begin The position of the first triangle to test.
+     *  \param end The position one past the last triangle to test.
+     *  \param max_t Only intersections nearer than max_t are considered.
+     *  \return nullopt if no intersection exists; otherwise, the position of the intersected triangle,
+     *          the ray parameter, and the barycentric coordinates at the intersection.
+     */
+    inline optional<std::tuple<std::size_t,float,float2>>
+      intersect(const ray& r, std::size_t begin, std::size_t end, float max_t) const
+    {
+      optional<std::tuple<std::size_t,float,float2>> result;
+
+      for(std::size_t block = begin; block < end; block += block_size)
+      {
+        float t[block_size], b0[block_size], b1[block_size];
+        bool hit[block_size];
+
+        intersect_block(r, block, end, max_t, t, b0, b1, hit);
+
+        for(std::size_t lane = 0; lane < block_size; ++lane)
+        {
+          if(hit[lane] && t[lane] < max_t)
+          {
+            max_t = t[lane];
+            result = std::make_tuple(block + lane, t[lane], float2(b0[lane], b1[lane]));
+          }
+        }
+      }
+
+      return result;
+    }
+
+    /*! Tests whether a ray intersects any of the triangles stored at positions [begin, end).
+     *  \param r The ray of interest.
+     *  \param begin The position of the first triangle to test.
+     *  \param end The position one past the last triangle to test.
+     *  \return true if an intersection exists; false, otherwise.
+     */
+    inline bool is_intersected(const ray& r, std::size_t begin, std::size_t end) const
+    {
+      return static_cast<bool>(find_intersected(r, begin, end));
+    }
+
+    /*! Finds a triangle stored at positions [begin, end) which a ray intersects, which need not be the nearest.
+     *  \param r The ray of interest.
+     *  \param begin The position of the first triangle to test.
+     *  \param end The position one past the last triangle to test.
+     *  \return nullopt if no intersection exists; otherwise, the position of an intersected triangle.
+     */
+    inline optional<std::size_t> find_intersected(const ray& r, std::size_t begin, std::size_t end) const
+    {
+      for(std::size_t block = begin; block < end; block += block_size)
+      {
+        float t[block_size], b0[block_size], b1[block_size];
+        bool hit[block_size];
+
+        intersect_block(r, block, end, r.end(), t, b0, b1, hit);
+
+        for(std::size_t lane = 0; lane < block_size; ++lane)
+        {
+          if(hit[lane]) return block + lane;
+        }
+      }
+
+      return nullopt;
+    }
+
+  private:
+    enum component
+    {
+      p0_x, p0_y, p0_z,
+      e1_x, e1_y, e1_z,
+      e2_x, e2_y, e2_z,
+      num_components
+    };
+
+    // intersects r with the block_size triangles beginning at position block
+    // this is the same computation as triangle_mesh::intersect(), with each lane computed unconditionally
+    inline void intersect_block(const ray& r, std::size_t block, std::size_t end, float max_t,
+                                float* t, float* b0, float* b1, bool* hit) const
+    {
+      const float ox = r.origin().x, oy = r.origin().y, oz = r.origin().z;
+      const float dx = r.direction().x, dy = r.direction().y, dz = r.direction().z;
+      const float t0 = r.begin(), t1 = r.end();
+
+      const float* p0x = m_components[p0_x].data() + block;
+      const float* p0y = m_components[p0_y].data() + block;
+      const float* p0z = m_components[p0_z].data() + block;
+      const float* e1x = m_components[e1_x].data() + block;
+      const float* e1y = m_components[e1_y].data() + block;
+      const float* e1z = m_components[e1_z].data() + block;
+      const float* e2x = m_components[e2_x].data() + block;
+      const float* e2y = m_components[e2_y].data() + block;
+      const float* e2z = m_components[e2_z].data() + block;
+
+      for(std::size_t lane = 0; lane < block_size; ++lane)
+      {
+        // s1 = direction x e2
+        float s1x = dy * e2z[lane] - dz * e2y[lane];
+        float s1y = dz * e2x[lane] - dx * e2z[lane];
+        float s1z = dx * e2y[lane] - dy * e2x[lane];
+
+        float divisor = s1x * e1x[lane] + s1y * e1y[lane] + s1z * e1z[lane];
+        float inv_divisor = 1.0f / divisor;
+
+        // d = origin - p0
+        float ddx = ox - p0x[lane];
+        float ddy = oy - p0y[lane];
+        float ddz = oz - p0z[lane];
+
+        b0[lane] = (ddx * s1x + ddy * s1y + ddz * s1z) * inv_divisor;
+
+        // s2 = d x e1
+        float s2x = ddy * e1z[lane] - ddz * e1y[lane];
+        float s2y = ddz * e1x[lane] - ddx * e1z[lane];
+        float s2z = ddx * e1y[lane] - ddy * e1x[lane];
+
+        b1[lane] = (dx * s2x + dy * s2y + dz * s2z) * inv_divisor;
+
+        t[lane] = inv_divisor * (e2x[lane] * s2x + e2y[lane] * s2y + e2z[lane] * s2z);
+
+        hit[lane] = (block + lane < end) &
+                    (divisor != 0.0f) &
+                    (b0[lane] >= 0.0f) & (b0[lane] <= 1.0f) &
+                    (b1[lane] >= 0.0f) & (b0[lane] + b1[lane] <= 1.0f) &
+                    (t[lane] >= t0) & (t[lane] <= t1) & (t[lane] < max_t);
+      }
+    }
+
+    std::array<std::vector<float>, num_components> m_components;
+};
+
+
+} // end igloo
+
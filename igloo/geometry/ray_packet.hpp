@@ -0,0 +1,291 @@
+#pragma once
+
+#include <igloo/geometry/ray.hpp>
+#include <igloo/geometry/point.hpp>
+#include <igloo/geometry/vector.hpp>
+#include <igloo/geometry/bounding_box.hpp>
+#include <algorithm>
+#include <utility>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+namespace igloo
+{
+
+
+/*! A ray_packet groups up to max_size coherent rays, e.g. primary rays through neighboring pixels or
+ *  shadow rays leaving a common point, so that a hierarchy may traverse them together with a single stack.
+ *  Rays are stored in structure-of-arrays layout, and subsets of a packet's rays are identified by masks
+ *  whose bit i selects the ray in lane i.
+ */
+class ray_packet
+{
+  public:
+    // the maximum number of rays in a packet
+    static constexpr std::size_t max_size = 16;
+
+    using mask_type = std::uint32_t;
+
+    /*! Creates an empty ray_packet.
+     */
+    inline ray_packet()
+      : m_size(0),
+        m_has_frustum(true)
+    {
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        m_origin_min[axis] = m_inv_direction_min[axis] =  std::numeric_limits<float>::infinity();
+        m_origin_max[axis] = m_inv_direction_max[axis] = -std::numeric_limits<float>::infinity();
+      }
+
+      m_begin_min = std::numeric_limits<float>::infinity();
+      m_end_max = -std::numeric_limits<float>::infinity();
+    }
+
+    /*! Adds a ray to the next lane of this ray_packet.
+     *  \param r The ray to add.
+     *  \note size() must be less than max_size.
+     */
+    inline void push_back(const ray& r)
+    {
+      std::size_t lane = m_size++;
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        float inv_direction = 1.f / r.direction()[axis];
+
+        m_origin[axis][lane] = r.origin()[axis];
+        m_direction[axis][lane] = r.direction()[axis];
+        m_inv_direction[axis][lane] = inv_direction;
+
+        m_origin_min[axis] = std::min(m_origin_min[axis], r.origin()[axis]);
+        m_origin_max[axis] = std::max(m_origin_max[axis], r.origin()[axis]);
+        m_inv_direction_min[axis] = std::min(m_inv_direction_min[axis], inv_direction);
+        m_inv_direction_max[axis] = std::max(m_inv_direction_max[axis], inv_direction);
+
+        // the frustum requires every ray to travel in the same direction along each axis
+        bool is_finite = std::abs(inv_direction) < std::numeric_limits<float>::infinity();
+        bool same_sign = (m_inv_direction_min[axis] > 0.f) == (m_inv_direction_max[axis] > 0.f);
+        m_has_frustum = m_has_frustum && is_finite && same_sign;
+      }
+
+      m_begin[lane] = r.begin();
+      m_end[lane] = r.end();
+
+      m_begin_min = std::min(m_begin_min, r.begin());
+      m_end_max = std::max(m_end_max, r.end());
+    }
+
+    /*! \return The number of rays in this ray_packet.
+     */
+    inline std::size_t size() const
+    {
+      return m_size;
+    }
+
+    /*! \return true if this ray_packet holds max_size rays; false, otherwise.
+     */
+    inline bool full() const
+    {
+      return m_size == max_size;
+    }
+
+    /*! \return A mask selecting every ray of this ray_packet.
+     */
+    inline mask_type lanes() const
+    {
+      return (mask_type(1) << m_size) - 1;
+    }
+
+    /*! \return The ray in the given lane.
+     */
+    inline ray operator[](std::size_t lane) const
+    {
+      return ray(point(m_origin[0][lane], m_origin[1][lane], m_origin[2][lane]),
+                 vector(m_direction[0][lane], m_direction[1][lane], m_direction[2][lane]),
+                 m_end[lane]);
+    }
+
+    /*! \return The direction of the ray in the given lane along the given axis.
+     */
+    inline float direction(std::size_t lane, int axis) const
+    {
+      return m_direction[axis][lane];
+    }
+
+    /*! \return The end of the interval of the ray in the given lane.
+     */
+    inline float end(std::size_t lane) const
+    {
+      return m_end[lane];
+    }
+
+    /*! Sets the end of the interval of the ray in the given lane, e.g. to the nearest intersection found so far.
+     */
+    inline void end(std::size_t lane, float t)
+    {
+      m_end[lane] = t;
+    }
+
+    /*! Calls f with the index of each lane selected by mask, in increasing order.
+     */
+    template<class Function>
+    inline static void for_each_lane(mask_type mask, Function f)
+    {
+      for(std::size_t lane = 0; mask != 0; ++lane, mask >>= 1)
+      {
+        if(mask & 1) f(lane);
+      }
+    }
+
+    /*! \return The index of the first lane selected by mask, which must be nonzero.
+     */
+    inline static std::size_t first_lane(mask_type mask)
+    {
+      std::size_t result = 0;
+      for(; !(mask & 1); mask >>= 1)
+      {
+        ++result;
+      }
+
+      return result;
+    }
+
+    /*! Tests whether the frustum bounding this ray_packet's rays misses a bounding_box, in which case every ray misses it.
+     *  The test bounds each ray's entry into and exit from box by interval arithmetic over the rays' origins and directions.
+     *  \param box The bounding_box of interest.
+     *  \return true if no ray of this ray_packet can intersect box; false, if some ray may intersect it,
+     *          or if this ray_packet's rays do not share the signs of their directions.
+     */
+    inline bool frustum_misses(const igloo::bounding_box& box) const
+    {
+      if(!m_has_frustum) return false;
+
+      // no ray enters box before entry, and no ray leaves it after exit
+      float entry = m_begin_min;
+      float exit = m_end_max;
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        bool is_negative = m_inv_direction_max[axis] < 0.f;
+
+        float near_plane = is_negative ? box.max()[axis] : box.min()[axis];
+        float far_plane  = is_negative ? box.min()[axis] : box.max()[axis];
+
+        entry = std::max(entry, min_product(near_plane - m_origin_max[axis], near_plane - m_origin_min[axis], axis));
+        exit  = std::min(exit,  max_product(far_plane  - m_origin_max[axis], far_plane  - m_origin_min[axis], axis));
+      }
+
+      return entry > exit;
+    }
+
+    /*! Finds the first ray of this ray_packet which intersects a bounding_box.
+     *  Coherent rays tend to intersect the same boxes, so testing lanes in order until one hits
+     *  is usually much cheaper than testing every lane.
+     *  \param box The bounding_box of interest.
+     *  \param mask The lanes to test.
+     *  \return The lanes of mask from the first whose ray's interval overlaps box onward, or 0 if none does.
+     */
+    inline mask_type first_intersecting(const igloo::bounding_box& box, mask_type mask) const
+    {
+      for(mask_type remaining = mask; remaining != 0; remaining &= remaining - 1)
+      {
+        std::size_t lane = first_lane(remaining);
+
+        if(intersects(box, lane))
+        {
+          return remaining;
+        }
+      }
+
+      return 0;
+    }
+
+    /*! Tests the rays of this ray_packet against a bounding_box.
+     *  \param box The bounding_box of interest.
+     *  \param mask The lanes to test.
+     *  \return The lanes of mask whose rays' intervals overlap box.
+     */
+    inline mask_type intersects(const igloo::bounding_box& box, mask_type mask) const
+    {
+      mask_type result = 0;
+
+      // test every lane, which the compiler can vectorize, and discard the lanes outside of mask afterward
+      for(std::size_t lane = 0; lane < m_size; ++lane)
+      {
+        float t0 = m_begin[lane];
+        float t1 = m_end[lane];
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+          float t_near = (box.min()[axis] - m_origin[axis][lane]) * m_inv_direction[axis][lane];
+          float t_far  = (box.max()[axis] - m_origin[axis][lane]) * m_inv_direction[axis][lane];
+
+          float lo = t_near > t_far ? t_far  : t_near;
+          float hi = t_near > t_far ? t_near : t_far;
+
+          // comparisons against NaN fail, so a ray lying in a slab's plane leaves the interval unchanged
+          t0 = lo > t0 ? lo : t0;
+          t1 = hi < t1 ? hi : t1;
+        }
+
+        result |= mask_type(t0 <= t1) << lane;
+      }
+
+      return result & mask;
+    }
+
+  private:
+    inline bool intersects(const igloo::bounding_box& box, std::size_t lane) const
+    {
+      float t0 = m_begin[lane];
+      float t1 = m_end[lane];
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        float t_near = (box.min()[axis] - m_origin[axis][lane]) * m_inv_direction[axis][lane];
+        float t_far  = (box.max()[axis] - m_origin[axis][lane]) * m_inv_direction[axis][lane];
+
+        if(t_near > t_far) std::swap(t_near, t_far);
+
+        t0 = t_near > t0 ? t_near : t0;
+        t1 = t_far  < t1 ? t_far  : t1;
+
+        if(t0 > t1) return false;
+      }
+
+      return true;
+    }
+
+    // the least and greatest products of the interval [lo, hi] with the rays' inverse directions along axis
+    inline float min_product(float lo, float hi, int axis) const
+    {
+      return std::min(std::min(lo * m_inv_direction_min[axis], lo * m_inv_direction_max[axis]),
+                      std::min(hi * m_inv_direction_min[axis], hi * m_inv_direction_max[axis]));
+    }
+
+    inline float max_product(float lo, float hi, int axis) const
+    {
+      return std::max(std::max(lo * m_inv_direction_min[axis], lo * m_inv_direction_max[axis]),
+                      std::max(hi * m_inv_direction_min[axis], hi * m_inv_direction_max[axis]));
+    }
+
+    float m_origin[3][max_size];
+    float m_direction[3][max_size];
+    float m_inv_direction[3][max_size];
+    float m_begin[max_size];
+    float m_end[max_size];
+    std::size_t m_size;
+
+    // the bounds of the frustum containing every ray
+    float m_origin_min[3], m_origin_max[3];
+    float m_inv_direction_min[3], m_inv_direction_max[3];
+    float m_begin_min, m_end_max;
+    bool m_has_frustum;
+}; // end ray_packet
+
+
+} // end igloo
+
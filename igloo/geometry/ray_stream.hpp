@@ -0,0 +1,199 @@
+#pragma once
+
+#include <igloo/geometry/ray.hpp>
+#include <igloo/geometry/point.hpp>
+#include <igloo/geometry/vector.hpp>
+#include <igloo/geometry/bounding_box.hpp>
+#include <igloo/utility/array_ref.hpp>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+namespace igloo
+{
+
+
+/*! A ray_stream holds a large batch of possibly incoherent rays, e.g. the secondary rays of many paths,
+ *  so that a hierarchy may traverse them together, filtering the stream down to the rays which intersect each node.
+ *  Rays are stored in structure-of-arrays layout, with each coordinate of their origins and directions in an array of its own,
+ *  and identified by their index into the batch.
+ *  Subsets of a stream's rays are arrays of such indices.
+ */
+class ray_stream
+{
+  public:
+    using index_type = std::uint32_t;
+
+    /*! Creates a new ray_stream.
+     *  \param rays The rays of interest.
+     */
+    inline ray_stream(array_ref<const ray> rays)
+      : m_begin(rays.size()),
+        m_end(rays.size())
+    {
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        m_origin[axis].resize(rays.size());
+        m_direction[axis].resize(rays.size());
+        m_inv_direction[axis].resize(rays.size());
+      }
+
+      for(std::size_t i = 0; i < rays.size(); ++i)
+      {
+        for(int axis = 0; axis < 3; ++axis)
+        {
+          m_origin[axis][i] = rays[i].origin()[axis];
+          m_direction[axis][i] = rays[i].direction()[axis];
+          m_inv_direction[axis][i] = 1.f / rays[i].direction()[axis];
+        }
+
+        m_begin[i] = rays[i].begin();
+        m_end[i] = rays[i].end();
+      }
+    }
+
+    /*! \return The number of rays in this ray_stream.
+     */
+    inline std::size_t size() const
+    {
+      return m_end.size();
+    }
+
+    /*! \return The ray with the given index.
+     */
+    inline ray operator[](index_type i) const
+    {
+      return ray(point(m_origin[0][i], m_origin[1][i], m_origin[2][i]),
+                 vector(m_direction[0][i], m_direction[1][i], m_direction[2][i]),
+                 m_end[i]);
+    }
+
+    /*! \return The direction of the ray with the given index along the given axis.
+     */
+    inline float direction(index_type i, int axis) const
+    {
+      return m_direction[axis][i];
+    }
+
+    /*! \return The end of the interval of the ray with the given index.
+     */
+    inline float end(index_type i) const
+    {
+      return m_end[i];
+    }
+
+    /*! Sets the end of the interval of the ray with the given index, e.g. to the nearest intersection found so far.
+     */
+    inline void end(index_type i, float t)
+    {
+      m_end[i] = t;
+    }
+
+    /*! Removes the ray with the given index from further traversal, e.g. once it is known to be occluded.
+     */
+    inline void retire(index_type i)
+    {
+      m_end[i] = -std::numeric_limits<float>::infinity();
+    }
+
+    /*! \return true if the ray with the given index was retired; false, otherwise.
+     */
+    inline bool is_retired(index_type i) const
+    {
+      return m_end[i] == -std::numeric_limits<float>::infinity();
+    }
+
+    /*! Orders the indices of this ray_stream's rays so that similar rays are adjacent.
+     *  Rays are grouped by the octant of their direction, and within an octant by the cell containing their origin
+     *  along a Morton curve through a grid over bounds. Traversing a stream in this order keeps the rays which
+     *  reach each node, and so the nodes and elements they touch, close together.
+     *  \param bounds A bounding_box bounding the rays' origins, e.g. the bounds of the scene.
+     *  \return The indices of this ray_stream's rays in order.
+     */
+    inline std::vector<index_type> sorted_indices(const igloo::bounding_box& bounds) const
+    {
+      std::vector<std::pair<std::uint64_t,index_type>> keys(size());
+
+      vector extent = bounds.max() - bounds.min();
+
+      for(std::size_t i = 0; i < size(); ++i)
+      {
+        std::uint64_t octant = 0;
+        std::uint64_t cell = 0;
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+          octant |= std::uint64_t(m_direction[axis][i] < 0.f) << axis;
+
+          // quantize the origin to one of 2^10 cells along each axis, clamping origins outside of bounds
+          float x = extent[axis] > 0.f ? (m_origin[axis][i] - bounds.min()[axis]) / extent[axis] : 0.f;
+          x = std::min(std::max(x, 0.f), 1.f);
+
+          cell |= spread_bits(std::min<std::uint64_t>(static_cast<std::uint64_t>(x * 1024.f), 1023)) << axis;
+        }
+
+        keys[i] = std::make_pair((octant << 30) | cell, static_cast<index_type>(i));
+      }
+
+      std::sort(keys.begin(), keys.end());
+
+      std::vector<index_type> result(size());
+      for(std::size_t i = 0; i < size(); ++i)
+      {
+        result[i] = keys[i].second;
+      }
+
+      return result;
+    }
+
+    /*! Tests a ray of this ray_stream against a bounding_box.
+     *  \param box The bounding_box of interest.
+     *  \param i The index of the ray of interest.
+     *  \return true if the ray's interval overlaps box; false, otherwise, or if the ray was retired.
+     */
+    inline bool intersects(const igloo::bounding_box& box, index_type i) const
+    {
+      float t0 = m_begin[i];
+      float t1 = m_end[i];
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        float t_near = (box.min()[axis] - m_origin[axis][i]) * m_inv_direction[axis][i];
+        float t_far  = (box.max()[axis] - m_origin[axis][i]) * m_inv_direction[axis][i];
+
+        if(t_near > t_far) std::swap(t_near, t_far);
+
+        t0 = t_near > t0 ? t_near : t0;
+        t1 = t_far  < t1 ? t_far  : t1;
+
+        if(t0 > t1) return false;
+      }
+
+      return true;
+    }
+
+  private:
+    // spreads the low 10 bits of x so that two zero bits separate each
+    inline static std::uint64_t spread_bits(std::uint64_t x)
+    {
+      x = (x | (x << 16)) & 0x030000FF;
+      x = (x | (x <<  8)) & 0x0300F00F;
+      x = (x | (x <<  4)) & 0x030C30C3;
+      x = (x | (x <<  2)) & 0x09249249;
+      return x;
+    }
+
+    // the x, y, and z coordinates of the rays' origins, directions, and inverse directions, each in an array of its own
+    std::vector<float> m_origin[3];
+    std::vector<float> m_direction[3];
+    std::vector<float> m_inv_direction[3];
+    std::vector<float> m_begin;
+    std::vector<float> m_end;
+}; // end ray_stream
+
+
+} // end igloo
+
@@ -118,6 +118,12 @@ point transform::inverse_transform(const point &p) const
 } // end transform::inverse_transform()
 
 
+vector transform::inverse_transform(const vector &v) const
+{
+  return transform_vector(m_inv, v);
+} // end transform::inverse_transform()
+
+
 normal transform::inverse_transform(const normal &n) const
 {
   // note we send the transform itself, not its inverse
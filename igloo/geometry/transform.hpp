@@ -71,6 +71,12 @@ class transform
      */
     point inverse_transform(const point &p) const;
 
+    /*! Transforms a vector by applying this transform's inverse.
+     *  \param v The vector to transform.
+     *  \return v transformed by this transform's inverse.
+     */
+    vector inverse_transform(const vector &v) const;
+
     /*! Transforms a normal by applying this transform's inverse.
      *  \param n The normal to transform.
      *  \return n transformed by this transform's inverse.
@@ -5,14 +5,21 @@
 #include <utility>
 #include <tuple>
 #include <type_traits>
-#include <dependencies/bounding_box_hierarchy/bounding_box_hierarchy.hpp>
+#include <string>
+#include <cstdio>
 #include <igloo/utility/requires.hpp>
 #include <igloo/utility/optional.hpp>
+#include <igloo/utility/hash.hpp>
 #include <igloo/geometry/bounding_box.hpp>
+#include <igloo/geometry/bounding_volume_hierarchy.hpp>
+#include <igloo/geometry/wide_bounding_volume_hierarchy.hpp>
+#include <igloo/geometry/precomputed_triangles.hpp>
 #include <igloo/geometry/point.hpp>
 #include <igloo/geometry/parametric.hpp>
 #include <igloo/geometry/normal.hpp>
 #include <igloo/geometry/ray.hpp>
+#include <igloo/geometry/ray_packet.hpp>
+#include <igloo/geometry/ray_stream.hpp>
 
 namespace igloo
 {
@@ -49,16 +56,140 @@ class triangle_mesh
                          Range1&& points,
                          Range2&& parametrics,
                          Range3&& normals,
-                         Range4&& triangles)
+                         Range4&& triangles,
+                         const bounding_volume_hierarchy_options& options)
       : m_points(std::forward<Range1>(points)),
         m_parametrics(std::forward<Range2>(parametrics)),
         m_normals(std::forward<Range3>(normals)),
         m_triangles(std::forward<Range4>(triangles)),
-        m_bbh(m_triangles, [this](const triangle& tri)
+        m_hierarchy(load_or_build_hierarchy(validated(options)))
+    {
+      derive_from_hierarchy();
+    }
+
+    // returns options after checking the options which the hierarchy's owner interprets,
+    // before the hierarchy is built or cached
+    inline static const bounding_volume_hierarchy_options& validated(const bounding_volume_hierarchy_options& options)
+    {
+      if(options.width != 2 && options.width != 4 && options.width != 8)
+      {
+        throw std::logic_error("triangle_mesh ctor: options.width must be 2, 4, or 8");
+      }
+
+      if(options.quantization_bits != 0 && options.quantization_bits != 8 && options.quantization_bits != 16)
+      {
+        throw std::logic_error("triangle_mesh ctor: options.quantization_bits must be 0, 8, or 16");
+      }
+
+      if(options.quantization_bits != 0 && options.width == 2)
+      {
+        throw std::logic_error("triangle_mesh ctor: options.quantization_bits requires options.width of 4 or 8");
+      }
+
+      return options;
+    }
+
+    inline bounding_volume_hierarchy build_hierarchy(const bounding_volume_hierarchy_options& options) const
+    {
+      return bounding_volume_hierarchy(m_triangles.size(), [this](std::size_t i)
+      {
+        return bounding_box(m_triangles[i]);
+      },
+      [this](std::size_t i, const igloo::bounding_box& box)
+      {
+        return bounding_box(m_triangles[i], box);
+      },
+      options);
+    }
+
+    // maps the hierarchy cached for this triangle_mesh's points and triangles in options.cache_directory,
+    // or builds it and adds it to the cache if it is absent
+    inline bounding_volume_hierarchy load_or_build_hierarchy(const bounding_volume_hierarchy_options& options) const
+    {
+      if(options.cache_directory.empty())
+      {
+        return build_hierarchy(options);
+      }
+
+      std::uint64_t key = hash_bytes(m_points.data(), m_points.size() * sizeof(point));
+      key = hash_bytes(m_triangles.data(), m_triangles.size() * sizeof(triangle), key);
+
+      // hierarchies built over the same triangles with different options are cached side by side
+      char name[64];
+      std::snprintf(name, sizeof(name), "%016llx-%016llx.bvh", static_cast<unsigned long long>(key),
+                    static_cast<unsigned long long>(bounding_volume_hierarchy::options_key(options)));
+      std::string filename = options.cache_directory + "/" + name;
+
+      auto cached = bounding_volume_hierarchy::map(filename, key, m_triangles.size(), options);
+      if(cached)
+      {
+        return std::move(*cached);
+      }
+
+      bounding_volume_hierarchy result = build_hierarchy(options);
+
+      // caching is an optimization, so a failure to write the cache is not an error
+      result.write(filename, key);
+
+      return result;
+    }
+
+    // (re)creates the structures derived from a newly built m_hierarchy and m_points
+    inline void derive_from_hierarchy()
+    {
+      bounding_volume_hierarchy_options options = m_hierarchy.options();
+
+      if(options.width == 4)
+      {
+        if(options.quantization_bits == 8)
         {
-          return bounding_box(tri);
-        })
-    {}
+          m_quantized8_hierarchy4.emplace(m_hierarchy);
+        }
+        else if(options.quantization_bits == 16)
+        {
+          m_quantized16_hierarchy4.emplace(m_hierarchy);
+        }
+        else
+        {
+          m_hierarchy4.emplace(m_hierarchy);
+        }
+      }
+      else if(options.width == 8)
+      {
+        if(options.quantization_bits == 8)
+        {
+          m_quantized8_hierarchy8.emplace(m_hierarchy);
+        }
+        else if(options.quantization_bits == 16)
+        {
+          m_quantized16_hierarchy8.emplace(m_hierarchy);
+        }
+        else
+        {
+          m_hierarchy8.emplace(m_hierarchy);
+        }
+      }
+
+      // the wide hierarchy shares nothing with the binary one, so keep only the record of the binary one's construction
+      if(options.width != 2)
+      {
+        m_hierarchy.clear();
+      }
+
+      precompute_triangles();
+    }
+
+    // copies the triangles' points in the order of the traversed hierarchy's leaves if options ask for it
+    inline void precompute_triangles()
+    {
+      if(m_hierarchy.options().precompute_leaves)
+      {
+        with_traversed_hierarchy([&](const auto& hierarchy)
+        {
+          m_precomputed_triangles.emplace(m_points, m_triangles, hierarchy.elements());
+        });
+      }
+    }
 
   public:
     template<class Range1, class Range2,
@@ -67,12 +198,14 @@ class triangle_mesh
                std::is_constructible<triangle_container, Range2&&>::value
              )>
     inline triangle_mesh(Range1&& points,
-                         Range2&& triangles)
+                         Range2&& triangles,
+                         const bounding_volume_hierarchy_options& options = bounding_volume_hierarchy_options())
       : triangle_mesh(construct_privately_t{},
                       std::forward<Range1>(points),
                       std::vector<parametric>(),
                       std::vector<normal>(),
-                      std::forward<Range2>(triangles))
+                      std::forward<Range2>(triangles),
+                      options)
     {}
 
 
@@ -84,12 +217,14 @@ class triangle_mesh
              )>
     inline triangle_mesh(Range1&& points,
                          Range2&& parametrics,
-                         Range3&& triangles)
+                         Range3&& triangles,
+                         const bounding_volume_hierarchy_options& options = bounding_volume_hierarchy_options())
       : triangle_mesh(construct_privately_t{},
                       std::forward<Range1>(points),
                       std::forward<Range2>(parametrics),
                       std::vector<normal>(),
-                      std::forward<Range3>(triangles))
+                      std::forward<Range3>(triangles),
+                      options)
     {
       if(m_parametrics.size() != m_points.size())
       {
@@ -106,12 +241,14 @@ class triangle_mesh
              )>
     inline triangle_mesh(Range1&& points,
                          Range2&& normals,
-                         Range3&& triangles)
+                         Range3&& triangles,
+                         const bounding_volume_hierarchy_options& options = bounding_volume_hierarchy_options())
       : triangle_mesh(construct_privately_t{},
                       std::forward<Range1>(points),
                       std::vector<parametric>(),
                       std::forward<Range2>(normals),
-                      std::forward<Range3>(triangles))
+                      std::forward<Range3>(triangles),
+                      options)
     {
       if(m_normals.size() != m_points.size())
       {
@@ -128,12 +265,14 @@ class triangle_mesh
              )>
     inline triangle_mesh(Range1&& points,
                          Range2&& triangles,
-                         Range3&& normals)
+                         Range3&& normals,
+                         const bounding_volume_hierarchy_options& options = bounding_volume_hierarchy_options())
       : triangle_mesh(construct_privately_t{},
                       std::forward<Range1>(points),
                       std::vector<parametric>(),
                       std::forward<Range3>(normals),
-                      std::forward<Range2>(triangles))
+                      std::forward<Range2>(triangles),
+                      options)
     {
       if(m_normals.size() != m_triangles.size())
       {
@@ -152,12 +291,14 @@ class triangle_mesh
     inline triangle_mesh(Range1&& points,
                          Range2&& parametrics,
                          Range3&& normals,
-                         Range4&& triangles)
+                         Range4&& triangles,
+                         const bounding_volume_hierarchy_options& options = bounding_volume_hierarchy_options())
       : triangle_mesh(construct_privately_t{},
                       std::forward<Range1>(points),
                       std::forward<Range2>(parametrics),
                       std::forward<Range3>(normals),
-                      std::forward<Range4>(triangles))
+                      std::forward<Range4>(triangles),
+                      options)
     {
       if(m_parametrics.size() != m_points.size())
       {
@@ -181,12 +322,14 @@ class triangle_mesh
     inline triangle_mesh(Range1&& points,
                          Range2&& parametrics,
                          Range3&& triangles,
-                         Range4&& normals)
+                         Range4&& normals,
+                         const bounding_volume_hierarchy_options& options = bounding_volume_hierarchy_options())
       : triangle_mesh(construct_privately_t{},
                       std::forward<Range1>(points),
                       std::forward<Range2>(parametrics),
                       std::forward<Range4>(normals),
-                      std::forward<Range3>(triangles))
+                      std::forward<Range3>(triangles),
+                      options)
     {
       if(m_parametrics.size() != m_points.size())
       {
@@ -200,6 +343,79 @@ class triangle_mesh
     }
 
 
+    /*! \return The binary bounding_volume_hierarchy built over this triangle_mesh's triangles.
+     *  \note When options.width is 4 or 8, the binary hierarchy's nodes and elements are released once collapsed into
+     *        the wide hierarchy which queries traverse, and only the record of its construction remains;
+     *        see with_traversed_hierarchy().
+     */
+    inline const bounding_volume_hierarchy& hierarchy() const
+    {
+      return m_hierarchy;
+    } // end hierarchy()
+
+
+    /*! Moves this triangle_mesh's points, keeping its triangles.
+     *  The traversed hierarchy is refit to the new points, and rebuilt only if refitting degraded it
+     *  past hierarchy().options().rebuild_threshold.
+     *  \param points The new points.
+     *  \note points.size() must equal vertices_size().
+     */
+    template<class Range,
+             IGLOO_REQUIRES(
+               std::is_constructible<point_container, Range&&>::value
+             )>
+    inline void update_points(Range&& points)
+    {
+      point_container new_points(std::forward<Range>(points));
+      if(new_points.size() != m_points.size())
+      {
+        throw std::logic_error("triangle_mesh::update_points(): points.size() != vertices_size()");
+      }
+
+      m_points = std::move(new_points);
+
+      auto bounding_box_of = [this](std::size_t i)
+      {
+        return bounding_box(m_triangles[i]);
+      };
+
+      // a wide hierarchy is refit in place, without the binary hierarchy it was collapsed from
+      if(refit_traversed_hierarchy(bounding_box_of))
+      {
+        m_hierarchy = build_hierarchy(m_hierarchy.options());
+        derive_from_hierarchy();
+      }
+      else
+      {
+        precompute_triangles();
+      }
+    } // end update_points()
+
+
+    /*! Moves this triangle_mesh's points and replaces its normals, keeping its triangles.
+     *  \param points The new points.
+     *  \param normals The new normals.
+     *  \note points.size() must equal vertices_size() and normals.size() must equal normals_size().
+     */
+    template<class Range1, class Range2,
+             IGLOO_REQUIRES(
+               std::is_constructible<point_container, Range1&&>::value and
+               std::is_constructible<normal_container, Range2&&>::value
+             )>
+    inline void update_points(Range1&& points, Range2&& normals)
+    {
+      normal_container new_normals(std::forward<Range2>(normals));
+      if(new_normals.size() != m_normals.size())
+      {
+        throw std::logic_error("triangle_mesh::update_points(): normals.size() != normals_size()");
+      }
+
+      update_points(std::forward<Range1>(points));
+
+      m_normals = std::move(new_normals);
+    } // end update_points()
+
+
     /*! \return normals_size() == vertices_size()
      */
     inline bool has_vertex_normals() const
@@ -372,6 +588,69 @@ class triangle_mesh
       return result;
     }
 
+    /// Returns a bounding_box bounding the part of the given triangle within a bounding_box.
+    /// \param tri The triangle of interest.
+    /// \param box The bounding_box to clip tri to.
+    /// \return A bounding_box bounding the polygon resulting from clipping tri to box, which is empty if they are disjoint.
+    igloo::bounding_box bounding_box(const triangle& tri, const igloo::bounding_box& box) const
+    {
+      // clip the triangle against each of box's six planes in turn
+      // each plane adds at most one vertex to the polygon
+      point polygon[9], clipped[9];
+      int n = 3;
+      polygon[0] = m_points[tri[0]];
+      polygon[1] = m_points[tri[1]];
+      polygon[2] = m_points[tri[2]];
+
+      for(int plane = 0; plane < 6 && n > 0; ++plane)
+      {
+        int axis = plane / 2;
+        bool is_max = plane % 2;
+        float bound = is_max ? box.max()[axis] : box.min()[axis];
+
+        auto inside = [=](const point& p)
+        {
+          return is_max ? p[axis] <= bound : p[axis] >= bound;
+        };
+
+        int m = 0;
+        for(int i = 0; i < n; ++i)
+        {
+          const point& p0 = polygon[i];
+          const point& p1 = polygon[(i + 1) % n];
+
+          if(inside(p0)) clipped[m++] = p0;
+
+          if(inside(p0) != inside(p1))
+          {
+            float t = (bound - p0[axis]) / (p1[axis] - p0[axis]);
+            point p = p0 + t * (p1 - p0);
+            p[axis] = bound;
+            clipped[m++] = p;
+          }
+        }
+
+        std::copy(clipped, clipped + m, polygon);
+        n = m;
+      }
+
+      igloo::bounding_box result;
+      for(int i = 0; i < n; ++i)
+      {
+        result += polygon[i];
+      }
+
+      // guard against rounding carrying intersection points outside of box
+      return n > 0 ? result.overlap(box) : result;
+    }
+
+    /// Returns a bounding_box bounding this triangle_mesh.
+    /// \return A bounding_box bounding all the points of this triangle_mesh.
+    igloo::bounding_box bounding_box() const
+    {
+      return std::accumulate(points_begin(), points_end(), igloo::bounding_box());
+    }
+
     /*! Tests a ray and a triangle for intersection.
      *  \param r The ray of interest.
      *  \param tri The triangle of interest.
@@ -431,41 +710,269 @@ class triangle_mesh
     inline optional<std::tuple<triangle_iterator,float,barycentric>>
       intersect(const ray &r) const
     {
-      using intersection = optional<std::tuple<triangle_iterator,float,barycentric>>;
+      return with_traversed_hierarchy([&](const auto& hierarchy)
+      {
+        return this->intersect(hierarchy, r);
+      });
+    } // end intersect()
 
-      intersection init = nullopt;
 
-      point origin = r.origin() + r.begin() * r.direction();
-      float max_t = r.end();
+    /*! Tests whether a ray intersects any triangle of this triangle_mesh.
+     *  Unlike intersect(), this terminates at the first intersection found rather than searching for the nearest.
+     *  \param r The ray of interest.
+     *  \return true if an intersection exists; false, otherwise.
+     */
+    inline bool is_intersected(const ray &r) const
+    {
+      return with_traversed_hierarchy([&](const auto& hierarchy)
+      {
+        return this->is_intersected(hierarchy, r);
+      });
+    } // end is_intersected()
 
-      auto result = m_bbh.intersect(origin, r.direction(), init,
-        [&](const triangle& tri, const point&, const vector&, intersection result)
+
+    /*! Finds a triangle of this triangle_mesh which a ray intersects.
+     *  Like is_intersected(), this terminates at the first intersection found, which need not be the nearest.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists; otherwise, a triangle which r intersects.
+     */
+    inline optional<triangle_iterator> find_intersected(const ray &r) const
+    {
+      return with_traversed_hierarchy([&](const auto& hierarchy)
+      {
+        return this->find_intersected(hierarchy, r);
+      });
+    } // end find_intersected()
+
+
+    /*! Finds the nearest intersection of each of a packet's rays with this triangle_mesh,
+     *  traversing the hierarchy once for the whole packet.
+     *  \param packet The rays of interest. The end of each ray's interval is shortened to its intersection, if any.
+     *  \param mask The lanes of packet to intersect.
+     *  \param results For each lane of the result, the triangle, ray parameter, and barycentric coordinates at the
+     *                 lane's intersection; other lanes are unchanged.
+     *  \return The lanes of mask whose rays intersect this triangle_mesh nearer than the end of their intervals.
+     */
+    inline ray_packet::mask_type intersect(ray_packet& packet, ray_packet::mask_type mask,
+                                           std::tuple<triangle_iterator,float,barycentric>* results) const
+    {
+      ray_packet::mask_type result = 0;
+
+      with_traversed_hierarchy([&](const auto& hierarchy)
+      {
+        hierarchy.intersect_leaves(packet, mask, [&](std::size_t begin, std::size_t end, ray_packet::mask_type leaf_mask)
         {
-          auto this_result = intersect(r, tri);
-          if(this_result)
+          ray_packet::for_each_lane(leaf_mask, [&](std::size_t lane)
           {
-            float t;
-            barycentric b;
-            std::tie(t,b) = *this_result;
+            ray r = packet[lane];
 
-            if(!result || t < std::get<float>(*result))
+            if(m_precomputed_triangles)
             {
-              result = std::make_tuple(to_iterator(tri), t, b);
+              auto this_result = m_precomputed_triangles->intersect(r, begin, end, r.end());
+              if(this_result)
+              {
+                std::size_t position;
+                float t;
+                barycentric b;
+                std::tie(position, t, b) = *this_result;
+
+                results[lane] = std::make_tuple(m_triangles.begin() + hierarchy.elements()[position], t, b);
+                packet.end(lane, t);
+                result |= ray_packet::mask_type(1) << lane;
+              }
+
+              return;
             }
-          }
+
+            for(std::size_t i = begin; i < end; ++i)
+            {
+              std::size_t element = hierarchy.elements()[i];
+
+              auto this_result = intersect(r, m_triangles[element]);
+              if(this_result && this_result->first < r.end())
+              {
+                results[lane] = std::make_tuple(m_triangles.begin() + element, this_result->first, this_result->second);
+                r.end(this_result->first);
+                packet.end(lane, this_result->first);
+                result |= ray_packet::mask_type(1) << lane;
+              }
+            }
+          });
+        });
+      });
+
+      return result;
+    } // end intersect()
+
+
+    /*! Tests which of a packet's rays intersect any triangle of this triangle_mesh,
+     *  traversing the hierarchy once for the whole packet.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to test.
+     *  \return The lanes of mask whose rays intersect this triangle_mesh.
+     */
+    inline ray_packet::mask_type is_intersected(const ray_packet& packet, ray_packet::mask_type mask) const
+    {
+      return find_intersected(packet, mask, [](std::size_t, triangle_iterator){});
+    } // end is_intersected()
+
+
+    /*! Finds a triangle of this triangle_mesh which each of a packet's rays intersects,
+     *  traversing the hierarchy once for the whole packet.
+     *  Like is_intersected(), this stops at the first intersection found for each ray, which need not be the nearest.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to test.
+     *  \param found A function of (lane, triangle) called once for each lane of the result, with a triangle its ray intersects.
+     *  \return The lanes of mask whose rays intersect this triangle_mesh.
+     */
+    template<class Function>
+    inline ray_packet::mask_type find_intersected(const ray_packet& packet, ray_packet::mask_type mask, Function found) const
+    {
+      return with_traversed_hierarchy([&](const auto& hierarchy)
+      {
+        return hierarchy.any_of_leaves(packet, mask, [&](std::size_t begin, std::size_t end, ray_packet::mask_type leaf_mask)
+        {
+          ray_packet::mask_type result = 0;
+
+          ray_packet::for_each_lane(leaf_mask, [&](std::size_t lane)
+          {
+            auto tri = this->find_intersected_in_leaf(hierarchy, packet[lane], begin, end);
+            if(tri)
+            {
+              found(lane, *tri);
+              result |= ray_packet::mask_type(1) << lane;
+            }
+          });
 
           return result;
-        },
-        [=](const intersection& i)
+        });
+      });
+    } // end find_intersected()
+
+
+    /*! Finds the nearest intersection of each of a stream's rays with this triangle_mesh,
+     *  traversing the hierarchy once for the whole stream.
+     *  \param stream The rays of interest. The end of each ray's interval is shortened to its intersection, if any.
+     *  \param indices The indices of the rays of stream to intersect.
+     *  \param found A function of (ray index, triangle, ray parameter, barycentric coordinates) called whenever
+     *               a ray's intersection nearer than any found before it is found.
+     */
+    template<class Function>
+    inline void intersect(ray_stream& stream, array_ref<const ray_stream::index_type> indices, Function found) const
+    {
+      with_traversed_hierarchy([&](const auto& hierarchy)
+      {
+        hierarchy.intersect_leaves(stream, indices, [&](std::size_t begin, std::size_t end, array_ref<const ray_stream::index_type> leaf_indices)
         {
-          return i ? std::get<float>(*i) : max_t;
-        }
-      );
+          for(ray_stream::index_type ray_index : leaf_indices)
+          {
+            ray r = stream[ray_index];
 
-      return result;
+            if(m_precomputed_triangles)
+            {
+              auto this_result = m_precomputed_triangles->intersect(r, begin, end, r.end());
+              if(this_result)
+              {
+                std::size_t position;
+                float t;
+                barycentric b;
+                std::tie(position, t, b) = *this_result;
+
+                stream.end(ray_index, t);
+                found(ray_index, m_triangles.begin() + hierarchy.elements()[position], t, b);
+              }
+
+              continue;
+            }
+
+            for(std::size_t i = begin; i < end; ++i)
+            {
+              std::size_t element = hierarchy.elements()[i];
+
+              auto this_result = intersect(r, m_triangles[element]);
+              if(this_result && this_result->first < r.end())
+              {
+                r.end(this_result->first);
+                stream.end(ray_index, this_result->first);
+                found(ray_index, m_triangles.begin() + element, this_result->first, this_result->second);
+              }
+            }
+          }
+        });
+      });
     } // end intersect()
 
 
+    /*! Tests which of a stream's rays intersect any triangle of this triangle_mesh,
+     *  traversing the hierarchy once for the whole stream.
+     *  \param stream The rays of interest. Each ray which intersects this triangle_mesh is retired.
+     *  \param indices The indices of the rays of stream to test.
+     */
+    inline void is_intersected(ray_stream& stream, array_ref<const ray_stream::index_type> indices) const
+    {
+      find_intersected(stream, indices, [](ray_stream::index_type, triangle_iterator){});
+    } // end is_intersected()
+
+
+    /*! Finds a triangle of this triangle_mesh which each of a stream's rays intersects,
+     *  traversing the hierarchy once for the whole stream.
+     *  Like is_intersected(), this stops at the first intersection found for each ray, which need not be the nearest.
+     *  \param stream The rays of interest. Each ray which intersects this triangle_mesh is retired.
+     *  \param indices The indices of the rays of stream to test.
+     *  \param found A function of (ray index, triangle) called as each ray is retired, with a triangle the ray intersects.
+     */
+    template<class Function>
+    inline void find_intersected(ray_stream& stream, array_ref<const ray_stream::index_type> indices, Function found) const
+    {
+      with_traversed_hierarchy([&](const auto& hierarchy)
+      {
+        hierarchy.intersect_leaves(stream, indices, [&](std::size_t begin, std::size_t end, array_ref<const ray_stream::index_type> leaf_indices)
+        {
+          for(ray_stream::index_type ray_index : leaf_indices)
+          {
+            auto tri = this->find_intersected_in_leaf(hierarchy, stream[ray_index], begin, end);
+            if(tri)
+            {
+              stream.retire(ray_index);
+              found(ray_index, *tri);
+            }
+          }
+        });
+      });
+    } // end find_intersected()
+
+
+    /*! \return The number of bytes occupied by the hierarchy traversed by intersection queries.
+     */
+    inline std::size_t traversed_hierarchy_memory_size() const
+    {
+      return with_traversed_hierarchy([](const auto& hierarchy)
+      {
+        return hierarchy.memory_size();
+      });
+    } // end traversed_hierarchy_memory_size()
+
+
+    /*! Calls a function with the hierarchy traversed by intersection queries, which is hierarchy() when options().width
+     *  is 2, and otherwise the wide_bounding_volume_hierarchy collapsed from it.
+     *  \param f A function accepting either hierarchy, e.g. to report its statistics.
+     *  \return The result of f.
+     */
+    template<class Function>
+    inline auto with_traversed_hierarchy(Function f) const
+      -> decltype(f(std::declval<const bounding_volume_hierarchy&>()))
+    {
+      if(m_hierarchy8) return f(*m_hierarchy8);
+      if(m_hierarchy4) return f(*m_hierarchy4);
+      if(m_quantized8_hierarchy8)  return f(*m_quantized8_hierarchy8);
+      if(m_quantized8_hierarchy4)  return f(*m_quantized8_hierarchy4);
+      if(m_quantized16_hierarchy8) return f(*m_quantized16_hierarchy8);
+      if(m_quantized16_hierarchy4) return f(*m_quantized16_hierarchy4);
+
+      return f(m_hierarchy);
+    } // end with_traversed_hierarchy()
+
+
     inline point point_at(const triangle& tri, const barycentric &b) const
     {
       return interpolate_point(tri,b);
@@ -545,10 +1052,141 @@ class triangle_mesh
 
 
   private:
-    triangle_iterator to_iterator(const triangle& tri) const
+    // refits the traversed hierarchy to elements' new bounding_boxes and returns whether it needs rebuilding
+    template<class Function>
+    inline bool refit_traversed_hierarchy(Function bounding_box_of)
     {
-      return m_triangles.begin() + (&tri - m_triangles.data());
-    }
+      auto refit = [&](auto& hierarchy)
+      {
+        hierarchy.refit(bounding_box_of);
+        return hierarchy.needs_rebuild();
+      };
+
+      if(m_hierarchy8) return refit(*m_hierarchy8);
+      if(m_hierarchy4) return refit(*m_hierarchy4);
+      if(m_quantized8_hierarchy8)  return refit(*m_quantized8_hierarchy8);
+      if(m_quantized8_hierarchy4)  return refit(*m_quantized8_hierarchy4);
+      if(m_quantized16_hierarchy8) return refit(*m_quantized16_hierarchy8);
+      if(m_quantized16_hierarchy4) return refit(*m_quantized16_hierarchy4);
+
+      return refit(m_hierarchy);
+    } // end refit_traversed_hierarchy()
+
+
+    template<class Hierarchy>
+    inline optional<std::tuple<triangle_iterator,float,barycentric>>
+      intersect(const Hierarchy& hierarchy, const ray &r) const
+    {
+      optional<std::tuple<triangle_iterator,float,barycentric>> result;
+
+      if(m_precomputed_triangles)
+      {
+        hierarchy.intersect_leaves(r, [&](std::size_t begin, std::size_t end, float max_t)
+        {
+          auto this_result = m_precomputed_triangles->intersect(r, begin, end, max_t);
+          if(this_result)
+          {
+            std::size_t position;
+            barycentric b;
+            std::tie(position, max_t, b) = *this_result;
+
+            result = std::make_tuple(m_triangles.begin() + hierarchy.elements()[position], max_t, b);
+          }
+
+          return max_t;
+        });
+
+        return result;
+      }
+
+      hierarchy.intersect(r, [&](std::size_t i, float max_t)
+      {
+        auto this_result = intersect(r, m_triangles[i]);
+        if(this_result && this_result->first < max_t)
+        {
+          float t;
+          barycentric b;
+          std::tie(t,b) = *this_result;
+
+          result = std::make_tuple(m_triangles.begin() + i, t, b);
+          max_t = t;
+        }
+
+        return max_t;
+      });
+
+      return result;
+    } // end intersect()
+
+
+    template<class Hierarchy>
+    inline bool is_intersected(const Hierarchy& hierarchy, const ray &r) const
+    {
+      if(m_precomputed_triangles)
+      {
+        return hierarchy.any_of_leaves(r, [&](std::size_t begin, std::size_t end)
+        {
+          return m_precomputed_triangles->is_intersected(r, begin, end);
+        });
+      }
+
+      return hierarchy.any_of(r, [&](std::size_t i)
+      {
+        return static_cast<bool>(intersect(r, m_triangles[i]));
+      });
+    } // end is_intersected()
+
+
+    template<class Hierarchy>
+    inline optional<triangle_iterator> find_intersected(const Hierarchy& hierarchy, const ray &r) const
+    {
+      optional<triangle_iterator> result;
+
+      if(m_precomputed_triangles)
+      {
+        hierarchy.any_of_leaves(r, [&](std::size_t begin, std::size_t end)
+        {
+          result = find_intersected_in_leaf(hierarchy, r, begin, end);
+          return static_cast<bool>(result);
+        });
+
+        return result;
+      }
+
+      hierarchy.any_of(r, [&](std::size_t i)
+      {
+        if(intersect(r, m_triangles[i]))
+        {
+          result = m_triangles.begin() + i;
+          return true;
+        }
+
+        return false;
+      });
+
+      return result;
+    } // end find_intersected()
+
+
+    // finds a triangle among the leaf elements()[begin, end) of hierarchy which r intersects
+    template<class Hierarchy>
+    inline optional<triangle_iterator> find_intersected_in_leaf(const Hierarchy& hierarchy, const ray &r, std::size_t begin, std::size_t end) const
+    {
+      if(m_precomputed_triangles)
+      {
+        auto position = m_precomputed_triangles->find_intersected(r, begin, end);
+        return position ? optional<triangle_iterator>(m_triangles.begin() + hierarchy.elements()[*position]) : nullopt;
+      }
+
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        triangle_iterator tri = m_triangles.begin() + hierarchy.elements()[i];
+        if(intersect(r, *tri)) return tri;
+      }
+
+      return nullopt;
+    } // end find_intersected_in_leaf()
+
 
     template<class T>
     static inline T interpolate(const barycentric& b, const T& x0, const T& x1, const T& x2)
@@ -593,7 +1231,20 @@ class triangle_mesh
     parametric_container             m_parametrics;
     normal_container                 m_normals;
     triangle_container               m_triangles;
-    bounding_box_hierarchy<triangle> m_bbh;
+    bounding_volume_hierarchy        m_hierarchy;
+
+    // when options.width is 4 or 8, the wide hierarchy traversed in place of m_hierarchy, which is then released
+    optional<wide_bounding_volume_hierarchy<4>> m_hierarchy4;
+    optional<wide_bounding_volume_hierarchy<8>> m_hierarchy8;
+
+    // when options.quantization_bits is also 8 or 16, the wide hierarchy with quantized child bounds traversed instead
+    optional<wide_bounding_volume_hierarchy<4, std::uint8_t>>  m_quantized8_hierarchy4;
+    optional<wide_bounding_volume_hierarchy<8, std::uint8_t>>  m_quantized8_hierarchy8;
+    optional<wide_bounding_volume_hierarchy<4, std::uint16_t>> m_quantized16_hierarchy4;
+    optional<wide_bounding_volume_hierarchy<8, std::uint16_t>> m_quantized16_hierarchy8;
+
+    // when options.precompute_leaves is set, the triangles in leaf order, intersected in place of m_triangles
+    optional<precomputed_triangles>             m_precomputed_triangles;
 };
 
 
@@ -0,0 +1,1019 @@
+#pragma once
+
+#include <igloo/geometry/bounding_volume_hierarchy.hpp>
+#include <igloo/geometry/bounding_box.hpp>
+#include <igloo/geometry/ray.hpp>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__SSE__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+
+namespace igloo
+{
+namespace detail
+{
+
+
+// a ray prepared for slab tests against the children of a wide node
+struct wide_traversal_ray
+{
+  float origin[3];
+  float inv_direction[3];
+
+  // the rows of a node's bounds holding the near and far planes along each axis
+  int near_row[3];
+  int far_row[3];
+
+  inline wide_traversal_ray(const ray& r)
+  {
+    for(int axis = 0; axis < 3; ++axis)
+    {
+      origin[axis] = r.origin()[axis];
+      inv_direction[axis] = 1.f / r.direction()[axis];
+
+      bool negative = inv_direction[axis] < 0;
+      near_row[axis] = negative ? axis + 3 : axis;
+      far_row[axis]  = negative ? axis : axis + 3;
+    }
+  }
+};
+
+
+// tests a ray against each of Width boxes stored in structure-of-arrays layout
+// returns a bitmask of the boxes which overlap [t0, t1] and stores the distance to each box in t_near
+template<std::size_t Width>
+struct wide_slab_test
+{
+  inline static unsigned int apply(const float (&bounds)[6][Width], const wide_traversal_ray& r, float t0, float t1, float* t_near)
+  {
+    unsigned int result = 0;
+
+    for(std::size_t i = 0; i < Width; ++i)
+    {
+      float lo = t0;
+      float hi = t1;
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        float tn = (bounds[r.near_row[axis]][i] - r.origin[axis]) * r.inv_direction[axis];
+        float tf = (bounds[r.far_row[axis]][i]  - r.origin[axis]) * r.inv_direction[axis];
+
+        // comparisons against NaN fail, so a ray lying in a slab's plane leaves the interval unchanged
+        lo = tn > lo ? tn : lo;
+        hi = tf < hi ? tf : hi;
+      }
+
+      t_near[i] = lo;
+      result |= (lo <= hi) << i;
+    }
+
+    return result;
+  }
+};
+
+
+#if defined(__SSE__)
+template<>
+struct wide_slab_test<4>
+{
+  inline static unsigned int apply(const float (&bounds)[6][4], const wide_traversal_ray& r, float t0, float t1, float* t_near)
+  {
+    __m128 lo = _mm_set1_ps(t0);
+    __m128 hi = _mm_set1_ps(t1);
+
+    for(int axis = 0; axis < 3; ++axis)
+    {
+      __m128 origin = _mm_set1_ps(r.origin[axis]);
+      __m128 inv_direction = _mm_set1_ps(r.inv_direction[axis]);
+
+      __m128 tn = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds[r.near_row[axis]]), origin), inv_direction);
+      __m128 tf = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds[r.far_row[axis]]),  origin), inv_direction);
+
+      // when either operand is NaN, _mm_max_ps & _mm_min_ps return the second operand
+      lo = _mm_max_ps(tn, lo);
+      hi = _mm_min_ps(tf, hi);
+    }
+
+    _mm_storeu_ps(t_near, lo);
+
+    return static_cast<unsigned int>(_mm_movemask_ps(_mm_cmple_ps(lo, hi)));
+  }
+};
+#endif
+
+
+#if defined(__AVX__)
+template<>
+struct wide_slab_test<8>
+{
+  inline static unsigned int apply(const float (&bounds)[6][8], const wide_traversal_ray& r, float t0, float t1, float* t_near)
+  {
+    __m256 lo = _mm256_set1_ps(t0);
+    __m256 hi = _mm256_set1_ps(t1);
+
+    for(int axis = 0; axis < 3; ++axis)
+    {
+      __m256 origin = _mm256_set1_ps(r.origin[axis]);
+      __m256 inv_direction = _mm256_set1_ps(r.inv_direction[axis]);
+
+      __m256 tn = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.near_row[axis]]), origin), inv_direction);
+      __m256 tf = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.far_row[axis]]),  origin), inv_direction);
+
+      // when either operand is NaN, _mm256_max_ps & _mm256_min_ps return the second operand
+      lo = _mm256_max_ps(tn, lo);
+      hi = _mm256_min_ps(tf, hi);
+    }
+
+    _mm256_storeu_ps(t_near, lo);
+
+    return static_cast<unsigned int>(_mm256_movemask_ps(_mm256_cmp_ps(lo, hi, _CMP_LE_OQ)));
+  }
+};
+#endif
+
+
+// the storage of the bounds of a wide node's children
+// unsigned integral Coordinates store each child's bounds quantized relative to the union of the children's bounds
+template<std::size_t Width, class Coordinate>
+struct wide_node_bounds
+{
+  static_assert(std::is_integral<Coordinate>::value && std::is_unsigned<Coordinate>::value,
+                "wide_node_bounds: Coordinate must be float or an unsigned integral type.");
+
+  using planes = float[6][Width];
+
+  // the bounds along each axis are decoded as origin + code * 2^exponent
+  // a power of two scale makes the product exact, so decoding rounds only once
+  float origin[3];
+  std::int8_t exponent[3];
+
+  // rows 0, 1, 2 hold the codes of the minimum x, y, z of each child's bounding_box; rows 3, 4, 5 hold the maximum
+  Coordinate codes[6][Width];
+
+  // encodes the bounding_boxes of n children so that each decoded box contains the original
+  inline void encode(const bounding_box* boxes, std::size_t n)
+  {
+    const float max_code = static_cast<float>(std::numeric_limits<Coordinate>::max());
+
+    bounding_box parent;
+    for(std::size_t i = 0; i < n; ++i)
+    {
+      parent += boxes[i];
+    }
+
+    for(int axis = 0; axis < 3; ++axis)
+    {
+      float lo = parent.min()[axis];
+      float hi = parent.max()[axis];
+
+      // find the least exponent at which the largest code reaches the parent's maximum despite rounding
+      int e = min_exponent;
+      if(hi > lo)
+      {
+        std::frexp((hi - lo) / max_code, &e);
+        e = std::max(e, int(min_exponent));
+      }
+
+      while(e < max_exponent && !at_least(lo, scale_of(e), max_code, hi)) ++e;
+
+      origin[axis] = lo;
+      exponent[axis] = static_cast<std::int8_t>(e);
+
+      float s = scale_of(e);
+
+      for(std::size_t i = 0; i < Width; ++i)
+      {
+        if(i < n)
+        {
+          // round outward, then correct for rounding in the decoding arithmetic
+          float q_lo = std::max(0.f, std::min(max_code, std::floor((boxes[i].min()[axis] - lo) / s)));
+          while(q_lo > 0.f && !at_most(lo, s, q_lo, boxes[i].min()[axis])) q_lo -= 1.f;
+
+          float q_hi = std::max(0.f, std::min(max_code, std::ceil((boxes[i].max()[axis] - lo) / s)));
+          while(q_hi < max_code && !at_least(lo, s, q_hi, boxes[i].max()[axis])) q_hi += 1.f;
+
+          codes[axis][i]     = static_cast<Coordinate>(q_lo);
+          codes[axis + 3][i] = static_cast<Coordinate>(q_hi);
+        }
+        else
+        {
+          codes[axis][i]     = static_cast<Coordinate>(max_code);
+          codes[axis + 3][i] = 0;
+        }
+      }
+    }
+  }
+
+  // decodes the children's bounds into scratch and returns it
+  inline const planes& decode(planes& scratch) const
+  {
+    for(int row = 0; row < 6; ++row)
+    {
+      const float o = origin[row % 3];
+      const float s = scale_of(exponent[row % 3]);
+
+      for(std::size_t i = 0; i < Width; ++i)
+      {
+        scratch[row][i] = o + static_cast<float>(codes[row][i]) * s;
+      }
+    }
+
+    return scratch;
+  }
+
+  // decodes the bounds of child i alone
+  inline bounding_box decode(std::size_t i) const
+  {
+    float row[6];
+    for(int r = 0; r < 6; ++r)
+    {
+      row[r] = origin[r % 3] + static_cast<float>(codes[r][i]) * scale_of(exponent[r % 3]);
+    }
+
+    return bounding_box(point(row[0], row[1], row[2]), point(row[3], row[4], row[5]));
+  }
+
+  // the range of exponents of normalized floats
+  static constexpr int min_exponent = -126;
+  static constexpr int max_exponent = 127;
+
+  // returns 2^e for e in [min_exponent, max_exponent]
+  inline static float scale_of(int e)
+  {
+    std::uint32_t bits = static_cast<std::uint32_t>(e + 127) << 23;
+
+    float result;
+    std::memcpy(&result, &bits, sizeof(float));
+    return result;
+  }
+
+  inline static bool at_most(float o, float s, float q, float x)
+  {
+    return o + q * s <= x;
+  }
+
+  inline static bool at_least(float o, float s, float q, float x)
+  {
+    return o + q * s >= x;
+  }
+};
+
+
+template<std::size_t Width>
+struct wide_node_bounds<Width, float>
+{
+  using planes = float[6][Width];
+
+  // rows 0, 1, 2 hold the minimum x, y, z of each child's bounding_box; rows 3, 4, 5 hold the maximum
+  planes bounds;
+
+  inline void encode(const bounding_box* boxes, std::size_t n)
+  {
+    for(std::size_t i = 0; i < Width; ++i)
+    {
+      // unused slots hold empty bounding_boxes
+      bounding_box box = i < n ? boxes[i] : bounding_box();
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        bounds[axis][i]     = box.min()[axis];
+        bounds[axis + 3][i] = box.max()[axis];
+      }
+    }
+  }
+
+  inline const planes& decode(planes&) const
+  {
+    return bounds;
+  }
+
+  inline bounding_box decode(std::size_t i) const
+  {
+    return bounding_box(point(bounds[0][i], bounds[1][i], bounds[2][i]), point(bounds[3][i], bounds[4][i], bounds[5][i]));
+  }
+};
+
+
+} // end detail
+
+
+/*! A wide_bounding_volume_hierarchy collapses a binary bounding_volume_hierarchy into a tree whose nodes have up to Width children.
+ *  Each node stores the bounds of its children in structure-of-arrays layout so that a single slab test checks every child at once.
+ *  When compiled for SSE (Width = 4) or AVX (Width = 8), the slab test uses a single vector instruction per plane.
+ *
+ *  When Coordinate is std::uint8_t or std::uint16_t rather than float, each node stores its children's bounds
+ *  quantized relative to the node's own bounds; with 8-bit codes, an 8-wide node shrinks from 212 to 84 bytes.
+ *  The quantized bounds are rounded outward, so they contain the exact bounds and traversal remains conservative.
+ */
+template<std::size_t Width, class Coordinate = float>
+class wide_bounding_volume_hierarchy
+{
+  public:
+    static_assert(Width >= 2 && Width <= 8, "wide_bounding_volume_hierarchy: Width must be in [2, 8].");
+
+    using index_type = bounding_volume_hierarchy::index_type;
+
+    struct node : detail::wide_node_bounds<Width, Coordinate>
+    {
+      // the index of the node's first interior child
+      // a node's interior children are stored contiguously, in the order of their slots
+      index_type first_child;
+
+      // the position in elements() of the first element of the node's first leaf child
+      // the elements of a node's leaf children are stored contiguously, in the order of their slots
+      index_type first_element;
+
+      // the number of elements in each leaf child; 0 for interior children and unused slots
+      std::uint8_t size[Width];
+
+      // the number of used slots, which precede the unused slots
+      std::uint8_t num_children;
+    };
+
+    /*! Creates an empty wide_bounding_volume_hierarchy.
+     */
+    inline wide_bounding_volume_hierarchy()
+      : m_built_sah_cost(0)
+    {}
+
+    /*! Creates a new wide_bounding_volume_hierarchy by collapsing a binary one.
+     *  The wide hierarchy shares nothing with binary, which may be destroyed afterward.
+     *  \param binary The bounding_volume_hierarchy to collapse.
+     *  \note The order of elements() generally differs from binary.elements().
+     */
+    inline explicit wide_bounding_volume_hierarchy(const bounding_volume_hierarchy& binary)
+      : m_options(binary.options()),
+        m_built_sah_cost(0)
+    {
+      if(binary.nodes().empty()) return;
+
+      m_nodes.reserve(binary.nodes().size() / (Width - 1) + 1);
+      m_elements.reserve(binary.elements().size());
+
+      m_nodes.emplace_back();
+
+      if(binary.nodes().front().is_leaf())
+      {
+        // a wide node can't be a leaf, so create a root with a single leaf child
+        index_type root = 0;
+        fill(binary, 0, &root, 1);
+      }
+      else
+      {
+        collapse(binary, 0, 0);
+      }
+
+      m_built_sah_cost = sah_cost();
+    }
+
+    /*! Recomputes the bounds of every node's children from their elements' new bounding_boxes, bottom-up,
+     *  keeping the hierarchy's structure, so that a moving mesh needs no binary hierarchy to refit.
+     *  \param bounding_box_of A function mapping an element index to the element's bounding_box.
+     *  \note As with bounding_volume_hierarchy::refit(), the hierarchy remains correct however far its elements move,
+     *        but its quality degrades; see needs_rebuild().
+     */
+    template<class Function>
+    inline void refit(Function bounding_box_of)
+    {
+      // the exact bounds of each node, which its parent encodes
+      std::vector<igloo::bounding_box> node_bounds(m_nodes.size());
+
+      // children follow their parent, so a reverse sweep visits each node's children before the node itself
+      for(std::size_t i = m_nodes.size(); i-- > 0;)
+      {
+        node& n = m_nodes[i];
+
+        igloo::bounding_box boxes[Width];
+        index_type next_child = n.first_child;
+        index_type next_element = n.first_element;
+        for(std::size_t c = 0; c < n.num_children; ++c)
+        {
+          if(n.size[c] == 0)
+          {
+            boxes[c] = node_bounds[next_child++];
+          }
+          else
+          {
+            for(index_type e = next_element; e < next_element + n.size[c]; ++e)
+            {
+              boxes[c] += bounding_box_of(std::size_t(m_elements[e]));
+            }
+
+            next_element += n.size[c];
+          }
+
+          node_bounds[i] += boxes[c];
+        }
+
+        n.encode(boxes, n.num_children);
+      }
+    }
+
+    /*! \return The options of the binary hierarchy this hierarchy was collapsed from.
+     */
+    inline const bounding_volume_hierarchy_options& options() const
+    {
+      return m_options;
+    }
+
+    /*! Estimates the expected cost of intersecting a random ray with this hierarchy using the surface area heuristic.
+     *  \return The sum over nodes of each node's cost weighted by the ratio of its surface area to the root's,
+     *          where nodes cost options().traversal_cost and leaf children cost the number of their elements.
+     */
+    inline float sah_cost() const
+    {
+      float root_area = bounding_box().surface_area();
+      if(root_area <= 0.f) return 0.f;
+
+      float result = 0.f;
+      for(const node& n : m_nodes)
+      {
+        float scratch[6][Width];
+        const auto& planes = n.decode(scratch);
+
+        igloo::bounding_box node_box;
+        for(std::size_t c = 0; c < n.num_children; ++c)
+        {
+          igloo::bounding_box child_box = child_bounding_box(planes, c);
+          node_box += child_box;
+
+          result += float(n.size[c]) * child_box.surface_area() / root_area;
+        }
+
+        result += m_options.traversal_cost * node_box.surface_area() / root_area;
+      }
+
+      return result;
+    }
+
+    /*! \return true if refit() has degraded this hierarchy's sah_cost() past options().rebuild_threshold
+     *          times its cost when collapsed; false, otherwise.
+     */
+    inline bool needs_rebuild() const
+    {
+      return sah_cost() > m_options.rebuild_threshold * m_built_sah_cost;
+    }
+
+    /*! \return A bounding_box bounding every element of this hierarchy.
+     */
+    inline igloo::bounding_box bounding_box() const
+    {
+      igloo::bounding_box result;
+      if(m_nodes.empty()) return result;
+
+      const node& root = m_nodes.front();
+
+      float scratch[6][Width];
+      const auto& planes = root.decode(scratch);
+      for(std::size_t c = 0; c < root.num_children; ++c)
+      {
+        result += child_bounding_box(planes, c);
+      }
+
+      return result;
+    }
+
+    /*! \return The number of bytes occupied by this hierarchy's nodes and elements.
+     */
+    inline std::size_t memory_size() const
+    {
+      return m_nodes.size() * sizeof(node) + m_elements.size() * sizeof(index_type);
+    }
+
+    /*! \return The number of element references in this hierarchy's leaves.
+     *  \note This exceeds the number of elements when the binary hierarchy was built with spatial splits.
+     */
+    inline std::size_t size() const
+    {
+      return m_elements.size();
+    }
+
+    /*! \return This hierarchy's nodes; the root is the first node.
+     */
+    inline const std::vector<node>& nodes() const
+    {
+      return m_nodes;
+    }
+
+    /*! \return This hierarchy's element indices in leaf order.
+     */
+    inline const std::vector<index_type>& elements() const
+    {
+      return m_elements;
+    }
+
+    /*! Visits the elements whose bounding_boxes are pierced by a ray in front-to-back order of their leaves,
+     *  skipping subtrees which lie beyond the nearest hit found so far.
+     *  \param r The ray of interest.
+     *  \param intersector A function of (element index, max_t) returning the ray parameter of the nearest
+     *                     intersection with the element if it is nearer than max_t; otherwise, max_t.
+     *  \return The ray parameter of the nearest intersection found, or r.end() if none exists.
+     */
+    template<class Function>
+    inline float intersect(const ray& r, Function intersector) const
+    {
+      return intersect_leaves(r, [&](std::size_t begin, std::size_t end, float max_t)
+      {
+        for(std::size_t i = begin; i < end; ++i)
+        {
+          max_t = intersector(m_elements[i], max_t);
+        }
+
+        return max_t;
+      });
+    }
+
+    /*! Visits the leaves pierced by a ray in front-to-back order,
+     *  skipping subtrees which lie beyond the nearest hit found so far.
+     *  \param r The ray of interest.
+     *  \param intersector A function of (begin, end, max_t) returning the ray parameter of the nearest intersection
+     *                     with the leaf's elements, elements()[begin, end), if it is nearer than max_t; otherwise, max_t.
+     *  \return The ray parameter of the nearest intersection found, or r.end() if none exists.
+     */
+    template<class Function>
+    inline float intersect_leaves(const ray& r, Function intersector) const
+    {
+      float max_t = r.end();
+
+      traverse(r, [&]
+      {
+        return max_t;
+      },
+      [&](std::size_t begin, std::size_t end)
+      {
+        max_t = intersector(begin, end, max_t);
+        return false;
+      });
+
+      return max_t;
+    }
+
+    /*! Tests whether any element pierced by a ray satisfies a predicate, terminating at the first that does.
+     *  \param r The ray of interest.
+     *  \param pred A function of (element index) returning true if the element is intersected by r.
+     *  \return true if pred returned true for some element; false, otherwise.
+     */
+    template<class Predicate>
+    inline bool any_of(const ray& r, Predicate pred) const
+    {
+      return any_of_leaves(r, [&](std::size_t begin, std::size_t end)
+      {
+        for(std::size_t i = begin; i < end; ++i)
+        {
+          if(pred(m_elements[i])) return true;
+        }
+
+        return false;
+      });
+    }
+
+    /*! Tests whether any leaf pierced by a ray satisfies a predicate, terminating at the first that does.
+     *  \param r The ray of interest.
+     *  \param pred A function of (begin, end) returning true if any of the leaf's elements, elements()[begin, end), is intersected by r.
+     *  \return true if pred returned true for some leaf; false, otherwise.
+     */
+    template<class Predicate>
+    inline bool any_of_leaves(const ray& r, Predicate pred) const
+    {
+      return traverse(r, [&]
+      {
+        return r.end();
+      },
+      [&](std::size_t begin, std::size_t end)
+      {
+        return pred(begin, end);
+      });
+    }
+
+    /*! Visits the leaves pierced by any of a packet's rays, sharing a single traversal among the rays.
+     *  \param packet The rays of interest. intersector shortens each ray's interval as it finds intersections,
+     *                which culls subtrees beyond them.
+     *  \param mask The lanes of packet to trace.
+     *  \param intersector A function of (begin, end, mask) which intersects the rays of packet in mask with the leaf's
+     *                     elements, elements()[begin, end), and sets the end of each ray it finds a nearer intersection for.
+     */
+    template<class Function>
+    inline void intersect_leaves(ray_packet& packet, ray_packet::mask_type mask, Function intersector) const
+    {
+      traverse(packet, mask, [&](std::size_t begin, std::size_t end, ray_packet::mask_type leaf_mask)
+      {
+        intersector(begin, end, leaf_mask);
+        return ray_packet::mask_type(0);
+      });
+    }
+
+    /*! Tests which of a packet's rays pierce a leaf satisfying a predicate, sharing a single traversal among the rays.
+     *  Each ray retires from the traversal at the first leaf for which it satisfies the predicate.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to trace.
+     *  \param pred A function of (begin, end, mask) returning the lanes of mask whose rays intersect any of the leaf's
+     *              elements, elements()[begin, end).
+     *  \return The lanes of mask for which pred returned true at some leaf.
+     */
+    template<class Predicate>
+    inline ray_packet::mask_type any_of_leaves(const ray_packet& packet, ray_packet::mask_type mask, Predicate pred) const
+    {
+      ray_packet::mask_type result = 0;
+
+      traverse(packet, mask, [&](std::size_t begin, std::size_t end, ray_packet::mask_type leaf_mask)
+      {
+        ray_packet::mask_type hits = pred(begin, end, leaf_mask) & leaf_mask;
+        result |= hits;
+        return hits;
+      });
+
+      return result;
+    }
+
+    /*! Visits the leaves pierced by any of a stream's rays, filtering the stream at each child
+     *  so that each node is fetched once for all of the rays which reach it.
+     *  \param stream The rays of interest. intersector shortens each ray's interval as it finds intersections,
+     *                which culls subtrees beyond them, and may retire rays which need no further traversal.
+     *  \param indices The indices of the rays of stream to trace, e.g. as ordered by ray_stream::sorted_indices().
+     *  \param intersector A function of (begin, end, indices) which intersects the rays of stream in indices with the
+     *                     leaf's elements, elements()[begin, end).
+     */
+    template<class Function>
+    inline void intersect_leaves(ray_stream& stream, array_ref<const ray_stream::index_type> indices, Function intersector) const
+    {
+      if(m_nodes.empty() || indices.empty()) return;
+
+      // the rays reaching each child on the stack occupy a segment of this buffer
+      std::vector<ray_stream::index_type> buffer(indices.begin(), indices.end());
+
+      // each level of the binary hierarchy adds at most Width - 1 entries to the stack
+      stream_entry stack[bounding_volume_hierarchy::max_depth * (Width - 1) + 1];
+      int top = 0;
+      stack[top++] = stream_entry{0, 0, no_parent, 0, 0, buffer.size()};
+
+      while(top > 0)
+      {
+        stream_entry e = stack[--top];
+
+        // the segments following e's were filtered for subtrees which have been traversed completely
+        buffer.resize(e.end);
+
+        // filter the rays reaching e's parent down to those which intersect e; every ray reaches the root
+        std::size_t begin = e.begin;
+        std::size_t end = e.end;
+        if(e.parent != no_parent)
+        {
+          igloo::bounding_box box = m_nodes[e.parent].decode(e.slot);
+
+          begin = buffer.size();
+          for(std::size_t i = e.begin; i < e.end; ++i)
+          {
+            ray_stream::index_type ray_index = buffer[i];
+
+            if(stream.intersects(box, ray_index))
+            {
+              buffer.push_back(ray_index);
+            }
+          }
+
+          end = buffer.size();
+        }
+
+        if(begin == end) continue;
+
+        if(e.size > 0)
+        {
+          intersector(e.index, e.index + e.size, array_ref<const ray_stream::index_type>(buffer.data() + begin, end - begin));
+          continue;
+        }
+
+        // order the children along the mean direction of the rays, and push the farthest child first
+        vector direction(0.f, 0.f, 0.f);
+        for(std::size_t i = begin; i < end; ++i)
+        {
+          for(int axis = 0; axis < 3; ++axis)
+          {
+            direction[axis] += stream.direction(buffer[i], axis);
+          }
+        }
+
+        push_children(e.index, direction, stack, top, [&](index_type index, std::uint32_t size, index_type parent, std::uint32_t slot)
+        {
+          return stream_entry{index, size, parent, slot, begin, end};
+        });
+      }
+    }
+
+  private:
+    // the parent of the root's stack entry
+    static constexpr index_type no_parent = std::numeric_limits<index_type>::max();
+
+    // an entry of the stack of a packet's traversal, which identifies a child by its node and slot
+    // in the child's parent, whose bounds the entry is tested against when it is popped
+    struct packet_entry
+    {
+      index_type index;
+      std::uint32_t size;
+      index_type parent;
+      std::uint32_t slot;
+      ray_packet::mask_type mask;
+    };
+
+    // an entry of the stack of a stream's traversal, whose rays occupy [begin, end) of the traversal's buffer
+    struct stream_entry
+    {
+      index_type index;
+      std::uint32_t size;
+      index_type parent;
+      std::uint32_t slot;
+      std::size_t begin, end;
+    };
+
+    // returns the bounding_box of child c from the decoded bounds of its node
+    inline static igloo::bounding_box child_bounding_box(const float (&planes)[6][Width], std::size_t c)
+    {
+      return igloo::bounding_box(point(planes[0][c], planes[1][c], planes[2][c]),
+                                 point(planes[3][c], planes[4][c], planes[5][c]));
+    }
+
+    // pushes make_entry(index, size, parent, slot) for each child of node parent onto stack, ordered so that
+    // the child farthest along direction is pushed first and the nearest is popped first
+    template<class Entry, class Function>
+    inline void push_children(index_type parent, const vector& direction, Entry* stack, int& top, Function make_entry) const
+    {
+      const node& n = m_nodes[parent];
+
+      float scratch[6][Width];
+      const auto& planes = n.decode(scratch);
+
+      Entry children[Width];
+      float distances[Width];
+      int num_children = 0;
+
+      index_type next_child = n.first_child;
+      index_type next_element = n.first_element;
+      for(std::size_t c = 0; c < n.num_children; ++c)
+      {
+        index_type index = n.size[c] == 0 ? next_child++ : next_element;
+        next_element += n.size[c];
+
+        float distance = 0.f;
+        for(int axis = 0; axis < 3; ++axis)
+        {
+          distance += 0.5f * (planes[axis][c] + planes[axis + 3][c]) * direction[axis];
+        }
+
+        // sort the children so that the farthest is first
+        int j = num_children++;
+        for(; j > 0 && distances[j-1] < distance; --j)
+        {
+          children[j] = children[j-1];
+          distances[j] = distances[j-1];
+        }
+
+        children[j] = make_entry(index, std::uint32_t(n.size[c]), parent, std::uint32_t(c));
+        distances[j] = distance;
+      }
+
+      for(int i = 0; i < num_children; ++i)
+      {
+        stack[top++] = children[i];
+      }
+    }
+
+    // visits the element ranges of leaves pierced by the rays of packet in mask
+    // visit returns the lanes which retire from the traversal
+    template<class Function>
+    inline void traverse(const ray_packet& packet, ray_packet::mask_type mask, Function visit) const
+    {
+      if(m_nodes.empty()) return;
+
+      // each level of the binary hierarchy adds at most Width - 1 entries to the stack
+      packet_entry stack[bounding_volume_hierarchy::max_depth * (Width - 1) + 1];
+      int top = 0;
+      stack[top++] = packet_entry{0, 0, no_parent, 0, mask};
+
+      ray_packet::mask_type active = mask;
+
+      while(top > 0 && active)
+      {
+        packet_entry e = stack[--top];
+
+        ray_packet::mask_type node_mask = e.mask & active;
+        if(!node_mask) continue;
+
+        // every ray of the packet reaches the root
+        if(e.parent != no_parent)
+        {
+          igloo::bounding_box box = m_nodes[e.parent].decode(e.slot);
+
+          // cull the child for the whole packet at once if the packet's frustum misses it
+          if(packet.frustum_misses(box)) continue;
+
+          if(e.size > 0)
+          {
+            // visit a leaf with exactly the rays which intersect it
+            node_mask = packet.intersects(box, node_mask);
+            if(node_mask)
+            {
+              active &= ~visit(e.index, e.index + e.size, node_mask);
+            }
+
+            continue;
+          }
+
+          // descend into a node once any ray intersects it, dropping only the rays tested before that one
+          node_mask = packet.first_intersecting(box, node_mask);
+          if(!node_mask) continue;
+        }
+
+        // order the children along the direction of the first active ray
+        std::size_t lane = ray_packet::first_lane(node_mask);
+        vector direction(packet.direction(lane, 0), packet.direction(lane, 1), packet.direction(lane, 2));
+
+        push_children(e.index, direction, stack, top, [&](index_type index, std::uint32_t size, index_type parent, std::uint32_t slot)
+        {
+          return packet_entry{index, size, parent, slot, node_mask};
+        });
+      }
+    }
+
+    // fills the wide node at result from the subtree rooted at the given interior binary node
+    inline void collapse(const bounding_volume_hierarchy& binary, index_type binary_node, index_type result)
+    {
+      array_ref<const bounding_volume_hierarchy::node> binary_nodes = binary.nodes();
+
+      index_type candidates[Width];
+      std::size_t num_candidates = 2;
+      candidates[0] = binary_node + 1;
+      candidates[1] = binary_nodes[binary_node].offset;
+
+      // repeatedly open the interior candidate with the greatest surface area until the node is full
+      while(num_candidates < Width)
+      {
+        int largest = -1;
+        float largest_area = -1.f;
+
+        for(std::size_t i = 0; i < num_candidates; ++i)
+        {
+          const bounding_volume_hierarchy::node& candidate = binary_nodes[candidates[i]];
+          if(!candidate.is_leaf() && candidate.bounding_box.surface_area() > largest_area)
+          {
+            largest = static_cast<int>(i);
+            largest_area = candidate.bounding_box.surface_area();
+          }
+        }
+
+        if(largest < 0) break;
+
+        index_type opened = candidates[largest];
+        candidates[largest] = opened + 1;
+        candidates[num_candidates++] = binary_nodes[opened].offset;
+      }
+
+      fill(binary, result, candidates, num_candidates);
+    }
+
+    // fills the wide node at result with the given binary nodes as its children, and collapses the interior ones
+    inline void fill(const bounding_volume_hierarchy& binary, index_type result, const index_type* candidates, std::size_t num_candidates)
+    {
+      array_ref<const bounding_volume_hierarchy::node> binary_nodes = binary.nodes();
+
+      igloo::bounding_box boxes[Width];
+      for(std::size_t i = 0; i < num_candidates; ++i)
+      {
+        boxes[i] = binary_nodes[candidates[i]].bounding_box;
+      }
+
+      // collapse() grows m_nodes, so don't hold a reference to this node across the calls below
+      node& n = m_nodes[result];
+      n.encode(boxes, num_candidates);
+      n.num_children = static_cast<std::uint8_t>(num_candidates);
+      n.first_child = static_cast<index_type>(m_nodes.size());
+      n.first_element = static_cast<index_type>(m_elements.size());
+
+      std::size_t num_interior = 0;
+      for(std::size_t i = 0; i < Width; ++i)
+      {
+        n.size[i] = 0;
+
+        if(i < num_candidates)
+        {
+          const bounding_volume_hierarchy::node& candidate = binary_nodes[candidates[i]];
+
+          if(candidate.is_leaf())
+          {
+            n.size[i] = static_cast<std::uint8_t>(candidate.size);
+
+            m_elements.insert(m_elements.end(),
+                              binary.elements().begin() + candidate.offset,
+                              binary.elements().begin() + candidate.offset + candidate.size);
+          }
+          else
+          {
+            ++num_interior;
+          }
+        }
+      }
+
+      // allocate the interior children contiguously before collapsing them
+      index_type child = static_cast<index_type>(m_nodes.size());
+      m_nodes.resize(m_nodes.size() + num_interior);
+
+      for(std::size_t i = 0; i < num_candidates; ++i)
+      {
+        if(!binary_nodes[candidates[i]].is_leaf())
+        {
+          collapse(binary, candidates[i], child++);
+        }
+      }
+    }
+
+    struct stack_entry
+    {
+      index_type index;
+      std::uint32_t size;
+      float t_near;
+    };
+
+    // visits the element ranges of leaves pierced by r until visit returns true
+    // max_t() returns the current end of the ray's interval
+    template<class Function1, class Function2>
+    inline bool traverse(const ray& r, Function1 max_t, Function2 visit) const
+    {
+      if(m_nodes.empty()) return false;
+
+      detail::wide_traversal_ray wide_ray(r);
+
+      // each level of the binary hierarchy adds at most Width - 1 entries to the stack
+      stack_entry stack[bounding_volume_hierarchy::max_depth * (Width - 1) + 1];
+      int top = 0;
+      stack[top++] = stack_entry{0, 0, r.begin()};
+
+      while(top > 0)
+      {
+        stack_entry entry = stack[--top];
+
+        // skip entries which lie beyond the nearest hit found since they were pushed
+        if(entry.t_near > max_t()) continue;
+
+        if(entry.size > 0)
+        {
+          if(visit(entry.index, entry.index + entry.size)) return true;
+
+          continue;
+        }
+
+        const node& n = m_nodes[entry.index];
+
+        float scratch[6][Width];
+        float t_near[Width];
+        unsigned int mask = detail::wide_slab_test<Width>::apply(n.decode(scratch), wide_ray, r.begin(), max_t(), t_near);
+
+        // sort the intersected children so that the farthest is first
+        stack_entry hits[Width];
+        int num_hits = 0;
+        index_type next_child = n.first_child;
+        index_type next_element = n.first_element;
+        for(std::size_t i = 0; i < n.num_children; ++i)
+        {
+          index_type index = n.size[i] == 0 ? next_child++ : next_element;
+          next_element += n.size[i];
+
+          if(mask & (1u << i))
+          {
+            stack_entry hit{index, n.size[i], t_near[i]};
+
+            int j = num_hits++;
+            for(; j > 0 && hits[j-1].t_near < hit.t_near; --j)
+            {
+              hits[j] = hits[j-1];
+            }
+
+            hits[j] = hit;
+          }
+        }
+
+        // push far to near so that the nearest child is visited first
+        for(int i = 0; i < num_hits; ++i)
+        {
+          stack[top++] = hits[i];
+        }
+      }
+
+      return false;
+    }
+
+    std::vector<node>                 m_nodes;
+    std::vector<index_type>           m_elements;
+    bounding_volume_hierarchy_options m_options;
+    float                             m_built_sah_cost;
+};
+
+
+} // end igloo
+
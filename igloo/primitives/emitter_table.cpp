@@ -0,0 +1,80 @@
+#include <igloo/primitives/emitter_table.hpp>
+#include <igloo/primitives/scene.hpp>
+#include <igloo/geometry/pi.hpp>
+#include <random>
+
+namespace igloo
+{
+
+
+emitter_table::emitter_table(const scene &s)
+{
+  const int num_sample_points = 16;
+
+  // sample each emitter's surface the same way on each creation
+  std::mt19937_64 rng;
+
+  float total_power = 0;
+
+  // the number of emitters which have area, and so may be sampled
+  std::size_t num_with_area = 0;
+
+  for(const auto& emitter : s.emitters())
+  {
+    float area = emitter.area();
+
+    // the radiance emitted along the normal at a few points of the emitter, which for a diffuse emitter
+    // is its radiance in every direction
+    float sum_of_luminance = 0;
+    if(area > 0)
+    {
+      for(int i = 0; i < num_sample_points; ++i)
+      {
+        differential_geometry dg = emitter.sample_surface(rng(), rng());
+
+        scattering_distribution_function e = emitter.material().evaluate_emission(dg);
+        sum_of_luminance += luminance(e(vector(0,0,1)));
+      }
+
+      ++num_with_area;
+    }
+
+    // a diffuse emitter of radiance L and area A emits a power of pi * L * A
+    float power = pi * area * sum_of_luminance / num_sample_points;
+
+    m_positions.push_back(m_emitters.size());
+    m_emitters.push_back(&emitter);
+    m_powers.push_back(power);
+
+    total_power += power;
+  }
+
+  if(m_emitters.empty()) return;
+
+  // the sampled points may all miss an emitter's emission, e.g. that of a textured emitter, and choosing such an emitter
+  // never would bias the renderer's estimate, so every emitter with area keeps a share of the probability
+  const float min_probability_share = 0.1f;
+
+  auto weight = [&](std::size_t position)
+  {
+    // if no emitter has area, choose among them uniformly rather than not at all
+    if(num_with_area == 0) return 1.f;
+
+    float uniform = m_emitters[position]->area() > 0 ? 1.f / num_with_area : 0.f;
+
+    // if no emitter appears to emit anything, choose among those with area uniformly
+    if(total_power <= 0) return uniform;
+
+    return (1.f - min_probability_share) * m_powers[position] / total_power + min_probability_share * uniform;
+  };
+
+  m_table.emplace(m_positions, weight);
+
+  for(std::size_t position : m_positions)
+  {
+    m_probabilities.push_back(m_table->probability_of(m_positions.cbegin() + position));
+  }
+} // end emitter_table::emitter_table()
+
+
+} // end igloo
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <igloo/primitives/surface_primitive.hpp>
+#include <igloo/utility/alias_table.hpp>
+#include <igloo/utility/optional.hpp>
+
+namespace igloo
+{
+
+
+class scene;
+
+
+/*! An emitter_table selects a single emitter of a scene with probability roughly proportional to its emitted power,
+ *  so that a renderer may sample direct lighting with one shadow ray per shading point however many emitters the scene has.
+ *  The power of each emitter is estimated once, when the emitter_table is created, by averaging its emitted radiance over
+ *  a few points of its surface; an emitter_table must be recreated when the scene's emitters change.
+ *  Because the estimate may miss an emitter's emission, a tenth of the probability is shared uniformly among the emitters
+ *  with nonzero area, so that each of them may be chosen.
+ */
+class emitter_table
+{
+  public:
+    /*! A selection is an emitter chosen by an emitter_table.
+     */
+    struct selection
+    {
+      // the position of the emitter in the scene's emitters()
+      std::size_t position;
+
+      const surface_primitive* emitter;
+
+      // the probability of choosing the emitter
+      float probability;
+    };
+
+    /*! Creates a new emitter_table.
+     *  \param s The scene of interest, which must be committed.
+     *  \throws std::logic_error if s has uncommitted edits.
+     */
+    explicit emitter_table(const scene &s);
+
+    // m_table refers to m_positions, so an emitter_table stays where it was created
+    emitter_table(const emitter_table&) = delete;
+    emitter_table& operator=(const emitter_table&) = delete;
+
+    /*! \return The number of emitters of this emitter_table.
+     */
+    inline std::size_t size() const
+    {
+      return m_emitters.size();
+    } // end size()
+
+    /*! \return true if the scene has no emitters; false, otherwise.
+     */
+    inline bool empty() const
+    {
+      return m_emitters.empty();
+    } // end empty()
+
+    /*! Chooses an emitter in constant time.
+     *  \param u A uniform random variable in [0,1).
+     *  \return The chosen emitter.
+     *  \note This emitter_table must not be empty().
+     */
+    inline selection operator()(float u) const
+    {
+      auto position_and_probability = (*m_table)(u);
+      std::size_t position = *position_and_probability.first;
+
+      return selection{position, m_emitters[position], position_and_probability.second};
+    } // end operator()()
+
+    /*! \return The probability of choosing the emitter at the given position in the scene's emitters().
+     */
+    inline float probability(std::size_t position) const
+    {
+      return m_probabilities[position];
+    } // end probability()
+
+    /*! \return The estimated power of the emitter at the given position in the scene's emitters().
+     */
+    inline float power(std::size_t position) const
+    {
+      return m_powers[position];
+    } // end power()
+
+  private:
+    std::vector<const surface_primitive*> m_emitters;
+    std::vector<float> m_powers;
+    std::vector<float> m_probabilities;
+
+    // the positions of the emitters, which m_table selects among
+    std::vector<std::size_t> m_positions;
+    optional<alias_table<std::vector<std::size_t>::const_iterator>> m_table;
+}; // end emitter_table
+
+
+} // end igloo
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <igloo/utility/optional.hpp>
+
+namespace igloo
+{
+
+
+/*! An occluder_cache remembers, for each emitter of a scene, the surface element which blocked the last shadow ray
+ *  toward that emitter. Shadow rays from nearby points toward the same emitter tend to be blocked by the same element,
+ *  so scene tests it before traversing its hierarchy. An occluder_cache is meant to be owned by a single rendering thread.
+ *  Its entries are invalidated by scene::commit() and scene::bind_material(), which may change the surface at an index or the
+ *  emitter at a position; the scene records its generation in the occluder_cache and empties it on first use after either.
+ */
+class occluder_cache
+{
+  public:
+    /*! An occluder identifies an element of a surface of a scene.
+     */
+    struct occluder
+    {
+      // the index of the surface in the scene
+      std::uint32_t primitive;
+
+      // the element of the surface, as returned by surface::find_occluder()
+      std::uint32_t element;
+    };
+
+    /*! Creates a new, empty occluder_cache.
+     *  \param num_emitters The number of emitters of the scene.
+     */
+    inline occluder_cache(std::size_t num_emitters = 0)
+      : m_occluders(num_emitters),
+        m_generation(0),
+        m_num_lookups(0),
+        m_num_hits(0)
+    {}
+
+    /*! \return The number of emitters this occluder_cache has an entry for.
+     */
+    inline std::size_t size() const
+    {
+      return m_occluders.size();
+    } // end size()
+
+    /*! \return The generation of the scene whose occluders this occluder_cache holds.
+     */
+    inline std::uint64_t generation() const
+    {
+      return m_generation;
+    } // end generation()
+
+    /*! Forgets every occluder, keeping the counters of lookups.
+     *  \param num_emitters The number of emitters of the scene.
+     *  \param generation The generation of the scene.
+     */
+    inline void reset(std::size_t num_emitters, std::uint64_t generation)
+    {
+      m_occluders.assign(num_emitters, nullopt);
+      m_generation = generation;
+    } // end reset()
+
+    /*! \return The occluder of the last shadow ray toward the given emitter, if any.
+     *  \param emitter The position of the emitter in the scene's emitters().
+     */
+    inline optional<occluder>& operator[](std::size_t emitter)
+    {
+      return m_occluders[emitter];
+    } // end operator[]()
+
+    /*! Records the outcome of testing a shadow ray against the cached occluder of its emitter.
+     *  \param is_hit Whether the cached occluder blocked the ray.
+     */
+    inline void count_lookup(bool is_hit)
+    {
+      ++m_num_lookups;
+      m_num_hits += is_hit;
+    } // end count_lookup()
+
+    /*! \return The number of shadow rays tested against this occluder_cache.
+     */
+    inline std::uint64_t num_lookups() const
+    {
+      return m_num_lookups;
+    } // end num_lookups()
+
+    /*! \return The number of shadow rays blocked by a cached occluder, which skipped traversal.
+     */
+    inline std::uint64_t num_hits() const
+    {
+      return m_num_hits;
+    } // end num_hits()
+
+    /*! \return The fraction of shadow rays blocked by a cached occluder.
+     */
+    inline double hit_rate() const
+    {
+      return m_num_lookups ? double(m_num_hits) / m_num_lookups : 0.0;
+    } // end hit_rate()
+
+  private:
+    std::vector<optional<occluder>> m_occluders;
+    std::uint64_t m_generation;
+    std::uint64_t m_num_lookups;
+    std::uint64_t m_num_hits;
+}; // end occluder_cache
+
+
+} // end igloo
+
@@ -1,23 +1,376 @@
 #include <igloo/primitives/scene.hpp>
 #include <algorithm>
+#include <stdexcept>
+#include <vector>
 
 namespace igloo
 {
 
 
-optional<scene::intersection> scene::intersect(const ray& r) const
+constexpr scene::handle scene::null_handle;
+constexpr std::uint32_t scene::not_an_emitter;
+
+
+void scene::commit()
 {
-  optional<scene::intersection> result;
+  adopt_new_surfaces();
 
-  for(const auto& surface : surfaces())
+  // rebuild everything once the edited surfaces, and the removed ones the hierarchy still bounds, reach a quarter of the scene
+  if(!is_built_ || 4 * (edited_packed_.size() + num_removed_) > packed_.size())
+  {
+    rebuild();
+  }
+  else if(has_edits_)
   {
-    auto i = surface.intersect(r);
+    rebuild_edited();
+  }
+
+  has_edits_ = false;
+  ++generation_;
+} // end scene::commit()
+
+
+bool scene::is_committed() const
+{
+  return is_built_ && !has_edits_ && handle_of_index_.size() == size();
+} // end scene::is_committed()
+
+
+scene::packed_primitive scene::make_record(std::size_t i) const
+{
+  packed_primitive result{};
+  result.primitive = static_cast<std::uint32_t>(i);
+
+  if(const sphere* s = (*this)[i].as_sphere())
+  {
+    result.sphere[0] = s->center().x;
+    result.sphere[1] = s->center().y;
+    result.sphere[2] = s->center().z;
+    result.sphere[3] = s->radius();
+    result.is_sphere = true;
+  }
+
+  return result;
+} // end scene::make_record()
 
-    if(i && (!result || i->ray_parameter() < result->ray_parameter()))
+
+void scene::adopt_new_surfaces()
+{
+  for(std::size_t i = handle_of_index_.size(); i < size(); ++i)
+  {
+    handle h;
+    if(free_handles_.empty())
+    {
+      h = static_cast<handle>(index_of_handle_.size());
+      index_of_handle_.push_back(static_cast<std::uint32_t>(i));
+    }
+    else
+    {
+      h = free_handles_.back();
+      free_handles_.pop_back();
+      index_of_handle_[h] = static_cast<std::uint32_t>(i);
+    }
+
+    handle_of_index_.push_back(h);
+    record_of_index_.push_back(record_location{false, 0});
+    emitter_position_of_index_.push_back(not_an_emitter);
+
+    add_emitter(i);
+
+    if(is_built_)
     {
-      result.emplace(*i, surface);
+      add_edited_record(i);
+
+      // the new record joins the edited hierarchy only when commit() rebuilds it
+      has_edits_ = true;
     }
   }
+} // end scene::adopt_new_surfaces()
+
+
+void scene::rebuild()
+{
+  hierarchy_ = bounding_volume_hierarchy(size(), [this](std::size_t i)
+  {
+    return (*this)[i].bounds();
+  });
+
+  // lay out the records in leaf order, so that each leaf's records are contiguous
+  packed_.clear();
+  packed_.reserve(size());
+
+  for(bounding_volume_hierarchy::index_type i : hierarchy_.elements())
+  {
+    record_of_index_[i] = record_location{false, static_cast<std::uint32_t>(packed_.size())};
+    packed_.push_back(make_record(i));
+  }
+
+  edited_hierarchy_ = bounding_volume_hierarchy();
+  edited_packed_.clear();
+  num_removed_ = 0;
+
+  is_built_ = true;
+} // end scene::rebuild()
+
+
+void scene::rebuild_edited()
+{
+  // drop the records of surfaces removed or moved again since they were edited
+  edited_packed_.erase(std::remove_if(edited_packed_.begin(), edited_packed_.end(), [](const packed_primitive& p)
+  {
+    return p.is_removed;
+  }),
+  edited_packed_.end());
+
+  edited_hierarchy_ = bounding_volume_hierarchy(edited_packed_.size(), [this](std::size_t i)
+  {
+    return (*this)[edited_packed_[i].primitive].bounds();
+  });
+
+  packed_primitives records;
+  records.reserve(edited_packed_.size());
+
+  for(bounding_volume_hierarchy::index_type i : edited_hierarchy_.elements())
+  {
+    record_of_index_[edited_packed_[i].primitive] = record_location{true, static_cast<std::uint32_t>(records.size())};
+    records.push_back(edited_packed_[i]);
+  }
+
+  edited_packed_ = std::move(records);
+} // end scene::rebuild_edited()
+
+
+void scene::remove_record(std::size_t i)
+{
+  if(!is_built_) return;
+
+  record_location location = record_of_index_[i];
+  if(location.is_edited)
+  {
+    edited_packed_[location.position].is_removed = true;
+  }
+  else
+  {
+    packed_[location.position].is_removed = true;
+    ++num_removed_;
+  }
+} // end scene::remove_record()
+
+
+void scene::add_edited_record(std::size_t i)
+{
+  record_of_index_[i] = record_location{true, static_cast<std::uint32_t>(edited_packed_.size())};
+  edited_packed_.push_back(make_record(i));
+} // end scene::add_edited_record()
+
+
+void scene::edit_record(std::size_t i)
+{
+  if(!is_built_) return;
+
+  remove_record(i);
+  add_edited_record(i);
+  has_edits_ = true;
+} // end scene::edit_record()
+
+
+void scene::add_emitter(std::size_t i)
+{
+  if(emitter_position_of_index_[i] == not_an_emitter && (*this)[i].material().is_emitter())
+  {
+    emitter_position_of_index_[i] = static_cast<std::uint32_t>(emitters_.size());
+    emitters_.push_back(static_cast<std::uint32_t>(i));
+  }
+} // end scene::add_emitter()
+
+
+void scene::remove_emitter(std::size_t i)
+{
+  std::uint32_t position = emitter_position_of_index_[i];
+  if(position == not_an_emitter) return;
+
+  // the last emitter takes the removed emitter's position
+  emitters_[position] = emitters_.back();
+  emitter_position_of_index_[emitters_[position]] = position;
+  emitters_.pop_back();
+
+  emitter_position_of_index_[i] = not_an_emitter;
+} // end scene::remove_emitter()
+
+
+scene::handle scene::add_surface(std::unique_ptr<surface>&& surf, const material& m)
+{
+  emplace_back(std::move(surf), m);
+  adopt_new_surfaces();
+
+  has_edits_ = has_edits_ || is_built_;
+
+  return handle_of_index_.back();
+} // end scene::add_surface()
+
+
+std::size_t scene::index_of(handle h) const
+{
+  if(h >= index_of_handle_.size() || index_of_handle_[h] == null_handle)
+  {
+    throw std::out_of_range("scene::index_of(): invalid handle");
+  }
+
+  return index_of_handle_[h];
+} // end scene::index_of()
+
+
+void scene::remove_surface(handle h)
+{
+  adopt_new_surfaces();
+
+  std::size_t i = index_of(h);
+  std::size_t last = size() - 1;
+
+  remove_record(i);
+  remove_emitter(i);
+
+  // move the last surface into the removed surface's place
+  if(i != last)
+  {
+    (*this)[i] = std::move((*this)[last]);
+
+    handle_of_index_[i] = handle_of_index_[last];
+    index_of_handle_[handle_of_index_[i]] = static_cast<std::uint32_t>(i);
+
+    record_of_index_[i] = record_of_index_[last];
+    if(is_built_)
+    {
+      packed_primitives& records = record_of_index_[i].is_edited ? edited_packed_ : packed_;
+      records[record_of_index_[i].position].primitive = static_cast<std::uint32_t>(i);
+    }
+
+    emitter_position_of_index_[i] = emitter_position_of_index_[last];
+    if(emitter_position_of_index_[i] != not_an_emitter)
+    {
+      emitters_[emitter_position_of_index_[i]] = static_cast<std::uint32_t>(i);
+    }
+  }
+
+  pop_back();
+  handle_of_index_.pop_back();
+  record_of_index_.pop_back();
+  emitter_position_of_index_.pop_back();
+
+  index_of_handle_[h] = null_handle;
+  free_handles_.push_back(h);
+
+  has_edits_ = has_edits_ || is_built_;
+} // end scene::remove_surface()
+
+
+void scene::transform_surface(handle h, const igloo::transform& xfrm)
+{
+  adopt_new_surfaces();
+
+  std::size_t i = index_of(h);
+
+  (*this)[i].transform(xfrm);
+
+  edit_record(i);
+} // end scene::transform_surface()
+
+
+void scene::update_points(handle h, const std::vector<point>& points)
+{
+  adopt_new_surfaces();
+
+  std::size_t i = index_of(h);
+
+  (*this)[i].update_points(points);
+
+  edit_record(i);
+} // end scene::update_points()
+
+
+void scene::update_points(handle h, const std::vector<point>& points, const std::vector<normal>& normals)
+{
+  adopt_new_surfaces();
+
+  std::size_t i = index_of(h);
+
+  (*this)[i].update_points(points, normals);
+
+  edit_record(i);
+} // end scene::update_points()
+
+
+void scene::bind_material(handle h, const material& m)
+{
+  adopt_new_surfaces();
+
+  std::size_t i = index_of(h);
+
+  remove_emitter(i);
+  (*this)[i].material(m);
+  add_emitter(i);
+
+  ++generation_;
+} // end scene::bind_material()
+
+
+optional<hit> scene::find_hit(const ray& r) const
+{
+  check_committed("scene::find_hit()");
+
+  optional<hit> result;
+  float nearest_t = r.end();
+
+  for_each_level([&](const bounding_volume_hierarchy& hierarchy, const packed_primitives& records)
+  {
+    // only accept intersections nearer than the nearest found in previous levels
+    ray nearer_than_level(r);
+    nearer_than_level.end(nearest_t);
+
+    nearest_t = hierarchy.intersect_leaves(nearer_than_level, [&](std::size_t begin, std::size_t end, float max_t)
+    {
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        if(records[i].is_removed) continue;
+
+        // only accept intersections nearer than the nearest found so far
+        ray nearer(r);
+        nearer.end(max_t);
+
+        auto h = find_hit(records[i], nearer);
+        if(h)
+        {
+          h->primitive = records[i].primitive;
+          max_t = h->ray_parameter;
+          result = h;
+        }
+      }
+
+      return max_t;
+    });
+  });
+
+  return result;
+} // end scene::find_hit()
+
+
+scene::intersection scene::intersection_at(const ray& r, const hit& h) const
+{
+  const surface_primitive& surface = (*this)[h.primitive];
+
+  return intersection(igloo::intersection(h.ray_parameter, surface.differential_geometry_at(r, h)), surface);
+} // end scene::intersection_at()
+
+
+optional<scene::intersection> scene::intersect(const ray& r) const
+{
+  optional<scene::intersection> result;
+
+  auto h = find_hit(r);
+  if(h)
+  {
+    result.emplace(intersection_at(r, *h));
+  }
 
   return result;
 } // end scene::intersect()
@@ -25,23 +378,346 @@ optional<scene::intersection> scene::intersect(const ray& r) const
 
 bool scene::is_intersected(const ray& r) const
 {
-  return std::any_of(surfaces().begin(), surfaces().end(), [&](const auto& surface)
+  check_committed("scene::is_intersected()");
+
+  bool result = false;
+
+  for_each_level([&](const bounding_volume_hierarchy& hierarchy, const packed_primitives& records)
   {
-    return surface.is_intersected(r);
+    result = result || hierarchy.any_of_leaves(r, [&](std::size_t begin, std::size_t end)
+    {
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        if(!records[i].is_removed && is_intersected(records[i], r)) return true;
+      }
+
+      return false;
+    });
   });
 
-  //for(const auto& surface : surfaces())
-  //{
-  //  if(surface.is_intersected(r))
-  //  {
-  //    std::cout << "hit surface " << surface.get_material().name() << std::endl;
-  //    return true;
-  //  }
-  //}
+  return result;
+} // end scene::is_intersected()
 
-  return false;
-} // end scene::intersect()
 
+optional<occluder_cache::occluder> scene::find_occluder(const ray& r) const
+{
+  check_committed("scene::find_occluder()");
+
+  optional<occluder_cache::occluder> result;
 
-} // end igloo
+  for_each_level([&](const bounding_volume_hierarchy& hierarchy, const packed_primitives& records)
+  {
+    if(result) return;
+
+    hierarchy.any_of_leaves(r, [&](std::size_t begin, std::size_t end)
+    {
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        if(records[i].is_removed) continue;
+
+        auto element = find_occluder(records[i], r);
+        if(element)
+        {
+          result = occluder_cache::occluder{records[i].primitive, *element};
+          return true;
+        }
+      }
+
+      return false;
+    });
+  });
+
+  return result;
+} // end scene::find_occluder()
+
+
+bool scene::is_intersected(const ray& r, std::size_t emitter, occluder_cache& cache) const
+{
+  check_committed("scene::is_intersected()");
+  check_emitter("scene::is_intersected()", emitter);
+  synchronize(cache);
+
+  if(is_intersected_by_cached(r, emitter, cache)) return true;
+
+  auto o = find_occluder(r);
+  if(o)
+  {
+    cache[emitter] = o;
+  }
+
+  return static_cast<bool>(o);
+} // end scene::is_intersected()
+
+
+void scene::find_hits(const ray_packet& packet, optional<hit>* hits) const
+{
+  check_committed("scene::find_hits()");
+
+  std::fill(hits, hits + packet.size(), nullopt);
+
+  // surfaces shorten the rays of nearer, a copy of packet, as they find hits
+  ray_packet nearer(packet);
+
+  for_each_level([&](const bounding_volume_hierarchy& hierarchy, const packed_primitives& records)
+  {
+    hierarchy.intersect_leaves(nearer, nearer.lanes(), [&](std::size_t begin, std::size_t end, ray_packet::mask_type mask)
+    {
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        if(records[i].is_removed) continue;
+
+        hit surface_hits[ray_packet::max_size];
+        ray_packet::mask_type hit_mask = (*this)[records[i].primitive].find_hits(nearer, mask, surface_hits);
+
+        ray_packet::for_each_lane(hit_mask, [&](std::size_t lane)
+        {
+          hits[lane] = surface_hits[lane];
+          hits[lane]->primitive = records[i].primitive;
+        });
+      }
+    });
+  });
+} // end scene::find_hits()
+
+
+ray_packet::mask_type scene::are_intersected(const ray_packet& packet) const
+{
+  check_committed("scene::are_intersected()");
+
+  return are_intersected(packet, packet.lanes(), nullptr);
+} // end scene::are_intersected()
+
+
+ray_packet::mask_type scene::are_intersected(const ray_packet& packet, std::size_t emitter, occluder_cache& cache) const
+{
+  check_committed("scene::are_intersected()");
+  check_emitter("scene::are_intersected()", emitter);
+  synchronize(cache);
+
+  ray_packet::mask_type result = 0;
+
+  ray_packet::for_each_lane(packet.lanes(), [&](std::size_t lane)
+  {
+    if(is_intersected_by_cached(packet[lane], emitter, cache))
+    {
+      result |= ray_packet::mask_type(1) << lane;
+    }
+  });
+
+  ray_packet::mask_type remaining = packet.lanes() & ~result;
+  if(remaining)
+  {
+    occluder_cache::occluder occluders[ray_packet::max_size];
+    ray_packet::mask_type traversed = are_intersected(packet, remaining, occluders);
+
+    // cache the occluder of a single occluded ray
+    if(traversed)
+    {
+      std::size_t lane = 0;
+      while(!(traversed & (ray_packet::mask_type(1) << lane))) ++lane;
+
+      cache[emitter] = occluders[lane];
+
+      result |= traversed;
+    }
+  }
+
+  return result;
+} // end scene::are_intersected()
+
+
+ray_packet::mask_type scene::are_intersected(const ray_packet& packet, ray_packet::mask_type mask, occluder_cache::occluder* occluders) const
+{
+  ray_packet::mask_type result = 0;
+
+  for_each_level([&](const bounding_volume_hierarchy& hierarchy, const packed_primitives& records)
+  {
+    // rays which intersect one level need not be tested against the next
+    ray_packet::mask_type remaining = mask & ~result;
+    if(!remaining) return;
+
+    result |= hierarchy.any_of_leaves(packet, remaining, [&](std::size_t begin, std::size_t end, ray_packet::mask_type mask)
+    {
+      ray_packet::mask_type leaf_result = 0;
+
+      // rays which intersect one surface need not be tested against the others
+      for(std::size_t i = begin; i < end && (mask & ~leaf_result); ++i)
+      {
+        if(records[i].is_removed) continue;
+
+        const surface_primitive& p = (*this)[records[i].primitive];
+
+        if(!occluders)
+        {
+          leaf_result |= p.are_intersected(packet, mask & ~leaf_result);
+          continue;
+        }
+
+        std::uint32_t elements[ray_packet::max_size];
+        ray_packet::mask_type occluded = p.find_occluders(packet, mask & ~leaf_result, elements);
+
+        ray_packet::for_each_lane(occluded, [&](std::size_t lane)
+        {
+          occluders[lane] = occluder_cache::occluder{records[i].primitive, elements[lane]};
+        });
+
+        leaf_result |= occluded;
+      }
+
+      return leaf_result;
+    });
+  });
+
+  return result;
+} // end scene::are_intersected()
+
+
+void scene::find_hits(array_ref<const ray> rays, array_ref<optional<hit>> hits) const
+{
+  check_committed("scene::find_hits()");
+
+  ray_stream stream(rays);
+  std::vector<ray_stream::index_type> indices = stream.sorted_indices(hierarchy_.bounding_box());
+
+  std::vector<hit> stream_hits(rays.size());
+
+  // the ends of the rays of a leaf before each surface shortens them, which identify the rays it hits
+  std::vector<float> ends;
+
+  for_each_level([&](const bounding_volume_hierarchy& hierarchy, const packed_primitives& records)
+  {
+    hierarchy.intersect_leaves(stream, indices, [&](std::size_t begin, std::size_t end, array_ref<const ray_stream::index_type> leaf_indices)
+    {
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        if(records[i].is_removed) continue;
+
+        ends.clear();
+        for(ray_stream::index_type ray_index : leaf_indices)
+        {
+          ends.push_back(stream.end(ray_index));
+        }
+
+        (*this)[records[i].primitive].find_hits(stream, leaf_indices, stream_hits);
+
+        for(std::size_t j = 0; j < leaf_indices.size(); ++j)
+        {
+          if(stream.end(leaf_indices[j]) < ends[j])
+          {
+            stream_hits[leaf_indices[j]].primitive = records[i].primitive;
+          }
+        }
+      }
+    });
+  });
+
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    if(stream.end(i) < rays[i].end())
+    {
+      hits[i] = stream_hits[i];
+    }
+    else
+    {
+      hits[i] = nullopt;
+    }
+  }
+} // end scene::find_hits()
+
+
+void scene::are_intersected(array_ref<const ray> rays, array_ref<bool> results) const
+{
+  check_committed("scene::are_intersected()");
+
+  ray_stream stream(rays);
+  std::vector<ray_stream::index_type> indices = stream.sorted_indices(hierarchy_.bounding_box());
 
+  // surfaces retire the rays they intersect, so the rest of the traversal, including the next level's, skips them
+  for_each_level([&](const bounding_volume_hierarchy& hierarchy, const packed_primitives& records)
+  {
+    hierarchy.intersect_leaves(stream, indices, [&](std::size_t begin, std::size_t end, array_ref<const ray_stream::index_type> leaf_indices)
+    {
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        if(records[i].is_removed) continue;
+
+        (*this)[records[i].primitive].are_intersected(stream, leaf_indices);
+      }
+    });
+  });
+
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    results[i] = stream.is_retired(i);
+  }
+} // end scene::are_intersected()
+
+
+void scene::are_intersected(array_ref<const ray> rays, array_ref<const std::uint32_t> emitters, occluder_cache& cache,
+                            array_ref<bool> results) const
+{
+  check_committed("scene::are_intersected()");
+  for(std::uint32_t emitter : emitters)
+  {
+    check_emitter("scene::are_intersected()", emitter);
+  }
+  synchronize(cache);
+
+  ray_stream stream(rays);
+
+  // rays blocked by their emitter's cached occluder are retired before the traversal, which skips them
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    if(is_intersected_by_cached(rays[i], emitters[i], cache))
+    {
+      stream.retire(i);
+    }
+  }
+
+  std::vector<ray_stream::index_type> indices = stream.sorted_indices(hierarchy_.bounding_box());
+  indices.erase(std::remove_if(indices.begin(), indices.end(), [&](ray_stream::index_type i)
+  {
+    return stream.is_retired(i);
+  }),
+  indices.end());
+
+  // the occluder of each ray the traversal retires
+  std::vector<optional<occluder_cache::occluder>> occluders(rays.size());
+  std::vector<std::uint32_t> elements(rays.size());
+
+  for_each_level([&](const bounding_volume_hierarchy& hierarchy, const packed_primitives& records)
+  {
+    hierarchy.intersect_leaves(stream, indices, [&](std::size_t begin, std::size_t end, array_ref<const ray_stream::index_type> leaf_indices)
+    {
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        if(records[i].is_removed) continue;
+
+        (*this)[records[i].primitive].find_occluders(stream, leaf_indices, elements);
+
+        // the rays retired without an occluder yet were retired by this surface
+        for(ray_stream::index_type ray_index : leaf_indices)
+        {
+          if(stream.is_retired(ray_index) && !occluders[ray_index])
+          {
+            occluders[ray_index] = occluder_cache::occluder{records[i].primitive, elements[ray_index]};
+          }
+        }
+      }
+    });
+  });
+
+  // cache the occluder of the last ray occluded toward each emitter
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    results[i] = stream.is_retired(i);
+
+    if(occluders[i])
+    {
+      cache[emitters[i]] = occluders[i];
+    }
+  }
+} // end scene::are_intersected()
+
+
+} // end igloo
@@ -1,8 +1,17 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <iterator>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
 #include <igloo/primitives/surface_primitive.hpp>
-#include <igloo/utility/filter_iterator.hpp>
+#include <igloo/primitives/occluder_cache.hpp>
+#include <igloo/geometry/bounding_volume_hierarchy.hpp>
+#include <igloo/geometry/transform.hpp>
+#include <igloo/utility/aligned_allocator.hpp>
 
 namespace igloo
 {
@@ -33,18 +42,173 @@ class scene : public std::vector<surface_primitive>
         const surface_primitive& surface_;
     };
 
+    /*! A handle identifies a surface of this scene across edits, unlike the surface's index, which removals may change.
+     *  The handle of a removed surface may be reused by a later add_surface().
+     */
+    using handle = std::uint32_t;
+
+    static constexpr handle null_handle = ~handle(0);
+
+    /*! Commits this scene: builds the hierarchy over the bounds of its surfaces which accelerates intersection queries,
+     *  packs a record of each surface into a contiguous, cache-aligned array in the hierarchy's leaf order,
+     *  and gathers the indices of its emitters.
+     *  Queries and emitters() read only this committed form.
+     *  Once committed, surfaces added, removed or transformed by the edit functions below are recorded under a second,
+     *  small hierarchy, which commit() rebuilds alone; the whole scene is rebuilt only once edits reach a quarter of it.
+     *  \note This must be called after surfaces are added to or removed from this scene and before intersection queries.
+     *        Surfaces added with emplace_back() are given handles here; after the first commit(),
+     *        surfaces must be removed only with remove_surface().
+     */
+    void commit();
+
+    /*! \return true if this scene has no edits since the last commit(); false, otherwise.
+     */
+    bool is_committed() const;
+
+    /*! Adds a surface to this scene.
+     *  \param surf A surface to take ownership of.
+     *  \param m The material of the new surface.
+     *  \return A handle to the new surface.
+     */
+    handle add_surface(std::unique_ptr<surface>&& surf, const material& m);
+
+    /*! Removes a surface from this scene.
+     *  The last surface takes the removed surface's index; other surfaces keep theirs, and every other handle remains valid.
+     *  \param h The handle of the surface to remove.
+     */
+    void remove_surface(handle h);
+
+    /*! Moves a surface of this scene by a transform applied after its current placement.
+     *  \param h The handle of the surface to move.
+     *  \param xfrm The transform to apply, in world space.
+     */
+    void transform_surface(handle h, const igloo::transform& xfrm);
+
+    /*! Moves the points of a mesh of this scene, keeping its triangles, e.g. to animate a deforming mesh.
+     *  The mesh's own hierarchy is refit, and its record is moved among the edited surfaces, whose bounds commit() refreshes.
+     *  \param h The handle of a surface which is exactly a mesh.
+     *  \param points An array of points, the same size as the array the mesh was created with.
+     *  \throws std::logic_error if the surface is not a mesh, or if the mesh rejects points.
+     */
+    void update_points(handle h, const std::vector<point>& points);
+
+    /*! Moves the points of a mesh of this scene and replaces its vertex normals, keeping its triangles.
+     *  \param h The handle of a surface which is exactly a mesh.
+     *  \param points An array of points, the same size as the array the mesh was created with.
+     *  \param normals An array of normals, the same size as the array the mesh was created with.
+     *  \throws std::logic_error if the surface is not a mesh, or if the mesh rejects points or normals.
+     */
+    void update_points(handle h, const std::vector<point>& points, const std::vector<normal>& normals);
+
+    /*! Binds a different material to a surface of this scene.
+     *  The emitters are updated immediately; the scene need not be committed again.
+     *  \param h The handle of the surface.
+     *  \param m The new material.
+     */
+    void bind_material(handle h, const material& m);
+
+    /*! \return The index of the surface with the given handle.
+     *  \throws std::out_of_range if h identifies no surface of this scene.
+     */
+    std::size_t index_of(handle h) const;
+
     /*! Tests for intersection between a ray and this scene and returns the details of the intersection if it exists.
      *  \param r The ray of interest.
      *  \param nullopt if no intersection exists; otherwise, the details of the intersection.
      */
     optional<intersection> intersect(const ray &r) const;
 
+    /*! Tests for intersection between a ray and this scene and returns a compact record of the nearest intersection.
+     *  Only the nearest surface's differential_geometry need be computed, and only when requested through intersection_at().
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists; otherwise, a hit whose primitive is the index of the hit surface.
+     */
+    optional<hit> find_hit(const ray &r) const;
+
+    /*! Computes the details of an intersection previously found by find_hit().
+     *  \param r The ray which produced h.
+     *  \param h A hit returned by find_hit(r).
+     *  \return The details of the intersection.
+     */
+    intersection intersection_at(const ray &r, const hit &h) const;
+
     /*! Tests for intersection between a ray and this scene.
      *  \param r The ray of interest.
      *  \return false if no intersection exists; true, otherwise.
      */
     bool is_intersected(const ray& r) const;
 
+    /*! Finds a surface element which a ray intersects, which need not be the nearest.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists; otherwise, the index of an intersected surface and its element.
+     */
+    optional<occluder_cache::occluder> find_occluder(const ray& r) const;
+
+    /*! Tests for intersection between a shadow ray toward an emitter and this scene.
+     *  The element which blocked the last shadow ray toward the same emitter is tested first, and only if it does not
+     *  block r is this scene's hierarchy traversed, and the element found recorded in its place.
+     *  \param r The ray of interest.
+     *  \param emitter The position in emitters() of the emitter toward which r points.
+     *  \param cache The occluders of the last shadow rays toward each emitter; emptied first if it is stale.
+     *  \return false if no intersection exists; true, otherwise.
+     *  \throws std::out_of_range if emitter is not a position in emitters().
+     */
+    bool is_intersected(const ray& r, std::size_t emitter, occluder_cache& cache) const;
+
+    /*! Finds the nearest hit of each of a packet's rays with this scene, traversing the scene's hierarchy once for the whole packet.
+     *  \param packet The rays of interest.
+     *  \param hits An array of packet.size() elements; hits[i] receives nullopt if the ray in lane i hits nothing,
+     *              and otherwise a hit whose primitive is the index of the hit surface.
+     */
+    void find_hits(const ray_packet& packet, optional<hit>* hits) const;
+
+    /*! Tests which of a packet's rays intersect this scene, traversing the scene's hierarchy once for the whole packet.
+     *  \param packet The rays of interest.
+     *  \return The lanes of packet whose rays intersect this scene.
+     */
+    ray_packet::mask_type are_intersected(const ray_packet& packet) const;
+
+    /*! Tests which of a packet of shadow rays toward an emitter intersect this scene.
+     *  Each ray is first tested against the element which blocked the last shadow ray toward the emitter,
+     *  and only the rest traverse the scene's hierarchy together.
+     *  \param packet The rays of interest.
+     *  \param emitter The position in emitters() of the emitter toward which the rays point.
+     *  \param cache The occluders of the last shadow rays toward each emitter; emptied first if it is stale.
+     *  \return The lanes of packet whose rays intersect this scene.
+     *  \throws std::out_of_range if emitter is not a position in emitters().
+     */
+    ray_packet::mask_type are_intersected(const ray_packet& packet, std::size_t emitter, occluder_cache& cache) const;
+
+    /*! Finds the nearest hit of each ray of a large, possibly incoherent batch with this scene.
+     *  The rays are sorted by direction and origin, then traverse this scene's hierarchy together as a stream,
+     *  which is filtered at each node down to the rays which intersect it.
+     *  \param rays The rays of interest.
+     *  \param hits An array of rays.size() elements; hits[i] receives nullopt if rays[i] hits nothing,
+     *              and otherwise a hit whose primitive is the index of the hit surface.
+     */
+    void find_hits(array_ref<const ray> rays, array_ref<optional<hit>> hits) const;
+
+    /*! Tests which rays of a large, possibly incoherent batch intersect this scene, traversing them together as a stream.
+     *  \param rays The rays of interest.
+     *  \param results An array of rays.size() elements; results[i] receives true if rays[i] intersects this scene
+     *                 and false otherwise.
+     */
+    void are_intersected(array_ref<const ray> rays, array_ref<bool> results) const;
+
+    /*! Tests which shadow rays of a large batch intersect this scene.
+     *  Each ray is first tested against the element which blocked the last shadow ray toward its emitter,
+     *  and only the rest traverse the scene's hierarchy together as a stream.
+     *  \param rays The rays of interest.
+     *  \param emitters An array of rays.size() elements; emitters[i] is the position in emitters() of the emitter
+     *                  toward which rays[i] points.
+     *  \param cache The occluders of the last shadow rays toward each emitter; emptied first if it is stale.
+     *  \param results An array of rays.size() elements; results[i] receives true if rays[i] intersects this scene
+     *                 and false otherwise.
+     *  \throws std::out_of_range if an element of emitters is not a position in emitters().
+     */
+    void are_intersected(array_ref<const ray> rays, array_ref<const std::uint32_t> emitters, occluder_cache& cache,
+                         array_ref<bool> results) const;
+
     class surfaces_view
     {
       public:
@@ -77,30 +241,76 @@ class scene : public std::vector<surface_primitive>
 
     class emitters_view
     {
-      private:
-        struct is_emitter
+      public:
+        class iterator
         {
-          bool operator()(const surface_primitive& surface) const
-          {
-            return surface.material().is_emitter();
-          }
+          public:
+            using value_type = surface_primitive;
+            using reference = const surface_primitive&;
+            using pointer = const surface_primitive*;
+            using difference_type = std::ptrdiff_t;
+            using iterator_category = std::forward_iterator_tag;
+
+            iterator(const scene& self, std::vector<std::uint32_t>::const_iterator i)
+              : self_(&self),
+                base_(i)
+            {}
+
+            reference operator*() const
+            {
+              return (*self_)[*base_];
+            }
+
+            pointer operator->() const
+            {
+              return &**this;
+            }
+
+            iterator& operator++()
+            {
+              ++base_;
+              return *this;
+            }
+
+            iterator operator++(int)
+            {
+              iterator result = *this;
+              ++base_;
+              return result;
+            }
+
+            bool operator==(const iterator& other) const
+            {
+              return base_ == other.base_;
+            }
+
+            bool operator!=(const iterator& other) const
+            {
+              return base_ != other.base_;
+            }
+
+          private:
+            const scene* self_;
+            std::vector<std::uint32_t>::const_iterator base_;
         };
 
-      public:
         emitters_view(const scene& self)
           : self_(self)
         {}
 
-        using iterator = filter_iterator<is_emitter, surfaces_view::iterator>;
-
         iterator begin() const
         {
-          return iterator(is_emitter(), self_.surfaces().begin(), self_.surfaces().end());
+          return iterator(self_, self_.emitters_.begin());
         }
 
         iterator end() const
         {
-          return iterator(is_emitter(), self_.surfaces().end(), self_.surfaces().end());
+          return iterator(self_, self_.emitters_.end());
+        }
+
+        std::size_t size() const
+        {
+          return self_.emitters_.size();
         }
 
       private:
@@ -109,8 +319,170 @@ class scene : public std::vector<surface_primitive>
 
     emitters_view emitters() const
     {
+      check_committed("scene::emitters()");
       return emitters_view(*this);
     }
+
+  private:
+    // the committed record of a surface, which leaf traversals read in place of the surface_primitive;
+    // two records share each cache line
+    struct alignas(32) packed_primitive
+    {
+      // the center and radius of the surface if it is a sphere, which is intersected here without visiting the surface
+      float sphere[4];
+
+      // the index of the surface in this scene
+      std::uint32_t primitive;
+
+      bool is_sphere;
+
+      // whether the surface was removed or moved since the record was made, which traversals skip
+      bool is_removed;
+    };
+
+    using packed_primitives = std::vector<packed_primitive, aligned_allocator<packed_primitive>>;
+
+    // where the record of a surface lies
+    struct record_location
+    {
+      bool is_edited;
+      std::uint32_t position;
+    };
+
+    static constexpr std::uint32_t not_an_emitter = ~std::uint32_t(0);
+
+    inline void check_committed(const char* caller) const
+    {
+      if(!is_committed())
+      {
+        throw std::logic_error(std::string(caller) + ": scene is not committed; call commit()");
+      }
+    }
+
+    // calls f with the hierarchy and records of the committed surfaces, then with those of the edited surfaces
+    template<class Function>
+    inline void for_each_level(Function f) const
+    {
+      f(hierarchy_, packed_);
+
+      if(!edited_packed_.empty())
+      {
+        f(edited_hierarchy_, edited_packed_);
+      }
+    }
+
+    // returns the hit of the ray r with the packed surface p
+    inline optional<hit> find_hit(const packed_primitive& p, const ray& r) const
+    {
+      if(p.is_sphere)
+      {
+        auto t = sphere::intersect_ray_parameter(r, point(p.sphere[0], p.sphere[1], p.sphere[2]), p.sphere[3]);
+        return t ? optional<hit>(hit{0, 0, *t, float2(0.f)}) : nullopt;
+      }
+
+      return (*this)[p.primitive].find_hit(r);
+    }
+
+    inline bool is_intersected(const packed_primitive& p, const ray& r) const
+    {
+      if(p.is_sphere)
+      {
+        return static_cast<bool>(sphere::intersect_ray_parameter(r, point(p.sphere[0], p.sphere[1], p.sphere[2]), p.sphere[3]));
+      }
+
+      return (*this)[p.primitive].is_intersected(r);
+    }
+
+    inline optional<std::uint32_t> find_occluder(const packed_primitive& p, const ray& r) const
+    {
+      if(p.is_sphere)
+      {
+        return is_intersected(p, r) ? optional<std::uint32_t>(0) : nullopt;
+      }
+
+      return (*this)[p.primitive].find_occluder(r);
+    }
+
+    // empties cache if it holds occluders of an earlier generation of this scene
+    inline void synchronize(occluder_cache& cache) const
+    {
+      if(cache.generation() != generation_ || cache.size() != emitters_.size())
+      {
+        cache.reset(emitters_.size(), generation_);
+      }
+    }
+
+    inline void check_emitter(const char* caller, std::size_t emitter) const
+    {
+      if(emitter >= emitters_.size())
+      {
+        throw std::out_of_range(std::string(caller) + ": emitter is not a position in emitters()");
+      }
+    }
+
+    // tests the ray r against the cached occluder of its emitter and counts the lookup
+    inline bool is_intersected_by_cached(const ray& r, std::size_t emitter, occluder_cache& cache) const
+    {
+      const optional<occluder_cache::occluder>& o = cache[emitter];
+
+      bool result = o && o->primitive < size() && (*this)[o->primitive].is_element_intersected(r, o->element);
+      cache.count_lookup(result);
+
+      return result;
+    }
+
+    // tests the lanes of mask against the scene, and if occluders is not null, records the occluder of each intersected lane
+    ray_packet::mask_type are_intersected(const ray_packet& packet, ray_packet::mask_type mask, occluder_cache::occluder* occluders) const;
+
+    packed_primitive make_record(std::size_t i) const;
+
+    // gives handles to the surfaces added with emplace_back() since the last edit
+    void adopt_new_surfaces();
+
+    void rebuild();
+
+    void rebuild_edited();
+
+    void remove_record(std::size_t i);
+
+    void add_edited_record(std::size_t i);
+
+    // moves the record of surface i, whose bounds have changed, among the edited surfaces
+    void edit_record(std::size_t i);
+
+    void add_emitter(std::size_t i);
+
+    void remove_emitter(std::size_t i);
+
+    bounding_volume_hierarchy hierarchy_;
+
+    // the surfaces' records in the leaf order of hierarchy_
+    packed_primitives packed_;
+
+    // the hierarchy and records of the surfaces added or moved since hierarchy_ was built
+    bounding_volume_hierarchy edited_hierarchy_;
+    packed_primitives edited_packed_;
+
+    // the number of records in packed_ marked removed
+    std::size_t num_removed_ = 0;
+
+    bool is_built_ = false;
+    bool has_edits_ = false;
+
+    // advanced by each commit() and bind_material(), after which the entries of occluder_caches may be stale
+    std::uint64_t generation_ = 0;
+
+    // indexed by surface
+    std::vector<handle> handle_of_index_;
+    std::vector<record_location> record_of_index_;
+    std::vector<std::uint32_t> emitter_position_of_index_;
+
+    // indexed by handle; removed surfaces' handles map to null_handle until reused
+    std::vector<std::uint32_t> index_of_handle_;
+    std::vector<handle> free_handles_;
+
+    // the indices of the surfaces whose materials emit
+    std::vector<std::uint32_t> emitters_;
 };
 
 
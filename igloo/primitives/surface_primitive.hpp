@@ -1,9 +1,19 @@
 #pragma once
 
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <vector>
 #include <igloo/surfaces/surface.hpp>
+#include <igloo/surfaces/mesh.hpp>
+#include <igloo/surfaces/sphere.hpp>
+#include <igloo/surfaces/sphere_set.hpp>
+#include <igloo/surfaces/instance.hpp>
+#include <igloo/geometry/transform.hpp>
 #include <igloo/materials/material.hpp>
 #include <igloo/utility/optional.hpp>
+#include <igloo/utility/variant.hpp>
 
 namespace igloo
 {
@@ -18,7 +28,8 @@ class surface_primitive
      */
     inline surface_primitive(std::unique_ptr<surface> &&surf, const material &m)
       : surface_(std::move(surf)),
-        material_(m)
+        kernel_(classify(surface_.get())),
+        material_(&m)
     {}
 
     /*! \return A triangle_mesh approximating this surface_primitive.
@@ -28,6 +39,13 @@ class surface_primitive
       return surface_->triangulate();
     } // end triangulate();
 
+    /*! \return A bounding_box bounding this surface_primitive.
+     */
+    inline bounding_box bounds() const
+    {
+      return surface_->bounds();
+    } // end bounds()
+
     /*! Tests for intersection between a ray and this surface_primitive and returns the details of the intersection, if it exists.
      *  \param r The ray of interest.
      *  \param nullopt if no intersection exists, otherwise the details of the intersection.
@@ -37,20 +55,145 @@ class surface_primitive
       return surface_->intersect(r);
     } // end intersect()
 
+    /*! Tests for intersection between a ray and this surface_primitive and returns a compact record of the nearest intersection.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists, otherwise a hit whose primitive is 0.
+     */
+    inline optional<hit> find_hit(const ray &r) const
+    {
+      return std::experimental::visit(find_hit_visitor{r}, kernel_);
+    } // end find_hit()
+
+    /*! \return The differential_geometry of this surface_primitive at a hit returned by find_hit(r).
+     */
+    inline differential_geometry differential_geometry_at(const ray &r, const hit &h) const
+    {
+      return std::experimental::visit(differential_geometry_at_visitor{r,h}, kernel_);
+    } // end differential_geometry_at()
+
     /*! Tests for intersection between a ray and this surface_primitive.
      *  \param r The ray of interest.
      *  \return false if no intersection exists; true, otherwise.
      */
     inline bool is_intersected(const ray& r) const
     {
-      return surface_->is_intersected(r);
+      return std::experimental::visit(is_intersected_visitor{r}, kernel_);
     } // end is_intersected()
 
+    /*! Finds an element of this surface_primitive which a ray intersects, which need not be the nearest.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists; otherwise, the element of an intersection.
+     */
+    inline optional<std::uint32_t> find_occluder(const ray& r) const
+    {
+      return surface_->find_occluder(r);
+    } // end find_occluder()
+
+    /*! Tests whether a ray intersects a single element of this surface_primitive, previously returned by find_occluder().
+     *  \param r The ray of interest.
+     *  \param element The element of interest.
+     *  \return true if r intersects element; false, otherwise.
+     */
+    inline bool is_element_intersected(const ray& r, std::uint32_t element) const
+    {
+      return surface_->is_element_intersected(r, element);
+    } // end is_element_intersected()
+
+    /*! Finds the nearest hit of each of a packet's rays with this surface_primitive.
+     *  \param packet The rays of interest. The end of each ray's interval is shortened to its hit, if any.
+     *  \param mask The lanes of packet to intersect.
+     *  \param hits For each lane of the result, a hit whose primitive is 0.
+     *  \return The lanes of mask whose rays hit this surface_primitive nearer than the end of their intervals.
+     */
+    inline ray_packet::mask_type find_hits(ray_packet& packet, ray_packet::mask_type mask, hit* hits) const
+    {
+      return surface_->find_hits(packet, mask, hits);
+    } // end find_hits()
+
+    /*! Tests which of a packet's rays intersect this surface_primitive.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to test.
+     *  \return The lanes of mask whose rays intersect this surface_primitive.
+     */
+    inline ray_packet::mask_type are_intersected(const ray_packet& packet, ray_packet::mask_type mask) const
+    {
+      return surface_->are_intersected(packet, mask);
+    } // end are_intersected()
+
+    /*! Finds an element of this surface_primitive which each of a packet's rays intersects.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to test.
+     *  \param elements For each lane of the result, the element of an intersection, as returned by find_occluder().
+     *  \return The lanes of mask whose rays intersect this surface_primitive.
+     */
+    inline ray_packet::mask_type find_occluders(const ray_packet& packet, ray_packet::mask_type mask, std::uint32_t* elements) const
+    {
+      return surface_->find_occluders(packet, mask, elements);
+    } // end find_occluders()
+
+    /*! Finds the nearest hit of each of a stream's rays with this surface_primitive.
+     *  \param stream The rays of interest. The end of each ray's interval is shortened to its hit, if any.
+     *  \param indices The indices of the rays of stream to intersect.
+     *  \param hits hits[i] receives a hit whose primitive is 0 if the ray with index i hits this surface_primitive
+     *              nearer than the end of its interval.
+     */
+    inline void find_hits(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<hit> hits) const
+    {
+      surface_->find_hits(stream, indices, hits);
+    } // end find_hits()
+
+    /*! Tests which of a stream's rays intersect this surface_primitive.
+     *  \param stream The rays of interest. Each ray which intersects this surface_primitive is retired.
+     *  \param indices The indices of the rays of stream to test.
+     */
+    inline void are_intersected(ray_stream& stream, array_ref<const ray_stream::index_type> indices) const
+    {
+      surface_->are_intersected(stream, indices);
+    } // end are_intersected()
+
+    /*! Finds an element of this surface_primitive which each of a stream's rays intersects.
+     *  \param stream The rays of interest. Each ray which intersects this surface_primitive is retired.
+     *  \param indices The indices of the rays of stream to test.
+     *  \param elements elements[i] receives the element of an intersection, as returned by find_occluder(),
+     *                  if the ray with index i is retired.
+     */
+    inline void find_occluders(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<std::uint32_t> elements) const
+    {
+      surface_->find_occluders(stream, indices, elements);
+    } // end find_occluders()
+
     /*! \return This surface_primitive's material.
      */
     inline const igloo::material &material() const
     {
-      return material_;
+      return *material_;
+    }
+
+    /*! Binds a different material to this surface_primitive.
+     *  \param m The new material.
+     */
+    inline void material(const igloo::material &m)
+    {
+      material_ = &m;
+    }
+
+    /*! Moves this surface_primitive by a transform applied after its current placement.
+     *  The surface becomes an instance of itself, or if it is already an instance, its transform is composed with xfrm.
+     *  \param xfrm The transform to apply, in world space.
+     */
+    inline void transform(const igloo::transform &xfrm)
+    {
+      if(typeid(*surface_) == typeid(instance))
+      {
+        const instance& placed = static_cast<const instance&>(*surface_);
+        surface_ = std::make_unique<instance>(placed.shared_prototype(), xfrm * placed.transform());
+      }
+      else
+      {
+        surface_ = std::make_unique<instance>(std::shared_ptr<const igloo::surface>(std::move(surface_)), xfrm);
+      }
+
+      kernel_ = classify(surface_.get());
     }
 
     /*! \return The differential_geometry of the surface at coordinates (u0, u1).
@@ -60,6 +203,13 @@ class surface_primitive
       return surface_->sample_surface(u0, u1);
     }
 
+    /*! \return The surface area of this surface_primitive.
+     */
+    inline float area() const
+    {
+      return surface_->area();
+    }
+
     /*! \return The value of the probability density function at the given surface location.
      */
     inline float pdf(const differential_geometry& dg) const
@@ -67,9 +217,117 @@ class surface_primitive
       return surface_->pdf(dg);
     }
 
+    /*! Moves the points of this surface_primitive's mesh, keeping its triangles. See mesh::update_points().
+     *  \param points An array of points, the same size as the array the mesh was created with.
+     *  \throws std::logic_error if the surface is not exactly a mesh, or if the mesh rejects points.
+     */
+    inline void update_points(const std::vector<point> &points)
+    {
+      mutable_mesh("surface_primitive::update_points()").update_points(points);
+    }
+
+    /*! Moves the points of this surface_primitive's mesh and replaces its vertex normals, keeping its triangles.
+     *  \param points An array of points, the same size as the array the mesh was created with.
+     *  \param normals An array of normals, the same size as the array the mesh was created with.
+     *  \throws std::logic_error if the surface is not exactly a mesh, or if the mesh rejects points or normals.
+     */
+    inline void update_points(const std::vector<point> &points, const std::vector<normal> &normals)
+    {
+      mutable_mesh("surface_primitive::update_points()").update_points(points, normals);
+    }
+
+    /*! \return This surface_primitive's surface if it is exactly a sphere; nullptr, otherwise.
+     */
+    inline const sphere* as_sphere() const
+    {
+      return typeid(*surface_) == typeid(sphere) ? static_cast<const sphere*>(surface_.get()) : nullptr;
+    }
+
   private:
+    // the surface, if it is exactly a mesh, which this surface_primitive owns alone and so may modify in place;
+    // kernel_ keeps pointing to it
+    inline igloo::mesh& mutable_mesh(const char* caller)
+    {
+      if(typeid(*surface_) != typeid(igloo::mesh))
+      {
+        throw std::logic_error(std::string(caller) + ": surface is not a mesh");
+      }
+
+      return static_cast<igloo::mesh&>(*surface_);
+    }
+
+    // the built-in surfaces, whose kernels the intersection queries above call without virtual dispatch,
+    // and any other surface, which remains reachable through the virtual interface of surface
+    using kernel_type = std::experimental::variant<
+      const mesh*,
+      const sphere*,
+      const sphere_set*,
+      const surface*
+    >;
+
+    inline static kernel_type classify(const surface* s)
+    {
+      // match types exactly, since a class derived from a built-in surface may override its kernels
+      if(typeid(*s) == typeid(mesh))       return static_cast<const mesh*>(s);
+      if(typeid(*s) == typeid(sphere))     return static_cast<const sphere*>(s);
+      if(typeid(*s) == typeid(sphere_set)) return static_cast<const sphere_set*>(s);
+
+      return s;
+    }
+
+    // qualified calls name a built-in surface's own kernel, so the compiler may inline it
+    struct find_hit_visitor
+    {
+      const ray& r;
+
+      template<class Surface>
+      optional<hit> operator()(const Surface* s) const
+      {
+        return s->Surface::find_hit(r);
+      }
+
+      optional<hit> operator()(const surface* s) const
+      {
+        return s->find_hit(r);
+      }
+    };
+
+    struct differential_geometry_at_visitor
+    {
+      const ray& r;
+      const hit& h;
+
+      template<class Surface>
+      differential_geometry operator()(const Surface* s) const
+      {
+        return s->Surface::differential_geometry_at(r, h);
+      }
+
+      differential_geometry operator()(const surface* s) const
+      {
+        return s->differential_geometry_at(r, h);
+      }
+    };
+
+    struct is_intersected_visitor
+    {
+      const ray& r;
+
+      template<class Surface>
+      bool operator()(const Surface* s) const
+      {
+        return s->Surface::is_intersected(r);
+      }
+
+      bool operator()(const surface* s) const
+      {
+        return s->is_intersected(r);
+      }
+    };
+
     std::unique_ptr<igloo::surface> surface_;
-    const igloo::material &material_;
+    kernel_type kernel_;
+    const igloo::material *material_;
 }; // end surface_primitive
 
 
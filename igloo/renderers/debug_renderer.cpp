@@ -3,13 +3,16 @@
 #include <igloo/surfaces/sphere.hpp>
 #include <igloo/surfaces/mesh.hpp>
 #include <igloo/scattering/perspective_sensor.hpp>
+#include <igloo/renderers/tile.hpp>
+#include <mutex>
+#include <vector>
 
 namespace igloo
 {
 
 
-debug_renderer::debug_renderer(const scene &s, image &im)
-  : m_scene(s), m_image(im)
+debug_renderer::debug_renderer(const scene &s, image &im, std::size_t num_threads)
+  : m_scene(s), m_image(im), m_scheduler(num_threads)
 {}
 
 
@@ -31,42 +34,55 @@ void debug_renderer::render(const float4x4 &modelview, render_progress &progress
 
   perspective_sensor perspective(fovy_radians, 1.f);
 
+  float u_spacing = 1.f / m_image.width();
   float v_spacing = 1.f / m_image.height();
-  float v = v_spacing / 2;
-  for(image::size_type row = 0; row < m_image.height(); ++row, v += v_spacing)
+
+  std::vector<tile> tiles = tile_image(m_image, 16);
+
+  // render_progress is not thread-safe, so workers report each finished tile under a lock
+  std::mutex progress_mutex;
+
+  m_scheduler.for_each(tiles.size(), [&](std::size_t, std::size_t tile_index)
   {
-    float u_spacing = 1.f / m_image.width();
-    float u = u_spacing / 2;
-    for(image::size_type col = 0; col < m_image.width(); ++col, u += u_spacing)
-    {
-      ray r(eye, sample_with_basis(perspective, right, up, look, u, v));
+    const tile& t = tiles[tile_index];
 
-      auto intersection = m_scene.intersect(r);
-      if(intersection)
+    for(image::size_type row = t.row_begin; row < t.row_end; ++row)
+    {
+      for(image::size_type col = t.col_begin; col < t.col_end; ++col)
       {
-        const differential_geometry &dg = intersection->differential_geometry();
+        float u = u_spacing / 2 + col * u_spacing;
+        float v = v_spacing / 2 + row * v_spacing;
 
-        vector wo = -normalize(r.direction());
+        ray r(eye, sample_with_basis(perspective, right, up, look, u, v));
 
-        // transform wo into dg's local coordinate system
-        wo = dg.localize(wo);
+        auto intersection = m_scene.intersect(r);
+        if(intersection)
+        {
+          const differential_geometry &dg = intersection->differential_geometry();
 
-        vector wi = wo;
+          vector wo = -normalize(r.direction());
 
-        const surface_primitive& surface = intersection->surface();
+          // transform wo into dg's local coordinate system
+          wo = dg.localize(wo);
 
-        scattering_distribution_function f = surface.material().evaluate_scattering(dg);
-        scattering_distribution_function e = surface.material().evaluate_emission(dg);
+          vector wi = wo;
 
-        // XXX we should rotate wo into the basis of the shading point, and then evaluate these functions
-        //     to do that, we need a tangent and normal vector
-        
-        m_image.raster(col, row) = f(wo,wi) * dg.abs_cos_theta(wi) + e(wo);
-      } // end if
+          const surface_primitive& surface = intersection->surface();
 
-      progress++;
-    } // end for col
-  } // end for row
+          scattering_distribution_function f = surface.material().evaluate_scattering(dg);
+          scattering_distribution_function e = surface.material().evaluate_emission(dg);
+
+          // XXX we should rotate wo into the basis of the shading point, and then evaluate these functions
+          //     to do that, we need a tangent and normal vector
+        
+          m_image.raster(col, row) = f(wo,wi) * dg.abs_cos_theta(wi) + e(wo);
+        } // end if
+      } // end for col
+    } // end for row
+
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    progress += t.size();
+  });
 } // end debug_renderer::render()
 
 
@@ -3,6 +3,8 @@
 #include <igloo/renderers/renderer.hpp>
 #include <igloo/primitives/scene.hpp>
 #include <igloo/records/image.hpp>
+#include <igloo/utility/work_stealing_scheduler.hpp>
+#include <cstddef>
 
 namespace igloo
 {
@@ -11,13 +13,16 @@ namespace igloo
 class debug_renderer : public renderer
 {
   public:
-    debug_renderer(const scene &s, image &im);
+    /*! \param num_threads The number of threads which render tiles of the image; 0 uses every hardware thread.
+     */
+    debug_renderer(const scene &s, image &im, std::size_t num_threads = 0);
 
     void render(const float4x4 &modelview, render_progress &progress);
 
   private:
     const scene &m_scene;
     image &m_image;
+    work_stealing_scheduler m_scheduler;
 }; // end debug_renderer
 
 
@@ -1,17 +1,27 @@
 #include <igloo/renderers/direct_lighting_renderer.hpp>
 #include <igloo/primitives/scene.hpp>
+#include <igloo/primitives/emitter_table.hpp>
 #include <igloo/surfaces/sphere.hpp>
 #include <igloo/surfaces/mesh.hpp>
 #include <igloo/scattering/perspective_sensor.hpp>
+#include <igloo/geometry/ray_packet.hpp>
+#include <igloo/renderers/tile.hpp>
+#include <dependencies/distribution2d/distribution2d/unit_interval_distribution.hpp>
 #include <array>
+#include <cstdint>
+#include <ostream>
 #include <random>
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 namespace igloo
 {
 
 
-direct_lighting_renderer::direct_lighting_renderer(const scene &s, image &im)
-  : m_scene(s), m_image(im)
+direct_lighting_renderer::direct_lighting_renderer(const scene &s, image &im, std::size_t num_threads)
+  : m_scene(s), m_image(im), m_scheduler(num_threads)
 {}
 
 
@@ -33,86 +43,168 @@ void direct_lighting_renderer::render(const float4x4 &modelview, render_progress
 
   perspective_sensor perspective(fovy_radians, 1.f);
 
-  std::mt19937_64 rng;
+  // direct lighting chooses its emitters from this table
+  const emitter_table lights(m_scene);
 
+  m_workers.assign(m_scheduler.num_workers(), worker{std::mt19937_64(), occluder_cache(m_scene.emitters().size())});
+
+  float u_spacing = 1.f / m_image.width();
   float v_spacing = 1.f / m_image.height();
-  float v = v_spacing / 2;
-  for(image::size_type row = 0; row < m_image.height(); ++row, v += v_spacing)
+
+  // each scheduled tile is traced in packets through square subtiles of neighboring pixels
+  const image::size_type subtile_size = 4;
+  static_assert(subtile_size * subtile_size <= ray_packet::max_size, "subtile must fit in a ray_packet");
+
+  std::vector<tile> tiles = tile_image(m_image, 4 * subtile_size);
+
+  // render_progress is not thread-safe, so workers report each finished tile under a lock
+  std::mutex progress_mutex;
+
+  m_scheduler.for_each(tiles.size(), [&](std::size_t worker_index, std::size_t tile_index)
   {
-    float u_spacing = 1.f / m_image.width();
-    float u = u_spacing / 2;
-    for(image::size_type col = 0; col < m_image.width(); ++col, u += u_spacing)
-    {
-      color result = black;
+    worker& w = m_workers[worker_index];
+    std::mt19937_64& rng = w.rng;
+    rng.seed(tile_index);
+
+    const tile& t = tiles[tile_index];
 
-      ray r(eye, sample_with_basis(perspective, right, up, look, u, v));
+    std::vector<differential_geometry> emitter_dgs;
+    emitter_dgs.reserve(ray_packet::max_size);
 
-      auto intersection = m_scene.intersect(r);
-      if(intersection)
+    for(image::size_type subtile_row = t.row_begin; subtile_row < t.row_end; subtile_row += subtile_size)
+    {
+      for(image::size_type subtile_col = t.col_begin; subtile_col < t.col_end; subtile_col += subtile_size)
       {
-        vector wo = -normalize(r.direction());
-  
-        const surface_primitive& surface = intersection->surface();
+        ray_packet primary_rays;
+        std::array<std::pair<image::size_type,image::size_type>, ray_packet::max_size> pixels;
 
-        // begin with emission from the hit point
-        const differential_geometry &dg = intersection->differential_geometry();
-        scattering_distribution_function e = surface.material().evaluate_emission(dg);
-        result = e(wo);
+        for(image::size_type row = subtile_row; row < std::min(subtile_row + subtile_size, t.row_end); ++row)
+        {
+          for(image::size_type col = subtile_col; col < std::min(subtile_col + subtile_size, t.col_end); ++col)
+          {
+            float u = u_spacing / 2 + col * u_spacing;
+            float v = v_spacing / 2 + row * v_spacing;
 
-        const point& x = r(intersection->ray_parameter());
+            pixels[primary_rays.size()] = std::make_pair(row, col);
+            primary_rays.push_back(ray(eye, sample_with_basis(perspective, right, up, look, u, v)));
+          }
+        }
 
-        // transform wo into dg's local coordinate system
-        wo = dg.localize(wo);
-  
-        scattering_distribution_function f = surface.material().evaluate_scattering(dg);
+        std::array<optional<hit>, ray_packet::max_size> hits;
+        m_scene.find_hits(primary_rays, hits.data());
 
-        // sum the contribution of each emitter
-        for(const auto& emitter : m_scene.emitters())
+        for(std::size_t lane = 0; lane < primary_rays.size(); ++lane)
         {
-          int num_sample_points = 128;
-          float sample_weight = 1.f / num_sample_points;
+          color result = black;
 
-          for(int i = 0; i < num_sample_points; ++i)
+          ray r = primary_rays[lane];
+
+          if(hits[lane])
           {
-            auto emitter_dg = emitter.sample_surface(rng(), rng());
+            auto intersection = m_scene.intersection_at(r, *hits[lane]);
+
+            vector wo = -normalize(r.direction());
+
+            const surface_primitive& surface = intersection.surface();
+
+            // begin with emission from the hit point
+            const differential_geometry &dg = intersection.differential_geometry();
+            scattering_distribution_function e = surface.material().evaluate_emission(dg);
+            result = e(wo);
+
+            const point& x = r(intersection.ray_parameter());
+
+            // transform wo into dg's local coordinate system
+            wo = dg.localize(wo);
 
-            // construct a ray between x and the point on the emitter
-            ray to_emitter(x, emitter_dg.point());
+            scattering_distribution_function f = surface.material().evaluate_scattering(dg);
 
-            if(!m_scene.is_intersected(to_emitter))
+            // sum samples of the emitters, each chosen in proportion to its power
+            if(!lights.empty())
             {
-              // evaluate the emitter's material
-              scattering_distribution_function e = emitter.material().evaluate_emission(emitter_dg);
+              int num_sample_points = 128;
+              float sample_weight = 1.f / num_sample_points;
 
-              // get the direction to the emitter
-              vector wi = normalize(to_emitter.direction());
+              // shadow rays from x toward the same emitter are coherent, so choose an emitter for each packet and test its rays together
+              for(int first_sample = 0; first_sample < num_sample_points; first_sample += ray_packet::max_size)
+              {
+                int num_samples = std::min<int>(ray_packet::max_size, num_sample_points - first_sample);
 
-              // get the direction from the emitter
-              vector we = -wi;
+                emitter_table::selection chosen = lights(dist2d::unit_interval_distribution<>()(rng()));
+                const surface_primitive& emitter = *chosen.emitter;
 
-              // localize wi to dg's coordinate system
-              wi = dg.localize(wi);
+                ray_packet shadow_rays;
+                emitter_dgs.clear();
 
-              // localize we to emitter_dg's coordinate system
-              we = emitter_dg.localize(we);
+                for(int i = 0; i < num_samples; ++i)
+                {
+                  emitter_dgs.push_back(emitter.sample_surface(rng(), rng()));
 
-              // compute geometric term
-              float g = emitter_dg.abs_cos_theta(we) / (distance_squared(dg, emitter_dg));
+                  // construct a ray between x and the point on the emitter
+                  shadow_rays.push_back(ray(x, emitter_dgs.back().point()));
+                }
 
-              // accumulate sample
-              result += sample_weight * f(wo,wi) * dg.abs_cos_theta(wi) * g * e(we) / emitter.pdf(emitter_dg);
+                ray_packet::mask_type occluded = m_scene.are_intersected(shadow_rays, chosen.position, w.occluders);
+
+                for(int i = 0; i < num_samples; ++i)
+                {
+                  if(occluded & (ray_packet::mask_type(1) << i)) continue;
+
+                  const differential_geometry& emitter_dg = emitter_dgs[i];
+                  ray to_emitter = shadow_rays[i];
+
+                  // evaluate the emitter's material
+                  scattering_distribution_function e = emitter.material().evaluate_emission(emitter_dg);
+
+                  // get the direction to the emitter
+                  vector wi = normalize(to_emitter.direction());
+
+                  // get the direction from the emitter
+                  vector we = -wi;
+
+                  // localize wi to dg's coordinate system
+                  wi = dg.localize(wi);
+
+                  // localize we to emitter_dg's coordinate system
+                  we = emitter_dg.localize(we);
+
+                  // compute geometric term
+                  float g = emitter_dg.abs_cos_theta(we) / (distance_squared(dg, emitter_dg));
+
+                  // the point's density is the product of the probability of choosing the emitter and the density of the point on it
+                  float pdf = chosen.probability * emitter.pdf(emitter_dg);
+
+                  // accumulate sample
+                  result += sample_weight * f(wo,wi) * dg.abs_cos_theta(wi) * g * e(we) / pdf;
+                }
+              }
             }
-          }
-        }
-      } // end if
+          } // end if
 
-      m_image.raster(col, row) = result;
+          m_image.raster(pixels[lane].second, pixels[lane].first) = result;
+        } // end for lane
+      } // end for subtile_col
+    } // end for subtile_row
 
-      progress++;
-    } // end for col
-  } // end for row
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    progress += t.size();
+  });
 } // end direct_lighting_renderer::render()
 
 
+void direct_lighting_renderer::print_statistics(std::ostream &os) const
+{
+  std::uint64_t num_hits = 0, num_lookups = 0;
+  for(const worker& w : m_workers)
+  {
+    num_hits += w.occluders.num_hits();
+    num_lookups += w.occluders.num_lookups();
+  }
+
+  os << "direct_lighting_renderer: " << m_workers.size() << " threads; " << num_hits << " of " << num_lookups
+     << " shadow rays blocked by a cached occluder (hit rate " << (num_lookups ? double(num_hits) / num_lookups : 0.0) << ")" << std::endl;
+} // end direct_lighting_renderer::print_statistics()
+
+
 } // end igloo
 
@@ -2,7 +2,13 @@
 
 #include <igloo/renderers/renderer.hpp>
 #include <igloo/primitives/scene.hpp>
+#include <igloo/primitives/occluder_cache.hpp>
 #include <igloo/records/image.hpp>
+#include <igloo/utility/aligned_allocator.hpp>
+#include <igloo/utility/work_stealing_scheduler.hpp>
+#include <cstddef>
+#include <random>
+#include <vector>
 
 namespace igloo
 {
@@ -11,13 +17,29 @@ namespace igloo
 class direct_lighting_renderer : public renderer
 {
   public:
-    direct_lighting_renderer(const scene &s, image &im);
+    /*! \param num_threads The number of threads which render tiles of the image; 0 uses every hardware thread.
+     */
+    direct_lighting_renderer(const scene &s, image &im, std::size_t num_threads = 0);
 
     void render(const float4x4 &modelview, render_progress &progress);
 
+    void print_statistics(std::ostream &os) const;
+
   private:
+    // the state private to each worker thread, on cache lines of its own
+    struct alignas(64) worker
+    {
+      // reseeded at each tile, so that the image does not depend on which worker renders which tile
+      std::mt19937_64 rng;
+
+      // the occluders of the last shadow rays toward each emitter
+      occluder_cache occluders;
+    };
+
     const scene &m_scene;
     image &m_image;
+    work_stealing_scheduler m_scheduler;
+    std::vector<worker, aligned_allocator<worker>> m_workers;
 }; // end direct_lighting_renderer
 
 
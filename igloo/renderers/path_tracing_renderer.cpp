@@ -1,33 +1,129 @@
 #include <igloo/renderers/path_tracing_renderer.hpp>
 #include <igloo/primitives/scene.hpp>
+#include <igloo/primitives/emitter_table.hpp>
 #include <igloo/surfaces/sphere.hpp>
 #include <igloo/surfaces/mesh.hpp>
 #include <igloo/scattering/perspective_sensor.hpp>
+#include <igloo/renderers/tile.hpp>
+#include <dependencies/distribution2d/distribution2d/unit_interval_distribution.hpp>
 #include <iostream>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <random>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
 
 namespace igloo
 {
 
 
-path_tracing_renderer::path_tracing_renderer(const scene &s, image &im, std::size_t max_path_length)
-  : scene_(s), image_(im), max_path_length_(max_path_length)
+path_tracing_renderer::path_tracing_renderer(const scene &s, image &im, const path_tracing_options &options)
+  : scene_(s),
+    image_(im),
+    options_(options),
+    scheduler_(options.num_threads),
+    radiance_sums_(im.width(), im.height()),
+    luminance_square_sums_(im.width(), im.height()),
+    path_counts_(im.width(), im.height()),
+    stop_requested_(false),
+    num_passes_(0)
 {
-  if(max_path_length_ < 2)
+  if(options_.max_path_length < 2)
   {
     std::clog << "path_tracing_renderer: Setting max_path_length to 3." << std::endl;
-    max_path_length_ = 3;
+    options_.max_path_length = 3;
+  }
+
+  if(options_.roulette_min_survival <= 0 || options_.roulette_min_survival > 1)
+  {
+    std::clog << "path_tracing_renderer: Setting roulette_min_survival to 0.05." << std::endl;
+    options_.roulette_min_survival = 0.05f;
+  }
+
+  if(options_.paths_per_pixel < 1)
+  {
+    std::clog << "path_tracing_renderer: Setting paths_per_pixel to 1." << std::endl;
+    options_.paths_per_pixel = 1;
+  }
+
+  if(options_.paths_per_pass < 1 || options_.paths_per_pass > options_.paths_per_pixel)
+  {
+    std::clog << "path_tracing_renderer: Setting paths_per_pass to " << options_.paths_per_pixel << "." << std::endl;
+    options_.paths_per_pass = options_.paths_per_pixel;
+  }
+
+  if(options_.relative_error > 0 && options_.max_paths_per_pixel < options_.paths_per_pixel)
+  {
+    std::clog << "path_tracing_renderer: Setting max_paths_per_pixel to " << options_.paths_per_pixel << "." << std::endl;
+    options_.max_paths_per_pixel = options_.paths_per_pixel;
   }
 }
 
 
+void path_tracing_renderer::stop()
+{
+  stop_requested_ = true;
+} // end path_tracing_renderer::stop()
+
+
+std::size_t path_tracing_renderer::num_passes() const
+{
+  return num_passes_;
+} // end path_tracing_renderer::num_passes()
+
+
+const array2<std::uint32_t> &path_tracing_renderer::path_counts() const
+{
+  return path_counts_;
+} // end path_tracing_renderer::path_counts()
+
+
+bool path_tracing_renderer::is_converged(image::size_type col, image::size_type row) const
+{
+  float n = path_counts_.raster(col, row);
+  if(n < std::max<std::size_t>(options_.min_paths_per_pixel, 2)) return false;
+
+  float mean = luminance(radiance_sums_.raster(col, row)) / n;
+
+  // the unbiased estimate of the variance of the paths' luminance
+  float variance = std::max(0.f, (luminance_square_sums_.raster(col, row) / n - mean * mean) * n / (n - 1));
+
+  float standard_error = std::sqrt(variance / n);
+
+  return standard_error <= options_.relative_error * mean;
+} // end path_tracing_renderer::is_converged()
+
+
 void path_tracing_renderer::render(const float4x4 &modelview, render_progress &progress)
 {
-  progress.reset(image_.width() * image_.height());
+  auto start = std::chrono::steady_clock::now();
+
+  bool is_adaptive = options_.relative_error > 0;
+
+  // the number of paths the render may trace, which adaptive sampling spends unevenly among the pixels
+  std::size_t budget = image_.width() * image_.height() * options_.paths_per_pixel;
+  std::size_t max_paths_per_pixel = is_adaptive ? options_.max_paths_per_pixel : options_.paths_per_pixel;
+
+  progress.reset(budget);
 
   image_.fill(black);
 
+  radiance_sums_ = array2<color>(image_.width(), image_.height());
+  radiance_sums_.fill(black);
+
+  luminance_square_sums_ = array2<float>(image_.width(), image_.height());
+  luminance_square_sums_.fill(0.f);
+
+  path_counts_ = array2<std::uint32_t>(image_.width(), image_.height());
+  path_counts_.fill(0);
+
+  stop_requested_ = false;
+  num_passes_ = 0;
+
   const point eye(0,0,3);
   const point center(0,0,-1);
   const vector up(0,1,0);
@@ -40,126 +136,317 @@ void path_tracing_renderer::render(const float4x4 &modelview, render_progress &p
 
   const perspective_sensor perspective(fovy_radians, 1.f);
 
-  std::mt19937_64 rng;
+  // next event estimation chooses one emitter per bounce from this table
+  const emitter_table lights(scene_);
 
+  workers_.clear();
+  workers_.resize(scheduler_.num_workers());
+  for(worker& w : workers_)
+  {
+    w.occluders = occluder_cache(scene_.emitters().size());
+  }
+
+  float u_spacing = 1.f / image_.width();
   float v_spacing = 1.f / image_.height();
-  float v = v_spacing / 2;
-  for(image::size_type row = 0; row < image_.height(); ++row, v += v_spacing)
+
+  std::vector<tile> tiles = tile_image(image_, 16);
+
+  // render_progress is not thread-safe, so workers report each finished tile under a lock
+  std::mutex progress_mutex;
+
+  // the number of paths traced by the completed passes
+  std::size_t num_traced_paths = 0;
+
+  for(std::size_t pass = 0; num_traced_paths < budget && !stop_requested_; ++pass)
   {
-    float u_spacing = 1.f / image_.width();
-    float u = u_spacing / 2;
-    for(image::size_type col = 0; col < image_.width(); ++col, u += u_spacing)
+    // the number of paths this pass traces, which adaptive sampling reduces as pixels converge
+    std::atomic<std::size_t> num_pass_paths(0);
+
+    // each tile of each pass draws from its own stream of random numbers
+    scheduler_.for_each(tiles.size(), [&](std::size_t worker_index, std::size_t tile_index)
     {
-      color result = black;
+      worker& w = workers_[worker_index];
+      std::mt19937_64& rng = w.rng;
+      rng.seed(pass * tiles.size() + tile_index);
+
+      const tile& t = tiles[tile_index];
+
+      // trace every path through a tile together, so that each bounce intersects a large batch of rays with the scene
+      std::vector<path>& paths = w.paths;
+      paths.clear();
+
+      std::vector<std::uint32_t>& tile_paths = w.tile_paths;
+      tile_paths.assign(t.size(), 0);
+
+      std::size_t num_tile_paths = 0;
+
+      for(image::size_type row = t.row_begin; row < t.row_end; ++row)
+      {
+        for(image::size_type col = t.col_begin; col < t.col_end; ++col)
+        {
+          float u = u_spacing / 2 + col * u_spacing;
+          float v = v_spacing / 2 + row * v_spacing;
+
+          std::size_t pixel = (row - t.row_begin) * t.width() + (col - t.col_begin);
+
+          std::size_t num_paths = path_counts_.raster(col, row);
+          if(num_paths >= max_paths_per_pixel) continue;
+
+          // adaptive sampling skips converged pixels
+          if(is_adaptive && is_converged(col, row)) continue;
+
+          std::size_t paths_per_pixel = std::min(options_.paths_per_pass, max_paths_per_pixel - num_paths);
+
+          tile_paths[pixel] = paths_per_pixel;
+          num_tile_paths += paths_per_pixel;
+
+          for(size_t i = 0; i < paths_per_pixel; ++i)
+          {
+            // the first bounce is considered to be sampled from a delta distribution
+            paths.push_back(path{pixel, black, white, ray(eye, sample_with_basis(perspective, right, up, look, u, v)), true});
+          }
+        }
+      }
 
-      size_t paths_per_pixel = 20;
-      float sample_weight = 1.f / paths_per_pixel;
+      std::vector<color>& tile_radiance = w.tile_radiance;
+      tile_radiance.assign(t.size(), black);
 
-      for(int path = 0; path < paths_per_pixel; ++path)
+      std::vector<float>& tile_luminance_squares = w.tile_luminance_squares;
+      tile_luminance_squares.assign(t.size(), 0.f);
+
+      // accumulates the radiance of a finished path
+      auto finish = [&](const path& p)
       {
-        color radiance = black;
-        color throughput = white;
+        float y = luminance(p.radiance);
 
-        point origin = eye;
-        vector direction = sample_with_basis(perspective, right, up, look, u, v);
+        tile_radiance[p.pixel] += p.radiance;
+        tile_luminance_squares[p.pixel] += y * y;
+      };
 
-        // the first bounce is considered to be sampled from a delta distribution
-        bool is_delta_sample = true;
-        for(int bounce = 2; bounce < max_path_length_; ++bounce)
+      for(size_t bounce = 2; bounce < options_.max_path_length && !paths.empty(); ++bounce)
+      {
+        w.rays.clear();
+        for(const path& p : paths)
         {
-          ray r(origin, direction);
+          w.rays.push_back(p.r);
+        }
+
+        w.hits.resize(w.rays.size());
+        scene_.find_hits(w.rays, w.hits);
+
+        w.shadow_samples.clear();
+        w.shadow_rays.clear();
+        w.shadow_emitters.clear();
 
-          auto intersection = scene_.intersect(r);
+        // paths which escape the scene are finished; compact the rest to the front of paths
+        std::size_t num_live_paths = 0;
+        for(std::size_t i = 0; i < paths.size(); ++i)
+        {
+          path& p = paths[i];
 
-          if(intersection)
+          if(!w.hits[i])
           {
-            vector wo = -r.direction();
-  
-            const surface_primitive& surface = intersection->surface();
+            finish(p);
+            continue;
+          }
+
+          auto intersection = scene_.intersection_at(p.r, *w.hits[i]);
+
+          vector wo = -p.r.direction();
 
-            // begin with emission from the hit point
-            const differential_geometry &dg = intersection->differential_geometry();
+          const surface_primitive& surface = intersection.surface();
 
-            // sum exitant radiance at the intersection point only on bounces from delta distributions
-            if(is_delta_sample)
+          // begin with emission from the hit point
+          const differential_geometry &dg = intersection.differential_geometry();
+
+          // sum exitant radiance at the intersection point only on bounces from delta distributions
+          if(p.is_delta_sample)
+          {
+            scattering_distribution_function e = surface.material().evaluate_emission(dg);
+            p.radiance += p.throughput * e(wo);
+          }
+
+          // beyond roulette_path_length, continue the path with a probability given by its throughput, and divide the
+          // survivors' throughput by that probability, so that their later contributions make up for the terminated paths'
+          if(bounce >= options_.roulette_path_length)
+          {
+            float survival = std::max(p.throughput[0], std::max(p.throughput[1], p.throughput[2]));
+            survival = std::min(1.f, std::max(options_.roulette_min_survival, survival));
+
+            if(dist2d::unit_interval_distribution<>()(rng()) >= survival)
             {
-              scattering_distribution_function e = surface.material().evaluate_emission(dg);
-              radiance += throughput * e(wo);
+              finish(p);
+              continue;
             }
 
-            const point& x = r(intersection->ray_parameter());
+            p.throughput /= survival;
+          }
 
-            // transform wo into dg's local coordinate system
-            wo = dg.localize(wo);
-  
-            scattering_distribution_function f = surface.material().evaluate_scattering(dg);
+          const point& x = p.r(intersection.ray_parameter());
 
-            // sum the contribution of each emitter
-            for(const auto& emitter : scene_.emitters())
-            {
-              auto emitter_dg = emitter.sample_surface(rng(), rng());
+          // transform wo into dg's local coordinate system
+          wo = dg.localize(wo);
 
-              // construct a ray between x and the point on the emitter
-              ray to_emitter(x, emitter_dg.point());
+          scattering_distribution_function f = surface.material().evaluate_scattering(dg);
 
-              if(!scene_.is_intersected(to_emitter))
-              {
-                // evaluate the emitter's material
-                scattering_distribution_function e = emitter.material().evaluate_emission(emitter_dg);
+          // sample the contribution of a single emitter, chosen in proportion to its power, deferring the shadow ray to a batch
+          if(!lights.empty())
+          {
+            emitter_table::selection chosen = lights(dist2d::unit_interval_distribution<>()(rng()));
+            const surface_primitive& emitter = *chosen.emitter;
 
-                // get the direction to the emitter
-                vector wi = normalize(to_emitter.direction());
+            auto emitter_dg = emitter.sample_surface(rng(), rng());
 
-                // get the direction from the emitter
-                vector we = -wi;
+            // construct a ray between x and the point on the emitter
+            ray to_emitter(x, emitter_dg.point());
 
-                // localize wi to dg's coordinate system
-                wi = dg.localize(wi);
+            // evaluate the emitter's material
+            scattering_distribution_function e = emitter.material().evaluate_emission(emitter_dg);
 
-                // localize we to emitter_dg's coordinate system
-                we = emitter_dg.localize(we);
+            // get the direction to the emitter
+            vector wi = normalize(to_emitter.direction());
 
-                // compute geometric term
-                float g = emitter_dg.abs_cos_theta(we) / (distance_squared(dg, emitter_dg));
+            // get the direction from the emitter
+            vector we = -wi;
 
-                // accumulate sample
-                radiance += throughput * f(wo,wi) * dg.abs_cos_theta(wi) * g * e(we) / emitter.pdf(emitter_dg);
-              } // end if not shadowed
-            } // end for emitter
+            // localize wi to dg's coordinate system
+            wi = dg.localize(wi);
 
-            // sample next direction
-            auto sample = f.sample_direction(rng(), rng(), wo);
+            // localize we to emitter_dg's coordinate system
+            we = emitter_dg.localize(we);
 
-            // update throughput
-            throughput *= sample.throughput();
-            throughput /= sample.probability_density();
-            if(!sample.is_delta_sample())
-            {
-              throughput *= dg.abs_cos_theta(sample.wi());
-            }
+            // compute geometric term
+            float g = emitter_dg.abs_cos_theta(we) / (distance_squared(dg, emitter_dg));
+
+            // the point's density is the product of the probability of choosing the emitter and the density of the point on it
+            float pdf = chosen.probability * emitter.pdf(emitter_dg);
+
+            w.shadow_samples.push_back(shadow_sample{num_live_paths, p.throughput * f(wo,wi) * dg.abs_cos_theta(wi) * g * e(we) / pdf});
+            w.shadow_rays.push_back(to_emitter);
+            w.shadow_emitters.push_back(static_cast<std::uint32_t>(chosen.position));
+          }
+
+          // sample next direction
+          auto sample = f.sample_direction(rng(), rng(), wo);
+
+          // update throughput
+          p.throughput *= sample.throughput();
+          p.throughput /= sample.probability_density();
+          if(!sample.is_delta_sample())
+          {
+            p.throughput *= dg.abs_cos_theta(sample.wi());
+          }
+
+          // update ray
+          p.r = ray(dg.point(), dg.globalize(sample.wi()));
+          p.is_delta_sample = sample.is_delta_sample();
+
+          paths[num_live_paths++] = p;
+        } // end for path
+
+        // accumulate the samples of unshadowed emitters
+        if(w.occluded_size < w.shadow_rays.size())
+        {
+          w.occluded.reset(new bool[w.shadow_rays.size()]);
+          w.occluded_size = w.shadow_rays.size();
+        }
+
+        scene_.are_intersected(w.shadow_rays, w.shadow_emitters, w.occluders, array_ref<bool>(w.occluded.get(), w.shadow_rays.size()));
 
-            // update ray
-            origin = dg.point();
-            direction = dg.globalize(sample.wi());
-            is_delta_sample = sample.is_delta_sample();
-          } // end if intersection
-          else
+        for(std::size_t i = 0; i < w.shadow_samples.size(); ++i)
+        {
+          if(!w.occluded[i])
           {
-            break;
+            paths[w.shadow_samples[i].path].radiance += w.shadow_samples[i].contribution;
           }
-        } // end for bounce
+        }
+
+        paths.erase(paths.begin() + num_live_paths, paths.end());
+      } // end for bounce
 
-        result += sample_weight * radiance;
-      } // end for paths
+      // paths which reach the maximum length are finished
+      for(const path& p : paths)
+      {
+        finish(p);
+      }
+
+      // add this pass's paths to the accumulation buffer and update the image to the running mean
+      for(image::size_type row = t.row_begin; row < t.row_end; ++row)
+      {
+        for(image::size_type col = t.col_begin; col < t.col_end; ++col)
+        {
+          std::size_t pixel = (row - t.row_begin) * t.width() + (col - t.col_begin);
+          if(!tile_paths[pixel]) continue;
 
-      image_.raster(col, row) = result;
+          radiance_sums_.raster(col, row) += tile_radiance[pixel];
+          luminance_square_sums_.raster(col, row) += tile_luminance_squares[pixel];
+          path_counts_.raster(col, row) += tile_paths[pixel];
+
+          image_.raster(col, row) = radiance_sums_.raster(col, row) / float(path_counts_.raster(col, row));
+        }
+      }
+
+      num_pass_paths += num_tile_paths;
+
+      // the last pass of an adaptive render may overrun the budget
+      std::lock_guard<std::mutex> lock(progress_mutex);
+      progress += std::min(num_tile_paths, progress.expected_count() - progress.count());
+    });
+
+    // once every pixel has converged or reached max_paths_per_pixel, further passes would trace nothing
+    if(num_pass_paths == 0) break;
+
+    num_traced_paths += num_pass_paths;
+    ++num_passes_;
+
+    if(options_.time_limit > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= options_.time_limit)
+    {
+      break;
+    }
+  } // end for pass
 
-      progress++;
-    } // end for col
-  } // end for row
+  // budget which was left unspent won't report progress, so complete it
+  std::lock_guard<std::mutex> lock(progress_mutex);
+  progress += progress.expected_count() - progress.count();
 }
 
 
+void path_tracing_renderer::print_statistics(std::ostream &os) const
+{
+  std::uint64_t num_hits = 0, num_lookups = 0;
+  for(const worker& w : workers_)
+  {
+    num_hits += w.occluders.num_hits();
+    num_lookups += w.occluders.num_lookups();
+  }
+
+  os << "path_tracing_renderer: " << num_passes_ << " passes over " << workers_.size() << " threads; " << num_hits << " of " << num_lookups
+     << " shadow rays blocked by a cached occluder (hit rate " << (num_lookups ? double(num_hits) / num_lookups : 0.0) << ")" << std::endl;
+
+  if(options_.relative_error > 0)
+  {
+    std::uint64_t num_paths = 0;
+    std::uint32_t max_paths = 0;
+    std::size_t num_converged = 0;
+
+    for(image::size_type row = 0; row < path_counts_.height(); ++row)
+    {
+      for(image::size_type col = 0; col < path_counts_.width(); ++col)
+      {
+        num_paths += path_counts_.raster(col, row);
+        max_paths = std::max(max_paths, path_counts_.raster(col, row));
+        num_converged += is_converged(col, row);
+      }
+    }
+
+    std::size_t num_pixels = path_counts_.width() * path_counts_.height();
+
+    os << "path_tracing_renderer: " << num_converged << " of " << num_pixels << " pixels within relative error "
+       << options_.relative_error << "; " << (num_pixels ? double(num_paths) / num_pixels : 0.0) << " paths per pixel on average, "
+       << max_paths << " at most" << std::endl;
+  }
+}
+
 } // end igloo
 
 
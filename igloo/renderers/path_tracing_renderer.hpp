@@ -2,23 +2,158 @@
 
 #include <igloo/renderers/renderer.hpp>
 #include <igloo/primitives/scene.hpp>
+#include <igloo/primitives/occluder_cache.hpp>
 #include <igloo/records/image.hpp>
+#include <igloo/utility/aligned_allocator.hpp>
+#include <igloo/utility/array2.hpp>
+#include <igloo/utility/work_stealing_scheduler.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
 
 namespace igloo
 {
 
 
+/*! Parameters controlling a path_tracing_renderer.
+ */
+struct path_tracing_options
+{
+  // the maximum number of vertices of a path, including the eye
+  std::size_t max_path_length = 10;
+
+  // paths which reach this many vertices continue with a probability proportional to their throughput,
+  // and the survivors' throughput is divided by that probability, which keeps the estimate unbiased
+  // this is Russian roulette, which ends most paths which would contribute little long before max_path_length
+  std::size_t roulette_path_length = 5;
+
+  // the least probability with which a path continues under Russian roulette
+  float roulette_min_survival = 0.05f;
+
+  // the number of paths traced through each pixel
+  // with adaptive sampling, the mean number of paths per pixel, which passes spend unevenly among the pixels
+  std::size_t paths_per_pixel = 20;
+
+  // the number of paths traced through each pixel by each pass over the image
+  // after each pass, the image holds the mean of every path traced so far
+  std::size_t paths_per_pass = 4;
+
+  // when positive, sampling is adaptive: each pass traces paths only through pixels whose estimated relative error
+  // exceeds this target, so that the paths which converged pixels would have taken go to the noisy ones
+  // passes continue until paths_per_pixel paths per pixel have been traced over the whole image, or until every pixel
+  // has converged or reached max_paths_per_pixel
+  // a pixel's relative error is the standard error of the mean luminance of its paths, divided by that mean
+  float relative_error = 0;
+
+  // the number of paths traced through a pixel before its relative error is estimated
+  std::size_t min_paths_per_pixel = 8;
+
+  // with adaptive sampling, the greatest number of paths traced through any one pixel
+  std::size_t max_paths_per_pixel = 256;
+
+  // the number of seconds after which no further pass begins; 0 imposes no limit
+  double time_limit = 0;
+
+  // the number of threads which render tiles of the image; 0 uses every hardware thread
+  std::size_t num_threads = 0;
+};
+
+
+/*! A path_tracing_renderer renders an image progressively, in passes which each trace a few paths through every pixel.
+ *  Each pass adds its paths' radiance to an accumulation buffer and its paths to a per-pixel count,
+ *  and the image is updated to their running mean, so that a useful preview is ready after the first pass
+ *  and rendering may stop after any pass.
+ *  When path_tracing_options::relative_error is positive, sampling is adaptive: passes skip pixels whose estimated
+ *  error has fallen below the target, and continue over the rest until the image's budget of paths is spent.
+ */
 class path_tracing_renderer : public renderer
 {
   public:
-    path_tracing_renderer(const scene &s, image &im, std::size_t max_path_length = 10);
+    path_tracing_renderer(const scene &s, image &im, const path_tracing_options &options = path_tracing_options());
 
     void render(const float4x4 &modelview, render_progress &progress);
 
+    /*! Asks a render() in progress on another thread to stop once its current pass completes.
+     *  The image then holds the mean of the paths traced by the completed passes.
+     */
+    void stop();
+
+    /*! \return The number of passes completed by the last call to render().
+     */
+    std::size_t num_passes() const;
+
+    /*! \return The number of paths traced through each pixel by the last call to render(),
+     *          which shows where adaptive sampling spent its paths.
+     */
+    const array2<std::uint32_t> &path_counts() const;
+
+    void print_statistics(std::ostream &os) const;
+
   private:
+    // the state of a path between bounces
+    struct path
+    {
+      // the index of the path's pixel within its tile
+      std::size_t pixel;
+      color radiance;
+      color throughput;
+      ray r;
+      bool is_delta_sample;
+    };
+
+    // a shadow ray's contribution to its path's radiance if it is unoccluded
+    struct shadow_sample
+    {
+      std::size_t path;
+      color contribution;
+    };
+
+    // the state private to each worker thread, on cache lines of its own
+    struct alignas(64) worker
+    {
+      // reseeded at each tile, so that the image does not depend on which worker renders which tile
+      std::mt19937_64 rng;
+
+      // the occluders of the last shadow rays toward each emitter
+      occluder_cache occluders;
+
+      // the paths through a tile and their rays, hits and shadow rays at the current bounce
+      std::vector<path> paths;
+      std::vector<ray> rays;
+      std::vector<optional<hit>> hits;
+      std::vector<shadow_sample> shadow_samples;
+      std::vector<ray> shadow_rays;
+      std::vector<std::uint32_t> shadow_emitters;
+      std::unique_ptr<bool[]> occluded;
+      std::size_t occluded_size = 0;
+
+      // the number of paths the current pass traces through each pixel of a tile,
+      // and the sums of their radiance and of the squares of their luminance
+      std::vector<std::uint32_t> tile_paths;
+      std::vector<color> tile_radiance;
+      std::vector<float> tile_luminance_squares;
+    };
+
     const scene &scene_;
     image &image_;
-    size_t max_path_length_;
+    path_tracing_options options_;
+    work_stealing_scheduler scheduler_;
+    std::vector<worker, aligned_allocator<worker>> workers_;
+
+    // returns whether the estimated relative error of the pixel at (col,row) is within options_.relative_error
+    bool is_converged(image::size_type col, image::size_type row) const;
+
+    // the sum of the radiance of the paths traced through each pixel, the sum of the squares of their luminance,
+    // and their number
+    array2<color> radiance_sums_;
+    array2<float> luminance_square_sums_;
+    array2<std::uint32_t> path_counts_;
+
+    std::atomic<bool> stop_requested_;
+    std::size_t num_passes_;
 };
 
 
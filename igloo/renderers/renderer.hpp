@@ -2,6 +2,7 @@
 
 #include <igloo/utility/matrix.hpp>
 #include <igloo/renderers/render_progress.hpp>
+#include <iosfwd>
 
 namespace igloo
 {
@@ -10,7 +11,15 @@ namespace igloo
 class renderer
 {
   public:
+    inline virtual ~renderer() {}
+
     virtual void render(const float4x4 &modelview, render_progress &progress) = 0;
+
+    /*! Writes statistics gathered by the last call to render(), such as the hit rates of its caches.
+     *  \param os The stream to write to.
+     *  \note The default implementation writes nothing.
+     */
+    inline virtual void print_statistics(std::ostream &) const {}
 }; // end renderer
 
 } // end igloo
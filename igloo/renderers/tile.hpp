@@ -0,0 +1,64 @@
+#pragma once
+
+#include <igloo/records/image.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace igloo
+{
+
+
+/*! A tile is a rectangle of pixels of an image, which renderers schedule as a unit of work.
+ */
+struct tile
+{
+  image::size_type row_begin, row_end;
+  image::size_type col_begin, col_end;
+
+  /*! \return The number of columns of this tile.
+   */
+  inline image::size_type width() const
+  {
+    return col_end - col_begin;
+  } // end width()
+
+  /*! \return The number of rows of this tile.
+   */
+  inline image::size_type height() const
+  {
+    return row_end - row_begin;
+  } // end height()
+
+  /*! \return The number of pixels of this tile.
+   */
+  inline std::size_t size() const
+  {
+    return width() * height();
+  } // end size()
+}; // end tile
+
+
+/*! Splits an image into square tiles, in row-major order. Tiles along the right and bottom edges may be smaller.
+ *  \param im The image of interest.
+ *  \param tile_size The width and height of each tile.
+ *  \return The tiles of im.
+ */
+inline std::vector<tile> tile_image(const image &im, image::size_type tile_size)
+{
+  std::vector<tile> result;
+
+  for(image::size_type row = 0; row < im.height(); row += tile_size)
+  {
+    for(image::size_type col = 0; col < im.width(); col += tile_size)
+    {
+      result.push_back(tile{row, std::min(row + tile_size, im.height()), col, std::min(col + tile_size, im.width())});
+    }
+  }
+
+  return result;
+} // end tile_image()
+
+
+} // end igloo
+
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <igloo/utility/math_vector.hpp>
+#include <cstdint>
+
+namespace igloo
+{
+
+
+/*! A hit is a compact record of the intersection between a ray and a surface.
+ *  Traversal produces hits cheaply; the surface's differential_geometry at the
+ *  hit is only computed on demand via surface::differential_geometry_at().
+ */
+struct hit
+{
+  // the index of the hit surface_primitive within its scene
+  std::uint32_t primitive;
+
+  // the index of the hit element (e.g. a triangle) within its surface
+  std::uint32_t element;
+
+  // the ray parameter at the hit
+  float ray_parameter;
+
+  // the hit's coordinates within its element (e.g. barycentric coordinates within a triangle)
+  float2 barycentric;
+};
+
+
+} // end igloo
+
@@ -0,0 +1,167 @@
+#include <igloo/surfaces/instance.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+namespace igloo
+{
+
+
+static bounding_box transform_bounds(const transform &xfrm, const bounding_box &box)
+{
+  bounding_box result;
+
+  if(box.empty()) return result;
+
+  // bound the transformed corners of box
+  for(int corner = 0; corner < 8; ++corner)
+  {
+    point p((corner & 1) ? box.max().x : box.min().x,
+            (corner & 2) ? box.max().y : box.min().y,
+            (corner & 4) ? box.max().z : box.min().z);
+
+    result += xfrm(p);
+  }
+
+  return result;
+} // end transform_bounds()
+
+
+// returns the factor by which xfrm scales areas, assuming it scales uniformly
+static float area_scale(const transform &xfrm)
+{
+  const float *m = xfrm.data();
+
+  float determinant = m[0] * (m[5] * m[10] - m[6] * m[9])
+                    - m[1] * (m[4] * m[10] - m[6] * m[8])
+                    + m[2] * (m[4] * m[9]  - m[5] * m[8]);
+
+  return std::pow(std::abs(determinant), 2.f / 3.f);
+} // end area_scale()
+
+
+// transforms n by xfrm and renormalizes it, since xfrm may scale
+static normal transform_normal(const transform &xfrm, const normal &n)
+{
+  normal result = xfrm(n);
+  return normalize(vector(result.x, result.y, result.z));
+} // end transform_normal()
+
+
+instance::instance(std::shared_ptr<const surface> prototype, const igloo::transform &object_to_world)
+  : m_prototype(prototype),
+    m_object_to_world(object_to_world),
+    m_bounds(transform_bounds(object_to_world, prototype->bounds())),
+    m_area(area_scale(object_to_world) * prototype->area())
+{} // end instance::instance()
+
+
+ray instance::to_object(const ray &r) const
+{
+  return ray(m_object_to_world.inverse_transform(r.origin()),
+             m_object_to_world.inverse_transform(r.direction()),
+             r.end());
+} // end instance::to_object()
+
+
+differential_geometry instance::to_world(const differential_geometry &dg) const
+{
+  vector s = m_object_to_world(dg.s());
+  vector t = m_object_to_world(dg.t());
+  normal n = transform_normal(m_object_to_world, dg.normal());
+
+  return differential_geometry(m_object_to_world(dg.point()), dg.parametric_coordinates(), s, t, n);
+} // end instance::to_world()
+
+
+triangle_mesh instance::triangulate() const
+{
+  triangle_mesh result = m_prototype->triangulate();
+
+  std::vector<point> points(result.points_begin(), result.points_end());
+  std::transform(points.begin(), points.end(), points.begin(), [&](const point &p)
+  {
+    return m_object_to_world(p);
+  });
+
+  if(result.has_normals())
+  {
+    std::vector<normal> normals(result.normals_begin(), result.normals_end());
+    std::transform(normals.begin(), normals.end(), normals.begin(), [&](const normal &n)
+    {
+      return transform_normal(m_object_to_world, n);
+    });
+
+    result.update_points(points, normals);
+  }
+  else
+  {
+    result.update_points(points);
+  }
+
+  return result;
+} // end instance::triangulate()
+
+
+optional<intersection> instance::intersect(const ray &r) const
+{
+  auto h = find_hit(r);
+  if(h)
+  {
+    return intersection(h->ray_parameter, differential_geometry_at(r, *h));
+  } // end if
+
+  return nullopt;
+} // end instance::intersect()
+
+
+optional<hit> instance::find_hit(const ray &r) const
+{
+  return m_prototype->find_hit(to_object(r));
+} // end instance::find_hit()
+
+
+differential_geometry instance::differential_geometry_at(const ray &r, const hit &h) const
+{
+  return to_world(m_prototype->differential_geometry_at(to_object(r), h));
+} // end instance::differential_geometry_at()
+
+
+bool instance::is_intersected(const ray &r) const
+{
+  return m_prototype->is_intersected(to_object(r));
+} // end instance::is_intersected()
+
+
+optional<std::uint32_t> instance::find_occluder(const ray &r) const
+{
+  return m_prototype->find_occluder(to_object(r));
+} // end instance::find_occluder()
+
+
+bool instance::is_element_intersected(const ray &r, std::uint32_t element) const
+{
+  return m_prototype->is_element_intersected(to_object(r), element);
+} // end instance::is_element_intersected()
+
+
+bounding_box instance::bounds() const
+{
+  return m_bounds;
+} // end instance::bounds()
+
+
+float instance::area() const
+{
+  return m_area;
+} // end instance::area()
+
+
+differential_geometry instance::sample_surface(std::uint64_t u0, std::uint64_t u1) const
+{
+  return to_world(m_prototype->sample_surface(u0, u1));
+} // end instance::sample_surface()
+
+
+} // end igloo
+
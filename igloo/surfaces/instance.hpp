@@ -0,0 +1,114 @@
+#pragma once
+
+#include <igloo/surfaces/surface.hpp>
+#include <igloo/geometry/transform.hpp>
+#include <igloo/geometry/bounding_box.hpp>
+#include <igloo/utility/optional.hpp>
+#include <memory>
+
+namespace igloo
+{
+
+
+/*! An instance is a surface which places a shared prototype surface, e.g. a mesh, into the world through a transform.
+ *  Many instances may share a single prototype, and with it the prototype's triangle_mesh and hierarchy.
+ *  Rays are transformed into the prototype's object space during intersection.
+ */
+class instance : public surface
+{
+  public:
+    /*! Creates a new instance.
+     *  \param prototype The surface to instance, in object space.
+     *  \param object_to_world The transform from the prototype's object space to world space.
+     */
+    instance(std::shared_ptr<const surface> prototype, const igloo::transform &object_to_world);
+
+    /*! \return The instanced surface.
+     */
+    inline const surface &prototype() const
+    {
+      return *m_prototype;
+    } // end prototype()
+
+    /*! \return The shared pointer to the instanced surface, e.g. to create another instance of it.
+     */
+    inline const std::shared_ptr<const surface> &shared_prototype() const
+    {
+      return m_prototype;
+    } // end shared_prototype()
+
+    /*! \return The transform from the prototype's object space to world space.
+     */
+    inline const igloo::transform &transform() const
+    {
+      return m_object_to_world;
+    } // end transform()
+
+    /*! \return A triangle_mesh approximating this instance, in world space.
+     */
+    virtual triangle_mesh triangulate() const;
+
+    /*! Tests for intersection between a ray and this instance.
+     *  \param r The ray of interest.
+     *  \param nullopt if no intersection exists, otherwise the details of the intersection.
+     */
+    virtual optional<intersection> intersect(const ray &r) const;
+
+    /*! Tests for intersection between a ray and this instance and returns a compact record of the nearest intersection.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists, otherwise the prototype's hit.
+     */
+    virtual optional<hit> find_hit(const ray &r) const;
+
+    /*! \return The differential_geometry of this instance, in world space, at a hit returned by find_hit(r).
+     */
+    virtual differential_geometry differential_geometry_at(const ray &r, const hit &h) const;
+
+    /*! Tests whether a ray intersects this instance without computing the details of the intersection.
+     *  \param r The ray of interest.
+     *  \return true if an intersection exists; false, otherwise.
+     */
+    virtual bool is_intersected(const ray &r) const;
+
+    /*! Finds an element of this instance's prototype which a ray intersects, which need not be the nearest.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists; otherwise, the prototype's element.
+     */
+    virtual optional<std::uint32_t> find_occluder(const ray &r) const;
+
+    /*! Tests whether a ray intersects a single element of this instance's prototype.
+     *  \param r The ray of interest.
+     *  \param element The prototype's element of interest.
+     *  \return true if r intersects element; false, otherwise.
+     */
+    virtual bool is_element_intersected(const ray &r, std::uint32_t element) const;
+
+    /*! \return A bounding_box bounding this instance, in world space.
+     */
+    virtual bounding_box bounds() const;
+
+    /*! \return The surface area of this instance.
+     *  \note This is exact when the transform scales uniformly, and approximate otherwise.
+     */
+    virtual float area() const;
+
+    /*! \return The differential_geometry of the instance at coordinates (u0,u1).
+     */
+    virtual differential_geometry sample_surface(std::uint64_t u0, std::uint64_t u1) const;
+
+  private:
+    // returns r transformed into the prototype's object space
+    // the transformed direction is not normalized, so ray parameters are the same in both spaces
+    ray to_object(const ray &r) const;
+
+    differential_geometry to_world(const differential_geometry &dg) const;
+
+    std::shared_ptr<const surface> m_prototype;
+    igloo::transform m_object_to_world;
+    bounding_box m_bounds;
+    float m_area;
+}; // end instance
+
+
+} // end igloo
+
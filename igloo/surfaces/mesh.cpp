@@ -2,13 +2,15 @@
 #include <dependencies/distribution2d/distribution2d/unit_interval_distribution.hpp>
 #include <dependencies/distribution2d/distribution2d/unit_isoceles_right_triangle_distribution.hpp>
 #include <algorithm>
+#include <stdexcept>
 
 namespace igloo
 {
 
 
+template<class Range>
 static std::vector<normal> face_normals(const std::vector<point> &points,
-                                        const std::vector<uint3> &triangles)
+                                        const Range &triangles)
 {
   std::vector<normal> result(triangles.size());
 
@@ -44,48 +46,142 @@ mesh::mesh(triangle_mesh&& triangle_mesh)
 
 
 mesh::mesh(const std::vector<point> &points,
-           const std::vector<uint3> &triangles)
-  : mesh(triangle_mesh(points, triangles, face_normals(points, triangles)))
+           const std::vector<uint3> &triangles,
+           const bounding_volume_hierarchy_options &options)
+  : mesh(triangle_mesh(points, triangles, face_normals(points, triangles), options))
 {}
 
 
 mesh::mesh(const std::vector<point> &points,
            const std::vector<parametric> &parametrics,
-           const std::vector<uint3> &triangles)
-  : mesh(triangle_mesh(points, parametrics, triangles, face_normals(points, triangles)))
+           const std::vector<uint3> &triangles,
+           const bounding_volume_hierarchy_options &options)
+  : mesh(triangle_mesh(points, parametrics, triangles, face_normals(points, triangles), options))
 {}
 
 
 mesh::mesh(const std::vector<point> &points,
            const std::vector<parametric> &parametrics,
            const std::vector<normal> &normals,
-           const std::vector<uint3> &triangles)
-  : mesh(triangle_mesh(points, parametrics, normals, triangles))
+           const std::vector<uint3> &triangles,
+           const bounding_volume_hierarchy_options &options)
+  : mesh(triangle_mesh(points, parametrics, normals, triangles, options))
 {}
 
 
+void mesh::update_area()
+{
+  area_weighted_probability_density_function_ = alias_table<triangle_mesh::triangle_iterator>(m_triangle_mesh.triangles(), area_of_triangle{m_triangle_mesh});
+  area_ = m_triangle_mesh.surface_area();
+} // end mesh::update_area()
+
+
+void mesh::update_points(const std::vector<point> &points)
+{
+  if(m_triangle_mesh.has_vertex_normals())
+  {
+    throw std::logic_error("mesh::update_points(): mesh has vertex normals; they must be updated with its points");
+  }
+
+  // face_normals() indexes points by the mesh's triangles, so check their count before computing them
+  if(points.size() != m_triangle_mesh.vertices_size())
+  {
+    throw std::logic_error("mesh::update_points(): points.size() != vertices_size()");
+  }
+
+  m_triangle_mesh.update_points(points, face_normals(points, m_triangle_mesh.triangles()));
+  update_area();
+} // end mesh::update_points()
+
+
+void mesh::update_points(const std::vector<point> &points,
+                         const std::vector<normal> &normals)
+{
+  m_triangle_mesh.update_points(points, normals);
+  update_area();
+} // end mesh::update_points()
+
+
 optional<intersection>
   mesh::intersect(const ray &r) const
 {
-  auto hit = m_triangle_mesh.intersect(r); 
-  if(hit)
+  auto h = find_hit(r);
+  if(h)
+  {
+    return intersection(h->ray_parameter, differential_geometry_at(r, *h));
+  } // end if
+
+  return nullopt;
+} // end mesh::intersect()
+
+
+ray_packet::mask_type mesh::find_hits(ray_packet& packet, ray_packet::mask_type mask, hit* hits) const
+{
+  std::tuple<triangle_mesh::triangle_iterator,float,triangle_mesh::barycentric> results[ray_packet::max_size];
+
+  ray_packet::mask_type result = m_triangle_mesh.intersect(packet, mask, results);
+
+  ray_packet::for_each_lane(result, [&](std::size_t lane)
   {
     triangle_mesh::triangle_iterator tri;
     float t;
     triangle_mesh::barycentric b;
-    std::tie(tri, t, b) = *hit;
+    std::tie(tri, t, b) = results[lane];
 
-    parametric uv = m_triangle_mesh.parametric_at(tri, b);
-    normal n = m_triangle_mesh.normal_at(tri, b);
+    std::uint32_t element = static_cast<std::uint32_t>(tri - m_triangle_mesh.triangles().begin());
 
-    vector dpdu, dpdv;
-    std::tie(dpdu, dpdv) = m_triangle_mesh.parametric_derivatives(tri);
+    hits[lane] = hit{0, element, t, b};
+  });
 
-    return intersection(t, differential_geometry(r(t), uv, dpdu, dpdv, n));
-  } // end if
+  return result;
+} // end mesh::find_hits()
 
-  return nullopt;
-} // end mesh::intersect()
+
+ray_packet::mask_type mesh::are_intersected(const ray_packet& packet, ray_packet::mask_type mask) const
+{
+  return m_triangle_mesh.is_intersected(packet, mask);
+} // end mesh::are_intersected()
+
+
+ray_packet::mask_type mesh::find_occluders(const ray_packet& packet, ray_packet::mask_type mask, std::uint32_t* elements) const
+{
+  return m_triangle_mesh.find_intersected(packet, mask, [&](std::size_t lane, triangle_mesh::triangle_iterator tri)
+  {
+    elements[lane] = static_cast<std::uint32_t>(tri - m_triangle_mesh.triangles().begin());
+  });
+} // end mesh::find_occluders()
+
+
+void mesh::find_hits(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<hit> hits) const
+{
+  m_triangle_mesh.intersect(stream, indices, [&](ray_stream::index_type i, triangle_mesh::triangle_iterator tri, float t, const triangle_mesh::barycentric& b)
+  {
+    std::uint32_t element = static_cast<std::uint32_t>(tri - m_triangle_mesh.triangles().begin());
+
+    hits[i] = hit{0, element, t, b};
+  });
+} // end mesh::find_hits()
+
+
+void mesh::are_intersected(ray_stream& stream, array_ref<const ray_stream::index_type> indices) const
+{
+  m_triangle_mesh.is_intersected(stream, indices);
+} // end mesh::are_intersected()
+
+
+void mesh::find_occluders(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<std::uint32_t> elements) const
+{
+  m_triangle_mesh.find_intersected(stream, indices, [&](ray_stream::index_type i, triangle_mesh::triangle_iterator tri)
+  {
+    elements[i] = static_cast<std::uint32_t>(tri - m_triangle_mesh.triangles().begin());
+  });
+} // end mesh::find_occluders()
+
+
+bounding_box mesh::bounds() const
+{
+  return m_triangle_mesh.bounding_box();
+} // end mesh::bounds()
 
 
 float mesh::area() const
@@ -7,6 +7,7 @@
 #include <igloo/geometry/triangle_mesh.hpp>
 #include <igloo/utility/optional.hpp>
 #include <igloo/utility/alias_table.hpp>
+#include <tuple>
 
 namespace igloo
 {
@@ -18,9 +19,11 @@ class mesh : public surface
     /*! Creates a new mesh from an array of points and triangles.
      *  \param points An array of points.
      *  \param triangles An array of triangles.
+     *  \param options Parameters controlling the construction of the mesh's hierarchy.
      */
     mesh(const std::vector<point> &points,
-         const std::vector<uint3> &triangles);
+         const std::vector<uint3> &triangles,
+         const bounding_volume_hierarchy_options &options = bounding_volume_hierarchy_options());
 
     /*! Creates a new mesh from an array of points, parametrics, and triangles.
      *  \param points An array of points.
@@ -28,10 +31,12 @@ class mesh : public surface
      *  \param num_vertices The size of the points and parametrics arrays.
      *  \param triangles An array of triangles.
      *  \param num_triangles The size of the triangles array.
+     *  \param options Parameters controlling the construction of the mesh's hierarchy.
      */
     mesh(const std::vector<point> &points,
          const std::vector<parametric> &parametrics,
-         const std::vector<uint3> &triangles);
+         const std::vector<uint3> &triangles,
+         const bounding_volume_hierarchy_options &options = bounding_volume_hierarchy_options());
 
     /*! Creates a new mesh from an array of points, parametrics, normals, and triangles.
      *  \param points An array of points.
@@ -40,11 +45,13 @@ class mesh : public surface
      *  \param num_vertices The size of the points and parametrics arrays.
      *  \param triangles An array of triangles.
      *  \param num_triangles The size of the triangles array.
+     *  \param options Parameters controlling the construction of the mesh's hierarchy.
      */
     mesh(const std::vector<point> &points,
          const std::vector<parametric> &parametrics,
          const std::vector<normal> &normals,
-         const std::vector<uint3> &triangles);
+         const std::vector<uint3> &triangles,
+         const bounding_volume_hierarchy_options &options = bounding_volume_hierarchy_options());
 
     /*! \return A triangle_mesh approximating this mesh.
      */
@@ -53,12 +60,174 @@ class mesh : public surface
       return m_triangle_mesh;
     } // end triangulate()
 
+    /*! \return The binary bounding_volume_hierarchy built over this mesh's triangles, which is released but for the record
+     *          of its construction when its options' width is 4 or 8; see triangle_mesh::hierarchy().
+     */
+    inline const bounding_volume_hierarchy& hierarchy() const
+    {
+      return m_triangle_mesh.hierarchy();
+    } // end hierarchy()
+
+    /*! \return The number of bytes occupied by the hierarchy traversed by intersection queries.
+     */
+    inline std::size_t traversed_hierarchy_memory_size() const
+    {
+      return m_triangle_mesh.traversed_hierarchy_memory_size();
+    } // end traversed_hierarchy_memory_size()
+
+    /*! Calls a function with the hierarchy traversed by intersection queries; see triangle_mesh::with_traversed_hierarchy().
+     *  \param f A function accepting either a bounding_volume_hierarchy or a wide_bounding_volume_hierarchy.
+     *  \return The result of f.
+     */
+    template<class Function>
+    inline auto with_traversed_hierarchy(Function f) const
+      -> decltype(std::declval<const triangle_mesh&>().with_traversed_hierarchy(f))
+    {
+      return m_triangle_mesh.with_traversed_hierarchy(f);
+    } // end with_traversed_hierarchy()
+
+    /*! Moves this mesh's points, keeping its triangles, e.g. to animate a deforming mesh.
+     *  The mesh's hierarchy is refit rather than rebuilt unless refitting degrades it too far,
+     *  and its face normals and area distribution are recomputed.
+     *  A mesh of a scene is moved with scene::update_points() instead, so that the scene refreshes its bounds.
+     *  \param points An array of points, the same size as the array the mesh was created with.
+     *  \throws std::logic_error if the mesh was created with vertex normals; use the overload accepting normals instead.
+     */
+    void update_points(const std::vector<point> &points);
+
+    /*! Moves this mesh's points and replaces its vertex normals, keeping its triangles.
+     *  \param points An array of points, the same size as the array the mesh was created with.
+     *  \param normals An array of normals, the same size as the array the mesh was created with.
+     */
+    void update_points(const std::vector<point> &points,
+                       const std::vector<normal> &normals);
+
     /*! Tests for intersection between a ray and this mesh.
      *  \param r The ray of interest.
      *  \param nullopt if no intersection exists, otherwise the details of the intersection.
      */
     virtual optional<intersection> intersect(const ray &r) const;
 
+    /*! Tests for intersection between a ray and this mesh and returns a compact record of the nearest intersection.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists, otherwise a hit identifying the hit triangle and its barycentric coordinates.
+     */
+    inline virtual optional<hit> find_hit(const ray &r) const
+    {
+      auto result = m_triangle_mesh.intersect(r);
+      if(result)
+      {
+        triangle_mesh::triangle_iterator tri;
+        float t;
+        triangle_mesh::barycentric b;
+        std::tie(tri, t, b) = *result;
+
+        std::uint32_t element = static_cast<std::uint32_t>(tri - m_triangle_mesh.triangles().begin());
+
+        return hit{0, element, t, b};
+      } // end if
+
+      return nullopt;
+    } // end find_hit()
+
+    /*! \return The differential_geometry of this mesh at a hit returned by find_hit(r).
+     */
+    inline virtual differential_geometry differential_geometry_at(const ray &r, const hit &h) const
+    {
+      triangle_mesh::triangle_iterator tri = m_triangle_mesh.triangles().begin() + h.element;
+
+      parametric uv = m_triangle_mesh.parametric_at(tri, h.barycentric);
+      normal n = m_triangle_mesh.normal_at(tri, h.barycentric);
+
+      vector dpdu, dpdv;
+      std::tie(dpdu, dpdv) = m_triangle_mesh.parametric_derivatives(tri);
+
+      return differential_geometry(r(h.ray_parameter), uv, dpdu, dpdv, n);
+    } // end differential_geometry_at()
+
+    /*! Tests whether a ray intersects this mesh without computing the details of the intersection.
+     *  \param r The ray of interest.
+     *  \return true if an intersection exists; false, otherwise.
+     */
+    inline virtual bool is_intersected(const ray &r) const
+    {
+      return m_triangle_mesh.is_intersected(r);
+    } // end is_intersected()
+
+    /*! Finds a triangle of this mesh which a ray intersects, which need not be the nearest.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists; otherwise, the index of an intersected triangle.
+     */
+    inline virtual optional<std::uint32_t> find_occluder(const ray &r) const
+    {
+      auto tri = m_triangle_mesh.find_intersected(r);
+      if(tri)
+      {
+        return static_cast<std::uint32_t>(*tri - m_triangle_mesh.triangles().begin());
+      } // end if
+
+      return nullopt;
+    } // end find_occluder()
+
+    /*! Tests whether a ray intersects a single triangle of this mesh.
+     *  \param r The ray of interest.
+     *  \param element The index of the triangle of interest.
+     *  \return true if r intersects the triangle; false, otherwise, or if element is not a triangle of this mesh.
+     */
+    inline virtual bool is_element_intersected(const ray &r, std::uint32_t element) const
+    {
+      return element < m_triangle_mesh.triangles().size() &&
+             static_cast<bool>(m_triangle_mesh.intersect(r, m_triangle_mesh.triangles().begin()[element]));
+    } // end is_element_intersected()
+
+    /*! Finds the nearest hit of each of a packet's rays with this mesh, traversing its hierarchy once for the whole packet.
+     *  \param packet The rays of interest. The end of each ray's interval is shortened to its hit, if any.
+     *  \param mask The lanes of packet to intersect.
+     *  \param hits For each lane of the result, a hit identifying the hit triangle and its barycentric coordinates.
+     *  \return The lanes of mask whose rays hit this mesh nearer than the end of their intervals.
+     */
+    virtual ray_packet::mask_type find_hits(ray_packet& packet, ray_packet::mask_type mask, hit* hits) const;
+
+    /*! Tests which of a packet's rays intersect this mesh, traversing its hierarchy once for the whole packet.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to test.
+     *  \return The lanes of mask whose rays intersect this mesh.
+     */
+    virtual ray_packet::mask_type are_intersected(const ray_packet& packet, ray_packet::mask_type mask) const;
+
+    /*! Finds a triangle of this mesh which each of a packet's rays intersects, traversing its hierarchy once for the whole packet.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to test.
+     *  \param elements For each lane of the result, the index of a triangle its ray intersects.
+     *  \return The lanes of mask whose rays intersect this mesh.
+     */
+    virtual ray_packet::mask_type find_occluders(const ray_packet& packet, ray_packet::mask_type mask, std::uint32_t* elements) const;
+
+    /*! Finds the nearest hit of each of a stream's rays with this mesh, traversing its hierarchy once for the whole stream.
+     *  \param stream The rays of interest. The end of each ray's interval is shortened to its hit, if any.
+     *  \param indices The indices of the rays of stream to intersect.
+     *  \param hits hits[i] receives a hit identifying the hit triangle if the ray with index i hits this mesh nearer than
+     *              the end of its interval.
+     */
+    virtual void find_hits(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<hit> hits) const;
+
+    /*! Tests which of a stream's rays intersect this mesh, traversing its hierarchy once for the whole stream.
+     *  \param stream The rays of interest. Each ray which intersects this mesh is retired.
+     *  \param indices The indices of the rays of stream to test.
+     */
+    virtual void are_intersected(ray_stream& stream, array_ref<const ray_stream::index_type> indices) const;
+
+    /*! Finds a triangle of this mesh which each of a stream's rays intersects, traversing its hierarchy once for the whole stream.
+     *  \param stream The rays of interest. Each ray which intersects this mesh is retired.
+     *  \param indices The indices of the rays of stream to test.
+     *  \param elements elements[i] receives the index of a triangle the ray with index i intersects if that ray is retired.
+     */
+    virtual void find_occluders(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<std::uint32_t> elements) const;
+
+    /*! \return A bounding_box bounding this mesh.
+     */
+    virtual bounding_box bounds() const;
+
     /*! \return The surface area of this mesh.
      */
     virtual float area() const;
@@ -70,6 +239,9 @@ class mesh : public surface
   private:
     mesh(triangle_mesh&& triangle_mesh);
 
+    // recomputes the quantities derived from the areas of m_triangle_mesh's triangles
+    void update_area();
+
     triangle_mesh m_triangle_mesh;
     alias_table<triangle_mesh::triangle_iterator> area_weighted_probability_density_function_;
 
@@ -0,0 +1,560 @@
+#include <igloo/surfaces/paged_mesh.hpp>
+#include <igloo/utility/select_by_cumulative_weight.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace igloo
+{
+
+
+paged_mesh::file_header paged_mesh::make_header()
+{
+  file_header result;
+  std::memset(&result, 0, sizeof(result));
+
+  std::memcpy(result.magic, "iglpmsh", 8);
+  result.version = 1;
+  result.byte_order = 0x01020304;
+
+  return result;
+} // end paged_mesh::make_header()
+
+
+void paged_mesh::write(const std::string &filename,
+                       const std::vector<point> &points,
+                       const std::vector<parametric> &parametrics,
+                       const std::vector<normal> &normals,
+                       const std::vector<uint3> &triangles,
+                       std::size_t cluster_size)
+{
+  if(!parametrics.empty() && parametrics.size() != points.size())
+  {
+    throw std::logic_error("paged_mesh::write(): parametrics.size() != points.size()");
+  }
+
+  if(!normals.empty() && normals.size() != points.size())
+  {
+    throw std::logic_error("paged_mesh::write(): normals.size() != points.size()");
+  }
+
+  if(!normals.empty() && parametrics.empty())
+  {
+    throw std::logic_error("paged_mesh::write(): normals require parametrics");
+  }
+
+  if(cluster_size == 0)
+  {
+    throw std::logic_error("paged_mesh::write(): cluster_size must be positive");
+  }
+
+  // the leaves of a hierarchy over the triangles order them so that consecutive triangles lie close together
+  bounding_volume_hierarchy hierarchy(triangles.size(), [&](std::size_t i)
+  {
+    return bounding_box() + points[triangles[i][0]] + points[triangles[i][1]] + points[triangles[i][2]];
+  });
+
+  array_ref<const bounding_volume_hierarchy::index_type> order = hierarchy.elements();
+
+  file_header header = make_header();
+  header.num_triangles = triangles.size();
+  header.num_clusters = (order.size() + cluster_size - 1) / cluster_size;
+  header.has_parametrics = !parametrics.empty();
+  header.has_normals = !normals.empty();
+
+  std::vector<cluster_header> clusters(header.num_clusters);
+
+  std::string temporary = filename + "." + std::to_string(std::random_device()()) + ".partial";
+
+  bool written = false;
+  {
+    std::ofstream os(temporary, std::ios::binary);
+
+    // the cluster headers are written once the payloads' offsets are known
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os.write(reinterpret_cast<const char*>(clusters.data()), clusters.size() * sizeof(cluster_header));
+
+    std::uint64_t offset = sizeof(header) + clusters.size() * sizeof(cluster_header);
+
+    std::unordered_map<unsigned int, unsigned int> local_index;
+    std::vector<unsigned int> global_index;
+    std::vector<uint3> local_triangles;
+
+    for(std::size_t c = 0; c < clusters.size(); ++c)
+    {
+      std::size_t begin = c * cluster_size;
+      std::size_t end = std::min(begin + cluster_size, order.size());
+
+      local_index.clear();
+      global_index.clear();
+      local_triangles.clear();
+
+      bounding_box bounds;
+      float area = 0;
+
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        const uint3 &tri = triangles[order[i]];
+
+        uint3 local;
+        for(int j = 0; j < 3; ++j)
+        {
+          auto inserted = local_index.emplace(tri[j], static_cast<unsigned int>(global_index.size()));
+          if(inserted.second)
+          {
+            global_index.push_back(tri[j]);
+            bounds += points[tri[j]];
+          }
+
+          local[j] = inserted.first->second;
+        }
+
+        local_triangles.push_back(local);
+
+        area += 0.5f * (points[tri[1]] - points[tri[0]]).cross(points[tri[2]] - points[tri[0]]).norm();
+      }
+
+      cluster_header &cluster = clusters[c];
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        cluster.min_corner[axis] = bounds.min()[axis];
+        cluster.max_corner[axis] = bounds.max()[axis];
+      }
+      cluster.area = area;
+      cluster.num_triangles = static_cast<std::uint32_t>(end - begin);
+      cluster.first_triangle = begin;
+      cluster.num_points = global_index.size();
+      cluster.offset = offset;
+
+      for(unsigned int i : global_index)
+      {
+        os.write(reinterpret_cast<const char*>(&points[i]), sizeof(point));
+      }
+
+      if(header.has_parametrics)
+      {
+        for(unsigned int i : global_index)
+        {
+          os.write(reinterpret_cast<const char*>(&parametrics[i]), sizeof(parametric));
+        }
+      }
+
+      if(header.has_normals)
+      {
+        for(unsigned int i : global_index)
+        {
+          os.write(reinterpret_cast<const char*>(&normals[i]), sizeof(normal));
+        }
+      }
+
+      os.write(reinterpret_cast<const char*>(local_triangles.data()), local_triangles.size() * sizeof(uint3));
+
+      offset += global_index.size() * (sizeof(point) + header.has_parametrics * sizeof(parametric) + header.has_normals * sizeof(normal))
+              + local_triangles.size() * sizeof(uint3);
+    }
+
+    os.seekp(sizeof(header));
+    os.write(reinterpret_cast<const char*>(clusters.data()), clusters.size() * sizeof(cluster_header));
+
+    written = bool(os);
+  }
+
+  if(!written || std::rename(temporary.c_str(), filename.c_str()) != 0)
+  {
+    std::remove(temporary.c_str());
+    throw std::runtime_error("paged_mesh::write(): couldn't write \"" + filename + "\"");
+  }
+} // end paged_mesh::write()
+
+
+paged_mesh::paged_mesh(const std::string &filename,
+                       std::size_t memory_budget,
+                       const bounding_volume_hierarchy_options &options)
+  : m_file(std::make_shared<const mapped_file>(filename)),
+    m_cluster_options(options),
+    m_memory_budget(memory_budget),
+    m_statistics{}
+{
+  file_header expected = make_header();
+  file_header header;
+
+  if(m_file->size() < sizeof(file_header))
+  {
+    throw std::runtime_error("paged_mesh ctor: \"" + filename + "\" is not a paged mesh");
+  }
+
+  std::memcpy(&header, m_file->data(), sizeof(file_header));
+  if(std::memcmp(&header, &expected, offsetof(file_header, num_triangles)) != 0)
+  {
+    throw std::runtime_error("paged_mesh ctor: \"" + filename + "\" is not a paged mesh, or was written by an incompatible build");
+  }
+
+  m_has_parametrics = header.has_parametrics;
+  m_has_normals = header.has_normals;
+  m_num_triangles = header.num_triangles;
+
+  if(m_file->size() < sizeof(file_header) + header.num_clusters * sizeof(cluster_header))
+  {
+    throw std::runtime_error("paged_mesh ctor: \"" + filename + "\" is truncated");
+  }
+
+  m_clusters.resize(header.num_clusters);
+  std::memcpy(m_clusters.data(), static_cast<const char*>(m_file->data()) + sizeof(file_header), m_clusters.size() * sizeof(cluster_header));
+
+  for(const cluster_header& c : m_clusters)
+  {
+    if(c.offset + payload_size(c) > m_file->size())
+    {
+      throw std::runtime_error("paged_mesh ctor: \"" + filename + "\" is truncated");
+    }
+  }
+
+  m_hierarchy = bounding_volume_hierarchy(m_clusters.size(), [this](std::size_t i)
+  {
+    const cluster_header& c = m_clusters[i];
+    return bounding_box(point(c.min_corner[0], c.min_corner[1], c.min_corner[2]),
+                        point(c.max_corner[0], c.max_corner[1], c.max_corner[2]));
+  },
+  options);
+
+  m_cumulative_area.reserve(m_clusters.size());
+
+  float area = 0;
+  for(const cluster_header& c : m_clusters)
+  {
+    area += c.area;
+    m_cumulative_area.push_back(area);
+  }
+
+  m_cache.resize(m_clusters.size());
+
+  // clusters are small, and are paged in by whichever thread first needs them, so build their hierarchies serially
+  m_cluster_options.num_threads = 1;
+} // end paged_mesh::paged_mesh()
+
+
+paged_mesh::cache_statistics paged_mesh::statistics() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_statistics;
+} // end paged_mesh::statistics()
+
+
+std::size_t paged_mesh::payload_size(const cluster_header &c) const
+{
+  return c.num_points * (sizeof(point) + m_has_parametrics * sizeof(parametric) + m_has_normals * sizeof(normal))
+       + c.num_triangles * sizeof(uint3);
+} // end paged_mesh::payload_size()
+
+
+std::size_t paged_mesh::cluster_of(std::uint64_t triangle) const
+{
+  auto after = std::upper_bound(m_clusters.begin(), m_clusters.end(), triangle, [](std::uint64_t t, const cluster_header& c)
+  {
+    return t < c.first_triangle;
+  });
+
+  return (after - m_clusters.begin()) - 1;
+} // end paged_mesh::cluster_of()
+
+
+void paged_mesh::read(std::size_t c,
+                      std::vector<point> &points,
+                      std::vector<parametric> &parametrics,
+                      std::vector<normal> &normals,
+                      std::vector<uint3> &triangles) const
+{
+  const cluster_header& cluster = m_clusters[c];
+  const char* payload = static_cast<const char*>(m_file->data()) + cluster.offset;
+
+  const point* first_point = reinterpret_cast<const point*>(payload);
+  points.assign(first_point, first_point + cluster.num_points);
+  payload += points.size() * sizeof(point);
+
+  const parametric* first_parametric = reinterpret_cast<const parametric*>(payload);
+  parametrics.assign(first_parametric, first_parametric + (m_has_parametrics ? cluster.num_points : 0));
+  payload += parametrics.size() * sizeof(parametric);
+
+  const normal* first_normal = reinterpret_cast<const normal*>(payload);
+  normals.assign(first_normal, first_normal + (m_has_normals ? cluster.num_points : 0));
+  payload += normals.size() * sizeof(normal);
+
+  const uint3* first_triangle = reinterpret_cast<const uint3*>(payload);
+  triangles.assign(first_triangle, first_triangle + cluster.num_triangles);
+} // end paged_mesh::read()
+
+
+std::shared_ptr<const mesh> paged_mesh::cluster(std::size_t c) const
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    cache_entry& entry = m_cache[c];
+    if(entry.geometry)
+    {
+      ++m_statistics.hits;
+
+      // move the cluster to the front of the list
+      m_least_recently_used.splice(m_least_recently_used.begin(), m_least_recently_used, entry.position);
+
+      return entry.geometry;
+    }
+  }
+
+  // page the cluster in without holding the lock, so that other threads' hits proceed meanwhile
+  std::vector<point> points;
+  std::vector<parametric> parametrics;
+  std::vector<normal> normals;
+  std::vector<uint3> triangles;
+  read(c, points, parametrics, normals, triangles);
+
+  // the copies are resident now, so the mapping's pages may go
+  m_file->release(m_clusters[c].offset, payload_size(m_clusters[c]));
+
+  std::shared_ptr<const mesh> result;
+  if(m_has_normals)
+  {
+    result = std::make_shared<const mesh>(points, parametrics, normals, triangles, m_cluster_options);
+  }
+  else if(m_has_parametrics)
+  {
+    result = std::make_shared<const mesh>(points, parametrics, triangles, m_cluster_options);
+  }
+  else
+  {
+    result = std::make_shared<const mesh>(points, triangles, m_cluster_options);
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  ++m_statistics.misses;
+
+  cache_entry& entry = m_cache[c];
+
+  // another thread may have paged the same cluster in meanwhile
+  if(entry.geometry)
+  {
+    m_least_recently_used.splice(m_least_recently_used.begin(), m_least_recently_used, entry.position);
+    return entry.geometry;
+  }
+
+  insert(c, result);
+
+  return result;
+} // end paged_mesh::cluster()
+
+
+void paged_mesh::insert(std::size_t c, const std::shared_ptr<const mesh> &geometry) const
+{
+  std::size_t bytes = payload_size(m_clusters[c]) + geometry->traversed_hierarchy_memory_size();
+
+  // evict the least recently used clusters until the new one fits, but always keep at least the new one
+  while(!m_least_recently_used.empty() && m_statistics.resident_bytes + bytes > m_memory_budget)
+  {
+    std::size_t victim = m_least_recently_used.back();
+    m_least_recently_used.pop_back();
+
+    m_statistics.resident_bytes -= m_cache[victim].bytes;
+    --m_statistics.resident_clusters;
+    ++m_statistics.evictions;
+
+    // queries still using the victim keep it alive until they finish
+    m_cache[victim] = cache_entry();
+  }
+
+  cache_entry& entry = m_cache[c];
+
+  m_least_recently_used.push_front(c);
+  entry.geometry = geometry;
+  entry.bytes = bytes;
+  entry.position = m_least_recently_used.begin();
+
+  m_statistics.resident_bytes += bytes;
+  ++m_statistics.resident_clusters;
+  m_statistics.peak_resident_bytes = std::max(m_statistics.peak_resident_bytes, m_statistics.resident_bytes);
+} // end paged_mesh::insert()
+
+
+void paged_mesh::keep(std::size_t c, const std::shared_ptr<const mesh> &geometry) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  cache_entry& entry = m_cache[c];
+  if(entry.geometry)
+  {
+    m_least_recently_used.splice(m_least_recently_used.begin(), m_least_recently_used, entry.position);
+  }
+  else
+  {
+    insert(c, geometry);
+  }
+} // end paged_mesh::keep()
+
+
+triangle_mesh paged_mesh::triangulate() const
+{
+  std::vector<point> points;
+  std::vector<uint3> triangles;
+
+  points.reserve(8 * m_clusters.size());
+  triangles.reserve(12 * m_clusters.size());
+
+  // the box's corners are numbered by the bits of their coordinates: bit 0 is x, bit 1 is y, bit 2 is z
+  const unsigned int faces[12][3] = {{0,2,1}, {1,2,3}, {4,5,6}, {5,7,6},
+                                     {0,1,4}, {1,5,4}, {2,6,3}, {3,6,7},
+                                     {0,4,2}, {2,4,6}, {1,3,5}, {3,7,5}};
+
+  for(const cluster_header& c : m_clusters)
+  {
+    unsigned int first = static_cast<unsigned int>(points.size());
+
+    for(unsigned int corner = 0; corner < 8; ++corner)
+    {
+      points.push_back(point(corner & 1 ? c.max_corner[0] : c.min_corner[0],
+                             corner & 2 ? c.max_corner[1] : c.min_corner[1],
+                             corner & 4 ? c.max_corner[2] : c.min_corner[2]));
+    }
+
+    for(const auto& face : faces)
+    {
+      triangles.push_back(uint3(first + face[0], first + face[1], first + face[2]));
+    }
+  }
+
+  return triangle_mesh(std::move(points), std::move(triangles));
+} // end paged_mesh::triangulate()
+
+
+optional<intersection> paged_mesh::intersect(const ray &r) const
+{
+  auto h = find_hit(r);
+  if(h)
+  {
+    return intersection(h->ray_parameter, differential_geometry_at(r, *h));
+  } // end if
+
+  return nullopt;
+} // end paged_mesh::intersect()
+
+
+optional<hit> paged_mesh::find_hit(const ray &r) const
+{
+  optional<hit> result;
+
+  // the cluster of the nearest hit so far
+  std::size_t nearest = 0;
+  std::shared_ptr<const mesh> nearest_geometry;
+
+  m_hierarchy.intersect(r, [&](std::size_t c, float max_t)
+  {
+    // only accept intersections nearer than the nearest found so far
+    ray nearer(r);
+    nearer.end(max_t);
+
+    std::shared_ptr<const mesh> geometry = cluster(c);
+
+    auto h = geometry->mesh::find_hit(nearer);
+    if(h)
+    {
+      h->element += static_cast<std::uint32_t>(m_clusters[c].first_triangle);
+      max_t = h->ray_parameter;
+      result = h;
+
+      nearest = c;
+      nearest_geometry = std::move(geometry);
+    }
+
+    return max_t;
+  });
+
+  // the clusters paged in after the hit's may have evicted it, but differential_geometry_at() is about to read it
+  if(result)
+  {
+    keep(nearest, nearest_geometry);
+  }
+
+  return result;
+} // end paged_mesh::find_hit()
+
+
+differential_geometry paged_mesh::differential_geometry_at(const ray &r, const hit &h) const
+{
+  std::size_t c = cluster_of(h.element);
+
+  hit local = h;
+  local.element -= static_cast<std::uint32_t>(m_clusters[c].first_triangle);
+
+  return cluster(c)->mesh::differential_geometry_at(r, local);
+} // end paged_mesh::differential_geometry_at()
+
+
+bool paged_mesh::is_intersected(const ray &r) const
+{
+  return m_hierarchy.any_of(r, [&](std::size_t c)
+  {
+    return cluster(c)->mesh::is_intersected(r);
+  });
+} // end paged_mesh::is_intersected()
+
+
+optional<std::uint32_t> paged_mesh::find_occluder(const ray &r) const
+{
+  optional<std::uint32_t> result;
+
+  m_hierarchy.any_of(r, [&](std::size_t c)
+  {
+    auto element = cluster(c)->mesh::find_occluder(r);
+    if(element)
+    {
+      result = *element + static_cast<std::uint32_t>(m_clusters[c].first_triangle);
+    }
+
+    return static_cast<bool>(element);
+  });
+
+  return result;
+} // end paged_mesh::find_occluder()
+
+
+bool paged_mesh::is_element_intersected(const ray &r, std::uint32_t element) const
+{
+  if(element >= m_num_triangles) return false;
+
+  std::size_t c = cluster_of(element);
+
+  return cluster(c)->mesh::is_element_intersected(r, element - static_cast<std::uint32_t>(m_clusters[c].first_triangle));
+} // end paged_mesh::is_element_intersected()
+
+
+bounding_box paged_mesh::bounds() const
+{
+  return m_hierarchy.bounding_box();
+} // end paged_mesh::bounds()
+
+
+float paged_mesh::area() const
+{
+  return m_cumulative_area.empty() ? 0.f : m_cumulative_area.back();
+} // end paged_mesh::area()
+
+
+differential_geometry paged_mesh::sample_surface(std::uint64_t u0, std::uint64_t u1) const
+{
+  if(m_clusters.empty())
+  {
+    throw std::logic_error("paged_mesh::sample_surface(): paged_mesh has no triangles");
+  }
+
+  // select a cluster in proportion to its area, and sample it with what remains of u0
+  auto cluster_and_u0 = select_by_cumulative_weight(m_cumulative_area, u0);
+
+  return cluster(cluster_and_u0.first)->sample_surface(cluster_and_u0.second, u1);
+} // end paged_mesh::sample_surface()
+
+
+} // end igloo
+
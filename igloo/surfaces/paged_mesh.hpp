@@ -0,0 +1,246 @@
+#pragma once
+
+#include <igloo/surfaces/surface.hpp>
+#include <igloo/surfaces/mesh.hpp>
+#include <igloo/geometry/point.hpp>
+#include <igloo/geometry/parametric.hpp>
+#include <igloo/geometry/normal.hpp>
+#include <igloo/geometry/triangle_mesh.hpp>
+#include <igloo/geometry/bounding_volume_hierarchy.hpp>
+#include <igloo/geometry/ray.hpp>
+#include <igloo/utility/mapped_file.hpp>
+#include <igloo/utility/optional.hpp>
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace igloo
+{
+
+
+/*! A paged_mesh is a mesh too large to keep in memory, stored in a file written by write() as spatially coherent clusters of triangles.
+ *  Only the clusters' bounds, areas, and a small hierarchy over them stay resident. A cluster's points, parametrics,
+ *  normals and triangles are paged in from the memory-mapped file as a mesh when a ray first reaches it,
+ *  and kept in a least-recently-used cache whose size is limited by a memory budget.
+ *  The element of a hit on a paged_mesh is the index of the hit triangle in the file.
+ */
+class paged_mesh : public surface
+{
+  public:
+    /*! The counters of a paged_mesh's cluster cache.
+     */
+    struct cache_statistics
+    {
+      // the number of cluster requests served by the cache
+      std::uint64_t hits;
+
+      // the number of cluster requests which paged the cluster in
+      std::uint64_t misses;
+
+      // the number of clusters dropped from the cache to respect the budget
+      std::uint64_t evictions;
+
+      // the number of clusters, and of bytes they occupy, currently in the cache
+      std::size_t resident_clusters;
+      std::size_t resident_bytes;
+
+      // the greatest number of bytes the cache has occupied
+      std::size_t peak_resident_bytes;
+    };
+
+    /*! Writes a mesh to a file which a paged_mesh can page.
+     *  The triangles are ordered along the leaves of a hierarchy over them and split into clusters of consecutive triangles,
+     *  so that each cluster is spatially compact. Each cluster stores its own copy of the vertices it references.
+     *  \param filename The name of the file to write.
+     *  \param points An array of points.
+     *  \param parametrics An array of parametric coordinates, either empty or the same size as points.
+     *  \param normals An array of normals, either empty or the same size as points; normals require parametrics.
+     *  \param triangles An array of triangles.
+     *  \param cluster_size The number of triangles per cluster.
+     *  \throws std::logic_error if the arrays' sizes are inconsistent.
+     *  \throws std::runtime_error if the file cannot be written.
+     */
+    static void write(const std::string &filename,
+                      const std::vector<point> &points,
+                      const std::vector<parametric> &parametrics,
+                      const std::vector<normal> &normals,
+                      const std::vector<uint3> &triangles,
+                      std::size_t cluster_size = 4096);
+
+    /*! Creates a new paged_mesh from a file written by write().
+     *  \param filename The name of the file to map.
+     *  \param memory_budget The number of bytes the cache of clusters may occupy. At least one cluster is always kept.
+     *  \param options Parameters controlling the construction of each cluster's hierarchy when it is paged in.
+     *  \throws std::runtime_error if the file cannot be mapped or was not written by write().
+     */
+    paged_mesh(const std::string &filename,
+               std::size_t memory_budget,
+               const bounding_volume_hierarchy_options &options = bounding_volume_hierarchy_options());
+
+    /*! \return The number of triangles of this paged_mesh.
+     */
+    inline std::size_t size() const
+    {
+      return m_num_triangles;
+    } // end size()
+
+    /*! \return The number of clusters of this paged_mesh.
+     */
+    inline std::size_t num_clusters() const
+    {
+      return m_clusters.size();
+    } // end num_clusters()
+
+    /*! \return A snapshot of the counters of this paged_mesh's cluster cache.
+     */
+    cache_statistics statistics() const;
+
+    /*! \return A coarse triangle_mesh approximating this paged_mesh, with a box per cluster,
+     *          which may be drawn without paging any cluster in.
+     */
+    virtual triangle_mesh triangulate() const;
+
+    /*! Tests for intersection between a ray and this paged_mesh.
+     *  \param r The ray of interest.
+     *  \param nullopt if no intersection exists, otherwise the details of the intersection.
+     */
+    virtual optional<intersection> intersect(const ray &r) const;
+
+    /*! Tests for intersection between a ray and this paged_mesh and returns a compact record of the nearest intersection.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists, otherwise a hit whose element is the index of the hit triangle.
+     */
+    virtual optional<hit> find_hit(const ray &r) const;
+
+    /*! \return The differential_geometry of this paged_mesh at a hit returned by find_hit(r).
+     */
+    virtual differential_geometry differential_geometry_at(const ray &r, const hit &h) const;
+
+    /*! Tests whether a ray intersects this paged_mesh without computing the details of the intersection.
+     *  \param r The ray of interest.
+     *  \return true if an intersection exists; false, otherwise.
+     */
+    virtual bool is_intersected(const ray &r) const;
+
+    /*! Finds a triangle of this paged_mesh which a ray intersects, which need not be the nearest.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists; otherwise, the index of an intersected triangle.
+     */
+    virtual optional<std::uint32_t> find_occluder(const ray &r) const;
+
+    /*! Tests whether a ray intersects a single triangle of this paged_mesh, paging in only the triangle's cluster.
+     *  \param r The ray of interest.
+     *  \param element The index of the triangle of interest.
+     *  \return true if r intersects the triangle; false, otherwise.
+     */
+    virtual bool is_element_intersected(const ray &r, std::uint32_t element) const;
+
+    /*! \return A bounding_box bounding this paged_mesh.
+     */
+    virtual bounding_box bounds() const;
+
+    /*! \return The surface area of this paged_mesh.
+     */
+    virtual float area() const;
+
+    /*! \return The differential_geometry of the paged_mesh at coordinates (u0,u1).
+     *  Clusters are selected in proportion to their areas, so points are uniform over the whole paged_mesh.
+     *  \throws std::logic_error if this paged_mesh has no triangles.
+     */
+    virtual differential_geometry sample_surface(std::uint64_t u0, std::uint64_t u1) const;
+
+  private:
+    // the layout of the beginning of a file written by write(), followed by num_clusters cluster_headers
+    // and then the clusters' payloads
+    struct file_header
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t byte_order;
+      std::uint64_t num_triangles;
+      std::uint64_t num_clusters;
+      std::uint32_t has_parametrics;
+      std::uint32_t has_normals;
+    };
+
+    // a cluster's payload is its points, then its parametrics and normals if the mesh has them, then its triangles,
+    // whose vertex indices are local to the cluster
+    struct cluster_header
+    {
+      float min_corner[3];
+      float max_corner[3];
+      float area;
+      std::uint32_t num_triangles;
+      std::uint64_t first_triangle;
+      std::uint64_t num_points;
+      std::uint64_t offset;
+    };
+
+    static file_header make_header();
+
+    std::size_t payload_size(const cluster_header &c) const;
+
+    // returns the cluster containing the triangle with the given index
+    std::size_t cluster_of(std::uint64_t triangle) const;
+
+    // reads the payload of cluster c from the file
+    void read(std::size_t c,
+              std::vector<point> &points,
+              std::vector<parametric> &parametrics,
+              std::vector<normal> &normals,
+              std::vector<uint3> &triangles) const;
+
+    // returns cluster c as a mesh, paging it in if it is not in the cache
+    std::shared_ptr<const mesh> cluster(std::size_t c) const;
+
+    // adds cluster c to the front of the cache, evicting the least recently used clusters to respect the budget;
+    // the caller must hold m_mutex
+    void insert(std::size_t c, const std::shared_ptr<const mesh> &geometry) const;
+
+    // makes cluster c the most recently used, returning geometry to the cache if c was evicted
+    void keep(std::size_t c, const std::shared_ptr<const mesh> &geometry) const;
+
+    std::shared_ptr<const mapped_file> m_file;
+    bool m_has_parametrics;
+    bool m_has_normals;
+    std::size_t m_num_triangles;
+
+    std::vector<cluster_header> m_clusters;
+
+    // the hierarchy over the clusters' bounds
+    bounding_volume_hierarchy m_hierarchy;
+
+    // the running sums of the clusters' areas, which sample_surface() searches
+    std::vector<float> m_cumulative_area;
+
+    bounding_volume_hierarchy_options m_cluster_options;
+    std::size_t m_memory_budget;
+
+    struct cache_entry
+    {
+      std::shared_ptr<const igloo::mesh> geometry;
+      std::size_t bytes;
+
+      // the entry's position in m_least_recently_used
+      std::list<std::size_t>::iterator position;
+    };
+
+    // guards the cache, which intersection queries from many threads may update
+    mutable std::mutex m_mutex;
+
+    // indexed by cluster; entries of clusters not in the cache are empty
+    mutable std::vector<cache_entry> m_cache;
+
+    // the clusters in the cache, from most to least recently used
+    mutable std::list<std::size_t> m_least_recently_used;
+
+    mutable cache_statistics m_statistics;
+}; // end paged_mesh
+
+
+} // end igloo
+
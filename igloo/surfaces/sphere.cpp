@@ -107,43 +107,10 @@ std::tuple<parametric, vector, vector> sphere::parametric_geometry_at(const norm
 }
 
 
-optional<intersection> sphere::intersect(const ray &r) const
+differential_geometry sphere::differential_geometry_at(const ray &r, const hit &h) const
 {
-  vector diff = r.origin() - center();
-
-  // compute the coefficients of the quadratic equation of this sphere
-  float a = r.direction().norm2();
-  float b = 2.0f * dot(r.direction(), diff);
-  float c = diff.norm2() - radius() * radius();
-
-  // solve the quadratic
-  float root0, root1;
-  std::tie(root0,root1) = solve_quadratic(a,b,c);
-  if(std::isnan(root0))
-  {
-    return nullopt;
-  }
-
-  // the hits must lie in the interval
-  if(root0 > r.interval().y || root1 < r.interval().x)
-  {
-    return nullopt;
-  } // end if
-
-  float t = root0;
-
-  // the hits must lie in the legal bound
-  if(t < r.interval().x)
-  {
-    t = root1;
-    if(t > r.interval().y)
-    {
-      return nullopt;
-    } // end if
-  } // end if
-
   // compute the hit point
-  point x = r(t);
+  point x = r(h.ray_parameter);
 
   // compute the normal at the hit point
   normal n = normalize(x - center());
@@ -152,42 +119,28 @@ optional<intersection> sphere::intersect(const ray &r) const
   vector dpdu, dpdv;
   std::tie(uv, dpdu, dpdv) = parametric_geometry_at(n);
 
-  return intersection(t,differential_geometry(x,uv,dpdu,dpdv,n));
-} // end sphere::intersect()
+  return differential_geometry(x,uv,dpdu,dpdv,n);
+} // end sphere::differential_geometry_at()
 
 
-std::pair<float,float> sphere::solve_quadratic(float a, float b, float c)
+optional<intersection> sphere::intersect(const ray &r) const
 {
-  float x0 = std::numeric_limits<float>::quiet_NaN();
-  float x1 = x0;
-
-  int result = 0;
-
-  // are there roots?
-  float denom = 2.0f*a;
-
-  if(denom != 0.0f)
+  auto h = find_hit(r);
+  if(h)
   {
-    float root = b*b - 4.0f*a*c;
+    return intersection(h->ray_parameter, differential_geometry_at(r, *h));
+  } // end if
 
-    if(root == 0.0f)
-    {
-      // one root
-      x0 = x1 = -b / denom;
-    } // end if
-    else if(root > 0.0f)
-    {
-      root = std::sqrt(root);
+  return nullopt;
+} // end sphere::intersect()
 
-      x0 = (-b - root) / denom;
-      x1 = (-b + root) / denom;
 
-      if(x0 > x1) std::swap(x0,x1);
-    } // end else if
-  } // end if
+bounding_box sphere::bounds() const
+{
+  vector extent(radius(), radius(), radius());
 
-  return std::make_pair(x0,x1);
-} // end solve_quadratic()
+  return bounding_box(center() - extent, center() + extent);
+} // end sphere::bounds()
 
 
 float sphere::area() const
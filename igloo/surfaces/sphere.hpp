@@ -8,6 +8,9 @@
 #include <igloo/geometry/pi.hpp>
 #include <igloo/utility/optional.hpp>
 #include <tuple>
+#include <utility>
+#include <limits>
+#include <cmath>
 
 namespace igloo
 {
@@ -54,6 +57,38 @@ class sphere : public surface
      */
     virtual optional<intersection> intersect(const ray &r) const;
 
+    /*! Tests for intersection between a ray and this sphere and returns a compact record of the nearest intersection.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists, otherwise a hit.
+     */
+    inline virtual optional<hit> find_hit(const ray &r) const
+    {
+      auto t = intersect_ray_parameter(r, center(), radius());
+      if(t)
+      {
+        return hit{0, 0, *t, float2(0.f)};
+      } // end if
+
+      return nullopt;
+    } // end find_hit()
+
+    /*! \return The differential_geometry of this sphere at a hit returned by find_hit(r).
+     */
+    virtual differential_geometry differential_geometry_at(const ray &r, const hit &h) const;
+
+    /*! Tests whether a ray intersects this sphere without computing the details of the intersection.
+     *  \param r The ray of interest.
+     *  \return true if an intersection exists; false, otherwise.
+     */
+    inline virtual bool is_intersected(const ray &r) const
+    {
+      return static_cast<bool>(intersect_ray_parameter(r, center(), radius()));
+    } // end is_intersected()
+
+    /*! \return A bounding_box bounding this sphere.
+     */
+    virtual bounding_box bounds() const;
+
     /*! \return The surface area of this sphere.
      */
     virtual float area() const;
@@ -62,8 +97,88 @@ class sphere : public surface
      */
     virtual differential_geometry sample_surface(std::uint64_t u0, std::uint64_t u1) const;
 
+    /*! Solves the quadratic equation a x^2 + b x + c = 0.
+     *  \return The roots in increasing order, or a pair whose first element exceeds its second if no real roots exist.
+     *  \note This is inline so that kernels which intersect many spheres at once may vectorize around it.
+     */
+    inline static std::pair<float,float> solve_quadratic(float a, float b, float c)
+    {
+      // no roots are reported as an empty interval rather than NaNs, which -ffast-math assumes never occur
+      float x0 = std::numeric_limits<float>::max();
+      float x1 = -x0;
+
+      // are there roots?
+      float denom = 2.0f*a;
+
+      if(denom != 0.0f)
+      {
+        float root = b*b - 4.0f*a*c;
+
+        if(root == 0.0f)
+        {
+          // one root
+          x0 = x1 = -b / denom;
+        } // end if
+        else if(root > 0.0f)
+        {
+          root = std::sqrt(root);
+
+          x0 = (-b - root) / denom;
+          x1 = (-b + root) / denom;
+
+          if(x0 > x1) std::swap(x0,x1);
+        } // end else if
+      } // end if
+
+      return std::make_pair(x0,x1);
+    } // end solve_quadratic()
+
+    /*! Intersects a ray with the sphere of the given center and radius.
+     *  \param r The ray of interest.
+     *  \param center The center of the sphere.
+     *  \param radius The radius of the sphere.
+     *  \return The ray parameter of the nearest intersection within r's interval, or nullopt if none exists.
+     *  \note This is static so that spheres stored in other layouts, e.g. a committed scene's, may be intersected in place.
+     */
+    inline static optional<float> intersect_ray_parameter(const ray &r, const point &center, float radius)
+    {
+      vector diff = r.origin() - center;
+
+      // compute the coefficients of the quadratic equation of this sphere
+      float a = r.direction().norm2();
+      float b = 2.0f * dot(r.direction(), diff);
+      float c = diff.norm2() - radius * radius;
+
+      // solve the quadratic
+      float root0, root1;
+      std::tie(root0,root1) = solve_quadratic(a,b,c);
+      if(root0 > root1)
+      {
+        return nullopt;
+      }
+
+      // the hits must lie in the interval
+      if(root0 > r.interval().y || root1 < r.interval().x)
+      {
+        return nullopt;
+      } // end if
+
+      float t = root0;
+
+      // the hits must lie in the legal bound
+      if(t < r.interval().x)
+      {
+        t = root1;
+        if(t > r.interval().y)
+        {
+          return nullopt;
+        } // end if
+      } // end if
+
+      return t;
+    } // end intersect_ray_parameter()
+
   private:
-    static std::pair<float,float> solve_quadratic(float a, float b, float c);
     static parametric parametric_coordinates_at(const normal& n);
 
     // returns (uv, dpdu, dpdv) on the sphere at the point with normal n
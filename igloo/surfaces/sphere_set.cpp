@@ -0,0 +1,144 @@
+#include <igloo/surfaces/sphere_set.hpp>
+#include <igloo/geometry/pi.hpp>
+#include <igloo/utility/select_by_cumulative_weight.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+
+namespace igloo
+{
+
+
+static bounding_volume_hierarchy_options without_spatial_splits(bounding_volume_hierarchy_options options)
+{
+  if(options.method == bounding_volume_hierarchy_options::split_method::spatial)
+  {
+    options.method = bounding_volume_hierarchy_options::split_method::binned_sah;
+  }
+
+  return options;
+} // end without_spatial_splits()
+
+
+sphere_set::sphere_set(const std::vector<point> &centers,
+                       const std::vector<float> &radii,
+                       const bounding_volume_hierarchy_options &options)
+{
+  if(centers.size() != radii.size())
+  {
+    throw std::logic_error("sphere_set ctor: radii.size() != centers.size()");
+  }
+
+  if(centers.empty())
+  {
+    throw std::logic_error("sphere_set ctor: centers must not be empty");
+  }
+
+  m_hierarchy = bounding_volume_hierarchy(centers.size(), [&](std::size_t i)
+  {
+    vector extent(radii[i], radii[i], radii[i]);
+    return bounding_box(centers[i] - extent, centers[i] + extent);
+  },
+  without_spatial_splits(options));
+
+  // lay out the spheres in leaf order, so that each leaf's spheres are contiguous
+  array_ref<const bounding_volume_hierarchy::index_type> elements = m_hierarchy.elements();
+
+  m_center_x.reserve(elements.size());
+  m_center_y.reserve(elements.size());
+  m_center_z.reserve(elements.size());
+  m_radius.reserve(elements.size());
+  m_cumulative_area.reserve(elements.size());
+
+  float area = 0;
+  for(bounding_volume_hierarchy::index_type i : elements)
+  {
+    m_center_x.push_back(centers[i].x);
+    m_center_y.push_back(centers[i].y);
+    m_center_z.push_back(centers[i].z);
+    m_radius.push_back(radii[i]);
+
+    area += 4.f * pi * radii[i] * radii[i];
+    m_cumulative_area.push_back(area);
+  }
+} // end sphere_set::sphere_set()
+
+
+differential_geometry sphere_set::differential_geometry_at(const ray &r, const hit &h) const
+{
+  return sphere(center(h.element), radius(h.element)).differential_geometry_at(r, h);
+} // end sphere_set::differential_geometry_at()
+
+
+optional<intersection> sphere_set::intersect(const ray &r) const
+{
+  auto h = find_hit(r);
+  if(h)
+  {
+    return intersection(h->ray_parameter, differential_geometry_at(r, *h));
+  } // end if
+
+  return nullopt;
+} // end sphere_set::intersect()
+
+
+triangle_mesh sphere_set::triangulate() const
+{
+  std::vector<point> points;
+  std::vector<triangle_mesh::triangle> triangles;
+
+  points.reserve(6 * size());
+  triangles.reserve(8 * size());
+
+  // the octahedron's vertices lie at +x, -x, +y, -y, +z, -z
+  const unsigned int faces[8][3] = {{0,2,4}, {2,1,4}, {1,3,4}, {3,0,4},
+                                    {2,0,5}, {1,2,5}, {3,1,5}, {0,3,5}};
+
+  for(std::size_t i = 0; i < size(); ++i)
+  {
+    unsigned int first = static_cast<unsigned int>(points.size());
+
+    point c = center(i);
+    float r = radius(i);
+
+    points.push_back(c + vector( r, 0, 0));
+    points.push_back(c + vector(-r, 0, 0));
+    points.push_back(c + vector(0,  r, 0));
+    points.push_back(c + vector(0, -r, 0));
+    points.push_back(c + vector(0, 0,  r));
+    points.push_back(c + vector(0, 0, -r));
+
+    for(const auto& face : faces)
+    {
+      triangles.push_back({first + face[0], first + face[1], first + face[2]});
+    }
+  }
+
+  return triangle_mesh(std::move(points), std::move(triangles));
+} // end sphere_set::triangulate()
+
+
+bounding_box sphere_set::bounds() const
+{
+  return m_hierarchy.bounding_box();
+} // end sphere_set::bounds()
+
+
+float sphere_set::area() const
+{
+  return m_cumulative_area.empty() ? 0.f : m_cumulative_area.back();
+} // end sphere_set::area()
+
+
+differential_geometry sphere_set::sample_surface(std::uint64_t u0, std::uint64_t u1) const
+{
+  // select a sphere in proportion to its area, and sample it with what remains of u0
+  auto sphere_and_u0 = select_by_cumulative_weight(m_cumulative_area, u0);
+  std::size_t i = sphere_and_u0.first;
+
+  return sphere(center(i), radius(i)).sample_surface(sphere_and_u0.second, u1);
+} // end sphere_set::sample_surface()
+
+
+} // end igloo
+
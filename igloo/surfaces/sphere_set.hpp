@@ -0,0 +1,222 @@
+#pragma once
+
+#include <igloo/surfaces/surface.hpp>
+#include <igloo/surfaces/sphere.hpp>
+#include <igloo/geometry/point.hpp>
+#include <igloo/geometry/triangle_mesh.hpp>
+#include <igloo/geometry/bounding_volume_hierarchy.hpp>
+#include <igloo/geometry/ray.hpp>
+#include <igloo/utility/optional.hpp>
+#include <vector>
+#include <utility>
+#include <tuple>
+
+namespace igloo
+{
+
+
+/*! A sphere_set is a single surface made of many spheres, e.g. the particles of a simulation or the atoms of a molecule.
+ *  Rather than a separate sphere per surface_primitive, it stores the spheres' centers and radii in
+ *  structure-of-arrays layout, in the leaf order of its own hierarchy, so that intersecting a leaf's spheres
+ *  reads contiguous arrays.
+ *  The element of a hit on a sphere_set is the position of the hit sphere in that order.
+ */
+class sphere_set : public surface
+{
+  public:
+    /*! Creates a new sphere_set.
+     *  \param centers The centers of the spheres.
+     *  \param radii The radii of the spheres; radii.size() must equal centers.size().
+     *  \param options Parameters controlling the construction of the sphere_set's hierarchy.
+     *  \throws std::logic_error if centers is empty or radii.size() != centers.size().
+     *  \note Spheres are compact, so spatial splits are replaced by binned_sah.
+     */
+    sphere_set(const std::vector<point> &centers,
+               const std::vector<float> &radii,
+               const bounding_volume_hierarchy_options &options = bounding_volume_hierarchy_options());
+
+    /*! \return The number of spheres in this sphere_set.
+     */
+    inline std::size_t size() const
+    {
+      return m_radius.size();
+    } // end size()
+
+    /*! \return The center of the sphere at the given position.
+     */
+    inline point center(std::size_t i) const
+    {
+      return point(m_center_x[i], m_center_y[i], m_center_z[i]);
+    } // end center()
+
+    /*! \return The radius of the sphere at the given position.
+     */
+    inline float radius(std::size_t i) const
+    {
+      return m_radius[i];
+    } // end radius()
+
+    /*! \return The hierarchy which accelerates intersection queries.
+     */
+    inline const bounding_volume_hierarchy &hierarchy() const
+    {
+      return m_hierarchy;
+    } // end hierarchy()
+
+    /*! \return A coarse triangle_mesh approximating this sphere_set, with an octahedron per sphere.
+     */
+    virtual triangle_mesh triangulate() const;
+
+    /*! Tests for intersection between a ray and this sphere_set.
+     *  \param r The ray of interest.
+     *  \param nullopt if no intersection exists, otherwise the details of the intersection.
+     */
+    virtual optional<intersection> intersect(const ray &r) const;
+
+    /*! Tests for intersection between a ray and this sphere_set and returns a compact record of the nearest intersection.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists, otherwise a hit whose element is the position of the hit sphere.
+     */
+    inline virtual optional<hit> find_hit(const ray &r) const
+    {
+      std::size_t nearest = size();
+
+      float t = m_hierarchy.intersect_leaves(r, [&](std::size_t begin, std::size_t end, float max_t)
+      {
+        ray nearer(r);
+        nearer.end(max_t);
+
+        auto result = nearest_in_leaf(nearer, begin, end);
+        if(result.first != end)
+        {
+          nearest = result.first;
+          max_t = result.second;
+        }
+
+        return max_t;
+      });
+
+      if(nearest != size())
+      {
+        return hit{0, static_cast<std::uint32_t>(nearest), t, float2(0.f)};
+      } // end if
+
+      return nullopt;
+    } // end find_hit()
+
+    /*! \return The differential_geometry of this sphere_set at a hit returned by find_hit(r).
+     */
+    virtual differential_geometry differential_geometry_at(const ray &r, const hit &h) const;
+
+    /*! Tests whether a ray intersects this sphere_set without computing the details of the intersection.
+     *  \param r The ray of interest.
+     *  \return true if an intersection exists; false, otherwise.
+     */
+    inline virtual bool is_intersected(const ray &r) const
+    {
+      return m_hierarchy.any_of_leaves(r, [&](std::size_t begin, std::size_t end)
+      {
+        return nearest_in_leaf(r, begin, end).first != end;
+      });
+    } // end is_intersected()
+
+    /*! Finds a sphere of this sphere_set which a ray intersects, which need not be the nearest.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists; otherwise, the position of an intersected sphere.
+     */
+    inline virtual optional<std::uint32_t> find_occluder(const ray &r) const
+    {
+      optional<std::uint32_t> result;
+
+      m_hierarchy.any_of_leaves(r, [&](std::size_t begin, std::size_t end)
+      {
+        std::size_t i = nearest_in_leaf(r, begin, end).first;
+        if(i != end)
+        {
+          result = static_cast<std::uint32_t>(i);
+          return true;
+        }
+
+        return false;
+      });
+
+      return result;
+    } // end find_occluder()
+
+    /*! Tests whether a ray intersects a single sphere of this sphere_set.
+     *  \param r The ray of interest.
+     *  \param element The position of the sphere of interest.
+     *  \return true if r intersects the sphere; false, otherwise, or if element is not a sphere of this sphere_set.
+     */
+    inline virtual bool is_element_intersected(const ray &r, std::uint32_t element) const
+    {
+      return element < size() && static_cast<bool>(sphere::intersect_ray_parameter(r, center(element), radius(element)));
+    } // end is_element_intersected()
+
+    /*! \return A bounding_box bounding this sphere_set.
+     */
+    virtual bounding_box bounds() const;
+
+    /*! \return The surface area of this sphere_set.
+     */
+    virtual float area() const;
+
+    /*! \return The differential_geometry of the sphere_set at coordinates (u0,u1).
+     *  The spheres are sampled in proportion to their areas, so points are uniform over the whole sphere_set.
+     */
+    virtual differential_geometry sample_surface(std::uint64_t u0, std::uint64_t u1) const;
+
+  private:
+    // returns the position of the sphere nearest along r in the leaf spheres [begin, end) and its ray parameter,
+    // if that parameter lies within r's interval
+    inline std::pair<std::size_t,float> nearest_in_leaf(const ray &r, std::size_t begin, std::size_t end) const
+    {
+      const float ox = r.origin().x, oy = r.origin().y, oz = r.origin().z;
+      const float dx = r.direction().x, dy = r.direction().y, dz = r.direction().z;
+
+      // the quadratic coefficient depends only on the ray
+      const float a = r.direction().norm2();
+      const float t_min = r.begin();
+
+      std::size_t nearest = end;
+      float nearest_t = r.end();
+
+      // test every sphere of the leaf without early exits, which the compiler can vectorize
+      for(std::size_t i = begin; i < end; ++i)
+      {
+        float diff_x = ox - m_center_x[i];
+        float diff_y = oy - m_center_y[i];
+        float diff_z = oz - m_center_z[i];
+
+        float b = 2.0f * (dx * diff_x + dy * diff_y + dz * diff_z);
+        float c = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z - m_radius[i] * m_radius[i];
+
+        float root0, root1;
+        std::tie(root0, root1) = sphere::solve_quadratic(a, b, c);
+
+        // take the nearer root unless it precedes the interval; a miss yields roots out of order
+        float t = root0 < t_min ? root1 : root0;
+        bool is_nearer = root0 <= root1 && t >= t_min && t < nearest_t;
+
+        nearest   = is_nearer ? i : nearest;
+        nearest_t = is_nearer ? t : nearest_t;
+      }
+
+      return std::make_pair(nearest, nearest_t);
+    } // end nearest_in_leaf()
+
+    bounding_volume_hierarchy m_hierarchy;
+
+    // the spheres in the leaf order of m_hierarchy
+    std::vector<float> m_center_x;
+    std::vector<float> m_center_y;
+    std::vector<float> m_center_z;
+    std::vector<float> m_radius;
+
+    // the running sums of the spheres' areas, which sample_surface() searches
+    std::vector<float> m_cumulative_area;
+}; // end sphere_set
+
+
+} // end igloo
+
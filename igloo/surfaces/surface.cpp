@@ -1,15 +1,152 @@
 #include <igloo/surfaces/surface.hpp>
+#include <numeric>
 
 namespace igloo
 {
 
 
+optional<hit> surface::find_hit(const ray& r) const
+{
+  auto inter = intersect(r);
+  if(inter)
+  {
+    return hit{0, 0, inter->ray_parameter(), float2(0.f)};
+  }
+
+  return nullopt;
+} // end surface::find_hit()
+
+
+differential_geometry surface::differential_geometry_at(const ray& r, const hit& h) const
+{
+  ray nearer(r);
+  nearer.end(h.ray_parameter);
+
+  return intersect(nearer).value().differential_geometry();
+} // end surface::differential_geometry_at()
+
+
+bounding_box surface::bounds() const
+{
+  triangle_mesh mesh = triangulate();
+
+  return std::accumulate(mesh.points_begin(), mesh.points_end(), bounding_box());
+} // end surface::bounds()
+
+
 bool surface::is_intersected(const ray& r) const
 {
   return static_cast<bool>(intersect(r));
 } // end surface::is_intersected()
 
 
+optional<std::uint32_t> surface::find_occluder(const ray& r) const
+{
+  return is_intersected(r) ? optional<std::uint32_t>(0) : nullopt;
+} // end surface::find_occluder()
+
+
+bool surface::is_element_intersected(const ray& r, std::uint32_t) const
+{
+  return is_intersected(r);
+} // end surface::is_element_intersected()
+
+
+ray_packet::mask_type surface::find_hits(ray_packet& packet, ray_packet::mask_type mask, hit* hits) const
+{
+  ray_packet::mask_type result = 0;
+
+  ray_packet::for_each_lane(mask, [&](std::size_t lane)
+  {
+    auto h = find_hit(packet[lane]);
+    if(h && h->ray_parameter < packet.end(lane))
+    {
+      hits[lane] = *h;
+      packet.end(lane, h->ray_parameter);
+      result |= ray_packet::mask_type(1) << lane;
+    }
+  });
+
+  return result;
+} // end surface::find_hits()
+
+
+ray_packet::mask_type surface::are_intersected(const ray_packet& packet, ray_packet::mask_type mask) const
+{
+  ray_packet::mask_type result = 0;
+
+  ray_packet::for_each_lane(mask, [&](std::size_t lane)
+  {
+    if(is_intersected(packet[lane]))
+    {
+      result |= ray_packet::mask_type(1) << lane;
+    }
+  });
+
+  return result;
+} // end surface::are_intersected()
+
+
+ray_packet::mask_type surface::find_occluders(const ray_packet& packet, ray_packet::mask_type mask, std::uint32_t* elements) const
+{
+  ray_packet::mask_type result = 0;
+
+  ray_packet::for_each_lane(mask, [&](std::size_t lane)
+  {
+    auto element = find_occluder(packet[lane]);
+    if(element)
+    {
+      elements[lane] = *element;
+      result |= ray_packet::mask_type(1) << lane;
+    }
+  });
+
+  return result;
+} // end surface::find_occluders()
+
+
+void surface::find_hits(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<hit> hits) const
+{
+  for(ray_stream::index_type i : indices)
+  {
+    auto h = find_hit(stream[i]);
+    if(h && h->ray_parameter < stream.end(i))
+    {
+      hits[i] = *h;
+      stream.end(i, h->ray_parameter);
+    }
+  }
+} // end surface::find_hits()
+
+
+void surface::are_intersected(ray_stream& stream, array_ref<const ray_stream::index_type> indices) const
+{
+  for(ray_stream::index_type i : indices)
+  {
+    if(!stream.is_retired(i) && is_intersected(stream[i]))
+    {
+      stream.retire(i);
+    }
+  }
+} // end surface::are_intersected()
+
+
+void surface::find_occluders(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<std::uint32_t> elements) const
+{
+  for(ray_stream::index_type i : indices)
+  {
+    if(stream.is_retired(i)) continue;
+
+    auto element = find_occluder(stream[i]);
+    if(element)
+    {
+      elements[i] = *element;
+      stream.retire(i);
+    }
+  }
+} // end surface::find_occluders()
+
+
 float surface::pdf(const differential_geometry&) const
 {
   // we assume that all surface_primitives sample their surface area uniformly
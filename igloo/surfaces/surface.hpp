@@ -1,8 +1,12 @@
 #pragma once
 
 #include <igloo/geometry/triangle_mesh.hpp>
+#include <igloo/geometry/bounding_box.hpp>
+#include <igloo/geometry/ray_packet.hpp>
+#include <igloo/geometry/ray_stream.hpp>
 #include <igloo/geometry/differential_geometry.hpp>
 #include <igloo/surfaces/intersection.hpp>
+#include <igloo/surfaces/hit.hpp>
 #include <igloo/utility/optional.hpp>
 
 namespace igloo
@@ -22,6 +26,22 @@ class surface
      */
     virtual optional<intersection> intersect(const ray &r) const = 0;
 
+    /*! Tests for intersection between a ray and this surface and returns a compact record of the nearest intersection.
+     *  Unlike intersect(), this need not compute the differential_geometry at the intersection.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists, otherwise a hit whose primitive is 0.
+     *  \note The default implementation calls intersect() and discards the differential_geometry.
+     */
+    virtual optional<hit> find_hit(const ray &r) const;
+
+    /*! Computes the differential_geometry at an intersection previously found by find_hit().
+     *  \param r The ray which produced h.
+     *  \param h A hit returned by find_hit(r).
+     *  \return The differential_geometry of this surface at h.
+     *  \note The default implementation repeats intersect() over the ray's interval up to h.
+     */
+    virtual differential_geometry differential_geometry_at(const ray &r, const hit &h) const;
+
     /*! \return A triangle_mesh approximating this surface.
      */
     virtual triangle_mesh triangulate() const = 0;
@@ -34,10 +54,82 @@ class surface
      */
     virtual differential_geometry sample_surface(std::uint64_t u0, std::uint64_t u1) const = 0;
 
+    /*! \return A bounding_box bounding this surface.
+     */
+    virtual bounding_box bounds() const;
+
     /*! \return true if the given ray is intersected by this surface.
      */
     virtual bool is_intersected(const ray& r) const;
 
+    /*! Finds an element of this surface which a ray intersects, such as a triangle of a mesh.
+     *  Like is_intersected(), this may stop at the first intersection found, which need not be the nearest.
+     *  \param r The ray of interest.
+     *  \return nullopt if no intersection exists; otherwise, the element of an intersection, as in the element of a hit.
+     *  \note The default implementation calls is_intersected() and treats this surface as a single element 0.
+     */
+    virtual optional<std::uint32_t> find_occluder(const ray& r) const;
+
+    /*! Tests whether a ray intersects a single element of this surface, previously returned by find_occluder().
+     *  \param r The ray of interest.
+     *  \param element The element of interest.
+     *  \return true if r intersects element; false, otherwise.
+     *  \note The default implementation calls is_intersected().
+     */
+    virtual bool is_element_intersected(const ray& r, std::uint32_t element) const;
+
+    /*! Finds the nearest hit of each of a packet's rays with this surface.
+     *  \param packet The rays of interest. The end of each ray's interval is shortened to its hit, if any.
+     *  \param mask The lanes of packet to intersect.
+     *  \param hits For each lane of the result, a hit whose primitive is 0; other lanes are unchanged.
+     *  \return The lanes of mask whose rays hit this surface nearer than the end of their intervals.
+     *  \note The default implementation calls find_hit() for each lane.
+     */
+    virtual ray_packet::mask_type find_hits(ray_packet& packet, ray_packet::mask_type mask, hit* hits) const;
+
+    /*! Tests which of a packet's rays intersect this surface.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to test.
+     *  \return The lanes of mask whose rays intersect this surface.
+     *  \note The default implementation calls is_intersected() for each lane.
+     */
+    virtual ray_packet::mask_type are_intersected(const ray_packet& packet, ray_packet::mask_type mask) const;
+
+    /*! Finds an element of this surface which each of a packet's rays intersects.
+     *  \param packet The rays of interest.
+     *  \param mask The lanes of packet to test.
+     *  \param elements For each lane of the result, the element of an intersection, as returned by find_occluder();
+     *                  other lanes are unchanged.
+     *  \return The lanes of mask whose rays intersect this surface.
+     *  \note The default implementation calls find_occluder() for each lane.
+     */
+    virtual ray_packet::mask_type find_occluders(const ray_packet& packet, ray_packet::mask_type mask, std::uint32_t* elements) const;
+
+    /*! Finds the nearest hit of each of a stream's rays with this surface.
+     *  \param stream The rays of interest. The end of each ray's interval is shortened to its hit, if any.
+     *  \param indices The indices of the rays of stream to intersect.
+     *  \param hits An array of stream.size() elements; hits[i] receives a hit whose primitive is 0 if the ray with index i
+     *              hits this surface nearer than the end of its interval, and is otherwise unchanged.
+     *  \note The default implementation calls find_hit() for each ray.
+     */
+    virtual void find_hits(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<hit> hits) const;
+
+    /*! Tests which of a stream's rays intersect this surface.
+     *  \param stream The rays of interest. Each ray which intersects this surface is retired.
+     *  \param indices The indices of the rays of stream to test.
+     *  \note The default implementation calls is_intersected() for each ray.
+     */
+    virtual void are_intersected(ray_stream& stream, array_ref<const ray_stream::index_type> indices) const;
+
+    /*! Finds an element of this surface which each of a stream's rays intersects.
+     *  \param stream The rays of interest. Each ray which intersects this surface is retired.
+     *  \param indices The indices of the rays of stream to test.
+     *  \param elements An array of stream.size() elements; elements[i] receives the element of an intersection,
+     *                  as returned by find_occluder(), if the ray with index i is retired, and is otherwise unchanged.
+     *  \note The default implementation calls find_occluder() for each ray.
+     */
+    virtual void find_occluders(ray_stream& stream, array_ref<const ray_stream::index_type> indices, array_ref<std::uint32_t> elements) const;
+
     /*! \return The value of the probability density function at the given surface point.
      */
     virtual float pdf(const differential_geometry& dg) const;
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <vector>
 #include <map>
+#include <utility>
 
 namespace igloo
 {
@@ -31,48 +34,54 @@ class alias_table
 
       mean_weight = sum_of_weights / n;
 
-      // mark all entries greater than the mean
-      std::vector<std::reference_wrapper<table_entry>> rich;
-      for(auto& entry : table_)
+      // split the entries into those below the mean and those at or above it
+      std::vector<size_t> poor, rich;
+      for(size_t i = 0; i < table_.size(); ++i)
       {
-        if(entry.divide > mean_weight)
+        if(table_[i].divide < mean_weight)
+        {
+          poor.push_back(i);
+        }
+        else
         {
-          rich.push_back(entry);
+          rich.push_back(i);
         }
       }
 
-      // steal from the rich
-      for(auto& entry : table_)
+      // fill each poor entry up to the mean with weight stolen from a rich entry,
+      // which may leave the victim poor in turn
+      while(!poor.empty() && !rich.empty())
       {
-        float difference = mean_weight - entry.divide;
-        if(difference > 0)
+        table_entry& entry = table_[poor.back()];
+        poor.pop_back();
+
+        table_entry& victim = table_[rich.back()];
+
+        // set the alias to point to the victim
+        entry.alias = victim.value;
+        entry.alias_probability = victim.value_probability;
+
+        // steal from the victim
+        victim.divide -= mean_weight - entry.divide;
+
+        // did the victim become poor?
+        if(victim.divide < mean_weight)
         {
-          if(rich.size() > 0)
-          {
-            // steal from the first rich entry
-            table_entry& victim = rich.back();
-
-            // set the alias to point to the victim
-            entry.alias = victim.value;
-            entry.alias_probability = victim.value_probability;
-
-            // steal from the victim
-            victim.divide -= difference;
-
-            // did the victim become poor?
-            if(victim.divide <= mean_weight)
-            {
-              rich.pop_back();
-            }
-          }
-          else
-          {
-            // this case may occur due to floating point error
-            // when difference ~ 0
-            // fear not, it will still work
-          }
-        } // end if
-      } // end for each entry
+          poor.push_back(rich.back());
+          rich.pop_back();
+        }
+      }
+
+      // whatever remains on either list is within floating point error of the mean, so never selects its alias
+      for(size_t i : poor)
+      {
+        table_[i].divide = mean_weight;
+      }
+
+      for(size_t i : rich)
+      {
+        table_[i].divide = mean_weight;
+      }
 
       float inv_mean_weight = 1.f / mean_weight;
       float inv_sum_of_weights = 1.f / sum_of_weights;
@@ -100,7 +109,7 @@ class alias_table
     std::pair<Iterator,float> operator()(float u) const
     {
       float q = float(table_.size()) * u;
-      size_t index_of_selected_entry = static_cast<size_t>(q);
+      size_t index_of_selected_entry = std::min(static_cast<size_t>(q), table_.size() - 1);
       float u1 = q - index_of_selected_entry;
       const auto& selected_entry = table_[index_of_selected_entry];
 
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace igloo
+{
+
+
+/*! An aligned_allocator is a standard allocator whose allocations begin on a multiple of Alignment bytes,
+ *  e.g. on a cache line, which std::allocator does not guarantee for over-aligned types before C++17.
+ */
+template<class T, std::size_t Alignment = 64>
+class aligned_allocator
+{
+  public:
+    using value_type = T;
+
+    template<class U>
+    struct rebind
+    {
+      using other = aligned_allocator<U,Alignment>;
+    };
+
+    aligned_allocator() = default;
+
+    template<class U>
+    aligned_allocator(const aligned_allocator<U,Alignment>&) {}
+
+    T* allocate(std::size_t n)
+    {
+      void* result = nullptr;
+      if(posix_memalign(&result, Alignment, n * sizeof(T)) != 0)
+      {
+        throw std::bad_alloc();
+      }
+
+      return static_cast<T*>(result);
+    }
+
+    void deallocate(T* ptr, std::size_t)
+    {
+      std::free(ptr);
+    }
+};
+
+
+template<class T, class U, std::size_t Alignment>
+bool operator==(const aligned_allocator<T,Alignment>&, const aligned_allocator<U,Alignment>&)
+{
+  return true;
+}
+
+
+template<class T, class U, std::size_t Alignment>
+bool operator!=(const aligned_allocator<T,Alignment>&, const aligned_allocator<U,Alignment>&)
+{
+  return false;
+}
+
+
+} // end igloo
+
@@ -26,6 +26,8 @@ template<typename T>
 
     constexpr array_ref(const array_ref &other) : m_ptr(other.m_ptr), m_size(other.m_size) {}
 
+    array_ref &operator=(const array_ref &other) = default;
+
     constexpr array_ref(pointer array, size_type length) : m_ptr(array), m_size(length) {}
 
     template<typename U>
@@ -88,7 +90,7 @@ template<typename T>
 
     constexpr iterator end() const
     {
-      return end() + size();
+      return begin() + size();
     }
 
     reverse_iterator rbegin() const
@@ -108,7 +110,7 @@ template<typename T>
 
     constexpr bool empty() const
     {
-      return m_size != 0;
+      return m_size == 0;
     }
 
     constexpr reference operator[](size_type i) const
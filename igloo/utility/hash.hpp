@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace igloo
+{
+
+
+/*! Hashes a range of bytes, eight at a time.
+ *  \param data The bytes to hash.
+ *  \param size The number of bytes to hash.
+ *  \param seed The hash to continue from, e.g. the result of hashing a previous range.
+ *  \return A 64-bit hash of the bytes.
+ *  \note This is not a cryptographic hash.
+ */
+inline std::uint64_t hash_bytes(const void *data, std::size_t size, std::uint64_t seed = 0xcbf29ce484222325ull)
+{
+  const unsigned char *bytes = static_cast<const unsigned char*>(data);
+
+  auto mix = [](std::uint64_t h, std::uint64_t word)
+  {
+    h ^= word;
+    h *= 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+  };
+
+  std::uint64_t result = mix(seed, size);
+
+  std::size_t i = 0;
+  for(; i + 8 <= size; i += 8)
+  {
+    std::uint64_t word;
+    std::memcpy(&word, bytes + i, 8);
+    result = mix(result, word);
+  }
+
+  if(i < size)
+  {
+    std::uint64_t word = 0;
+    std::memcpy(&word, bytes + i, size - i);
+    result = mix(result, word);
+  }
+
+  return result;
+} // end hash_bytes()
+
+
+} // end igloo
+
@@ -0,0 +1,73 @@
+#include <igloo/utility/mapped_file.hpp>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace igloo
+{
+
+
+mapped_file::mapped_file(const std::string &filename)
+  : m_data(nullptr),
+    m_size(0)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+  {
+    throw std::runtime_error("mapped_file ctor: couldn't open \"" + filename + "\"");
+  }
+
+  struct stat status;
+  if(fstat(fd, &status) < 0)
+  {
+    close(fd);
+    throw std::runtime_error("mapped_file ctor: couldn't stat \"" + filename + "\"");
+  }
+
+  m_size = static_cast<std::size_t>(status.st_size);
+
+  if(m_size > 0)
+  {
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(data == MAP_FAILED)
+    {
+      close(fd);
+      throw std::runtime_error("mapped_file ctor: couldn't map \"" + filename + "\"");
+    }
+
+    m_data = data;
+  }
+
+  // the mapping remains valid after its descriptor is closed
+  close(fd);
+} // end mapped_file::mapped_file()
+
+
+mapped_file::~mapped_file()
+{
+  if(m_data)
+  {
+    munmap(m_data, m_size);
+  }
+} // end mapped_file::~mapped_file()
+
+
+void mapped_file::release(std::size_t offset, std::size_t size) const
+{
+  const std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+  // only release the pages no other range shares
+  std::size_t begin = (offset + page_size - 1) / page_size * page_size;
+  std::size_t end = (offset + size) / page_size * page_size;
+
+  if(m_data && begin < end)
+  {
+    madvise(static_cast<char*>(m_data) + begin, end - begin, MADV_DONTNEED);
+  }
+} // end mapped_file::release()
+
+
+} // end igloo
+
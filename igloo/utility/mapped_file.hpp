@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+namespace igloo
+{
+
+
+/*! A mapped_file maps the contents of a file into memory read-only.
+ *  Pages are loaded on demand and shared by every process mapping the same file.
+ */
+class mapped_file
+{
+  public:
+    /*! Maps a file.
+     *  \param filename The name of the file to map.
+     *  \throws std::runtime_error if the file cannot be opened or mapped.
+     */
+    explicit mapped_file(const std::string &filename);
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    /*! Unmaps the file.
+     */
+    ~mapped_file();
+
+    /*! \return A pointer to the first byte of the file's contents.
+     */
+    inline const void *data() const
+    {
+      return m_data;
+    } // end data()
+
+    /*! \return The size of the file in bytes.
+     */
+    inline std::size_t size() const
+    {
+      return m_size;
+    } // end size()
+
+    /*! Advises the system that a range of the file's contents will not be read again soon, so that the physical pages
+     *  lying wholly within it may be reclaimed. The contents remain readable, and are paged in again on demand.
+     *  \param offset The position of the first byte of the range.
+     *  \param size The number of bytes of the range.
+     */
+    void release(std::size_t offset, std::size_t size) const;
+
+  private:
+    void *m_data;
+    std::size_t m_size;
+}; // end mapped_file
+
+
+} // end igloo
+
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <igloo/utility/clamp.hpp>
+#include <dependencies/distribution2d/distribution2d/unit_interval_distribution.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace igloo
+{
+
+
+/*! Selects an element in proportion to its weight, e.g. a part of a surface in proportion to its area.
+ *  \param cumulative_weights The running sums of the elements' weights, which must not be empty.
+ *  \param u A uniform random variable.
+ *  \return The position of the selected element, and the part of u which the selection leaves over,
+ *          rescaled to a uniform random variable with which to sample the selected element.
+ */
+inline std::pair<std::size_t,std::uint64_t> select_by_cumulative_weight(const std::vector<float> &cumulative_weights, std::uint64_t u)
+{
+  float x = dist2d::unit_interval_distribution<>()(u) * cumulative_weights.back();
+
+  std::size_t i = std::upper_bound(cumulative_weights.begin(), cumulative_weights.end(), x) - cumulative_weights.begin();
+
+  // x rounded up to the total weight, so select the last element with any weight
+  if(i == cumulative_weights.size())
+  {
+    i = std::lower_bound(cumulative_weights.begin(), cumulative_weights.end(), x) - cumulative_weights.begin();
+  }
+
+  // rescale x's position within the selected element's weight to [0,1)
+  float begin = i > 0 ? cumulative_weights[i-1] : 0.f;
+  float weight = cumulative_weights[i] - begin;
+  float rest = weight > 0 ? clamp((x - begin) / weight, 0.f, std::nextafter(1.f, 0.f)) : 0.f;
+
+  return std::make_pair(i, static_cast<std::uint64_t>(std::ldexp(rest, 64)));
+} // end select_by_cumulative_weight()
+
+
+} // end igloo
+
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <igloo/utility/aligned_allocator.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace igloo
+{
+
+
+/*! A work_stealing_scheduler runs batches of independent tasks over a fixed pool of worker threads,
+ *  which it starts once and keeps waiting between batches.
+ *  Each worker begins a batch with a contiguous range of the tasks, which it runs in order, so neighboring tasks,
+ *  such as neighboring tiles of an image, tend to run on the same worker. A worker whose range is exhausted
+ *  steals the later half of the remaining range of another worker, so that workers finish together even when
+ *  the tasks' costs vary widely.
+ */
+class work_stealing_scheduler
+{
+  public:
+    /*! Creates a new work_stealing_scheduler and starts its worker threads.
+     *  \param num_threads The number of worker threads, including the thread calling for_each(); 0 uses every hardware thread.
+     *  \throws std::system_error if a thread cannot be started, after joining the threads already started.
+     */
+    inline explicit work_stealing_scheduler(std::size_t num_threads = 0)
+      : m_num_workers(num_threads ? num_threads : std::max<std::size_t>(std::thread::hardware_concurrency(), 1)),
+        m_batch(0),
+        m_batch_size(0),
+        m_num_running(0),
+        m_work(nullptr),
+        m_run(nullptr),
+        m_is_stopping(false)
+    {
+      m_threads.reserve(m_num_workers - 1);
+
+      try
+      {
+        for(std::size_t w = 1; w < m_num_workers; ++w)
+        {
+          m_threads.emplace_back(&work_stealing_scheduler::wait_for_work, this, w);
+        }
+      }
+      catch(...)
+      {
+        stop();
+        throw;
+      }
+    }
+
+    /*! Stops and joins the worker threads.
+     */
+    inline ~work_stealing_scheduler()
+    {
+      stop();
+    }
+
+    work_stealing_scheduler(const work_stealing_scheduler&) = delete;
+    work_stealing_scheduler& operator=(const work_stealing_scheduler&) = delete;
+
+    /*! \return The number of workers of this work_stealing_scheduler.
+     */
+    inline std::size_t num_workers() const
+    {
+      return m_num_workers;
+    } // end num_workers()
+
+    /*! Calls f(worker, task) for each task in [0, num_tasks), and returns once every call has returned.
+     *  Calls with the same worker are made by the same thread, one at a time, so f may use state private to each worker.
+     *  The calling thread serves as worker 0. Calls of for_each() from several threads run one after another,
+     *  and f must not call for_each() itself.
+     *  \param num_tasks The number of tasks.
+     *  \param f The function to call for each task.
+     *  \throws Any exception thrown by f, after every worker has stopped. Once f throws, workers start no further tasks.
+     */
+    template<class Function>
+    inline void for_each(std::size_t num_tasks, Function f)
+    {
+      std::lock_guard<std::mutex> batch_lock(m_for_each_mutex);
+
+      std::size_t num_workers = std::min(m_num_workers, std::max<std::size_t>(num_tasks, 1));
+
+      std::vector<task_range, aligned_allocator<task_range>> ranges(num_workers);
+      for(std::size_t w = 0; w < num_workers; ++w)
+      {
+        ranges[w].begin = num_tasks * w / num_workers;
+        ranges[w].end   = num_tasks * (w + 1) / num_workers;
+      }
+
+      std::vector<std::exception_ptr> errors(num_workers);
+
+      // set once any call of f throws, so that every worker stops
+      std::atomic<bool> has_failed(false);
+
+      auto work = [&](std::size_t w)
+      {
+        try
+        {
+          std::size_t task;
+          while(!has_failed && (pop(ranges[w], task) || steal(ranges, w, task)))
+          {
+            f(w, task);
+          }
+        }
+        catch(...)
+        {
+          errors[w] = std::current_exception();
+          has_failed = true;
+        }
+      };
+
+      // hand the batch to the pool's threads
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_work = &work;
+        m_run = &run<decltype(work)>;
+        m_batch_size = num_workers;
+        m_num_running = num_workers - 1;
+        ++m_batch;
+      }
+      m_batch_started.notify_all();
+
+      work(0);
+
+      // wait for the other workers of the batch, which are done with work once they report
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_batch_finished.wait(lock, [this]{ return m_num_running == 0; });
+        m_work = nullptr;
+        m_run = nullptr;
+      }
+
+      for(const std::exception_ptr& e : errors)
+      {
+        if(e) std::rethrow_exception(e);
+      }
+    } // end for_each()
+
+  private:
+    // the tasks a worker has yet to run, on a cache line of its own
+    struct alignas(64) task_range
+    {
+      std::mutex mutex;
+      std::size_t begin = 0;
+      std::size_t end = 0;
+    };
+
+    // calls the work of the current batch, whose type for_each() erased
+    template<class Work>
+    static inline void run(void* work, std::size_t w)
+    {
+      (*static_cast<Work*>(work))(w);
+    } // end run()
+
+    // the loop of the thread of worker w, which runs its part of each batch in which it takes part
+    inline void wait_for_work(std::size_t w)
+    {
+      std::size_t last_batch = 0;
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while(true)
+      {
+        m_batch_started.wait(lock, [&]{ return m_is_stopping || m_batch != last_batch; });
+
+        if(m_is_stopping) return;
+
+        last_batch = m_batch;
+
+        // batches with fewer tasks than workers leave the last workers idle
+        if(w >= m_batch_size) continue;
+
+        void* work = m_work;
+        void (*run_work)(void*, std::size_t) = m_run;
+
+        lock.unlock();
+        run_work(work, w);
+        lock.lock();
+
+        if(--m_num_running == 0)
+        {
+          m_batch_finished.notify_one();
+        }
+      }
+    } // end wait_for_work()
+
+    // stops and joins the threads of the pool
+    inline void stop()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_is_stopping = true;
+      }
+      m_batch_started.notify_all();
+
+      for(std::thread& t : m_threads)
+      {
+        t.join();
+      }
+
+      m_threads.clear();
+    } // end stop()
+
+    // takes the next task of a worker's own range
+    static inline bool pop(task_range& range, std::size_t& task)
+    {
+      std::lock_guard<std::mutex> lock(range.mutex);
+
+      if(range.begin == range.end) return false;
+
+      task = range.begin++;
+      return true;
+    } // end pop()
+
+    // moves the later half, rounded up, of another worker's range to worker w's range, and takes its first task
+    template<class TaskRanges>
+    static inline bool steal(TaskRanges& ranges, std::size_t w, std::size_t& task)
+    {
+      for(std::size_t i = 1; i < ranges.size(); ++i)
+      {
+        task_range& victim = ranges[(w + i) % ranges.size()];
+
+        std::size_t begin, end;
+        {
+          std::lock_guard<std::mutex> lock(victim.mutex);
+
+          if(victim.begin == victim.end) continue;
+
+          begin = victim.begin + (victim.end - victim.begin) / 2;
+          end = victim.end;
+          victim.end = begin;
+        }
+
+        std::lock_guard<std::mutex> lock(ranges[w].mutex);
+        ranges[w].begin = begin + 1;
+        ranges[w].end = end;
+
+        task = begin;
+        return true;
+      }
+
+      return false;
+    } // end steal()
+
+    std::size_t m_num_workers;
+
+    // the threads of workers 1 through m_num_workers - 1
+    std::vector<std::thread> m_threads;
+
+    // serializes calls of for_each()
+    std::mutex m_for_each_mutex;
+
+    // guards the state of the current batch below, which the pool's threads wait on
+    std::mutex m_mutex;
+    std::condition_variable m_batch_started;
+    std::condition_variable m_batch_finished;
+
+    // counts the batches begun by for_each()
+    std::size_t m_batch;
+
+    // the number of workers taking part in the current batch
+    std::size_t m_batch_size;
+
+    // the number of the pool's threads which have yet to finish the current batch
+    std::size_t m_num_running;
+
+    void* m_work;
+    void (*m_run)(void*, std::size_t);
+
+    bool m_is_stopping;
+}; // end work_stealing_scheduler
+
+
+} // end igloo
+
@@ -0,0 +1,310 @@
+#include "test.hpp"
+#include <igloo/geometry/triangle_mesh.hpp>
+#include <igloo/geometry/ray_packet.hpp>
+#include <igloo/geometry/ray_stream.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace igloo
+{
+namespace test
+{
+namespace
+{
+
+
+bool same_ray_parameter(const optional<float> &a, const optional<float> &b)
+{
+  return bool(a) == bool(b) && (!a || std::abs(*a - *b) <= 1e-5f * std::max(1.f, std::abs(*b)));
+} // end same_ray_parameter()
+
+
+// counts the disagreements of m's single ray, packet, and stream queries with testing each of m's triangles
+std::size_t count_mismatches(const triangle_mesh &m, const std::vector<ray> &rays)
+{
+  std::size_t result = 0;
+
+  std::vector<optional<float>> expected;
+  for(const ray& r : rays)
+  {
+    expected.push_back(brute_force_ray_parameter(m, r));
+  }
+
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    auto x = m.intersect(rays[i]);
+    result += !same_ray_parameter(x ? optional<float>(std::get<1>(*x)) : nullopt, expected[i]);
+
+    result += m.is_intersected(rays[i]) != bool(expected[i]);
+
+    auto tri = m.find_intersected(rays[i]);
+    result += bool(tri) != bool(expected[i]) || (tri && !m.intersect(rays[i], **tri));
+  }
+
+  for(std::size_t first = 0; first < rays.size(); first += ray_packet::max_size)
+  {
+    ray_packet packet;
+    for(std::size_t i = first; i < std::min(first + ray_packet::max_size, rays.size()); ++i)
+    {
+      packet.push_back(rays[i]);
+    }
+
+    ray_packet nearer(packet);
+    std::tuple<triangle_mesh::triangle_iterator,float,triangle_mesh::barycentric> hits[ray_packet::max_size];
+    ray_packet::mask_type hit_mask = m.intersect(nearer, nearer.lanes(), hits);
+
+    ray_packet::mask_type occluded = m.is_intersected(packet, packet.lanes());
+
+    triangle_mesh::triangle_iterator occluders[ray_packet::max_size];
+    ray_packet::mask_type found = m.find_intersected(packet, packet.lanes(), [&](std::size_t lane, triangle_mesh::triangle_iterator tri)
+    {
+      occluders[lane] = tri;
+    });
+
+    for(std::size_t lane = 0; lane < packet.size(); ++lane)
+    {
+      const optional<float>& e = expected[first + lane];
+      bool is_hit = (hit_mask >> lane) & 1;
+
+      result += !same_ray_parameter(is_hit ? optional<float>(std::get<1>(hits[lane])) : nullopt, e);
+      result += bool((occluded >> lane) & 1) != bool(e);
+      result += bool((found >> lane) & 1) != bool(e) || (((found >> lane) & 1) && !m.intersect(packet[lane], *occluders[lane]));
+    }
+  }
+
+  ray_stream stream(rays), occlusion_stream(rays), occluder_stream(rays);
+  std::vector<ray_stream::index_type> indices = stream.sorted_indices(m.bounding_box());
+
+  std::vector<optional<float>> nearest(rays.size());
+  m.intersect(stream, indices, [&](ray_stream::index_type i, triangle_mesh::triangle_iterator, float t, const triangle_mesh::barycentric&)
+  {
+    nearest[i] = t;
+  });
+
+  m.is_intersected(occlusion_stream, indices);
+
+  std::vector<optional<triangle_mesh::triangle_iterator>> occluders(rays.size());
+  m.find_intersected(occluder_stream, indices, [&](ray_stream::index_type i, triangle_mesh::triangle_iterator tri)
+  {
+    occluders[i] = tri;
+  });
+
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    result += !same_ray_parameter(nearest[i], expected[i]);
+    result += occlusion_stream.is_retired(i) != bool(expected[i]);
+    result += occluder_stream.is_retired(i) != bool(expected[i]) || bool(occluders[i]) != bool(expected[i]);
+    result += occluders[i] && !m.intersect(rays[i], **occluders[i]);
+  }
+
+  return result;
+} // end count_mismatches()
+
+
+// checks each hierarchy width, quantization, leaf layout, and split method against testing each triangle,
+// before and after moving the triangles' points
+void test_traversal()
+{
+  std::mt19937 rng(13);
+
+  std::vector<point> points;
+  std::vector<uint3> triangles;
+  random_triangles(rng, 1500, 1.f, points, triangles);
+
+  std::vector<point> moved(points);
+  for(point& p : moved)
+  {
+    p = p + vector(0.1f * p.y, 0.05f, 0.f);
+  }
+
+  std::vector<ray> rays = random_rays(rng, 300, 1.2f);
+
+  for(std::size_t width : {2, 4, 8})
+  {
+    for(std::size_t quantization_bits : {0, 8, 16})
+    {
+      if(width == 2 && quantization_bits != 0) continue;
+
+      for(bool precompute_leaves : {false, true})
+      {
+        for(auto method : {bounding_volume_hierarchy_options::split_method::binned_sah, bounding_volume_hierarchy_options::split_method::spatial})
+        {
+          bounding_volume_hierarchy_options options;
+          options.width = width;
+          options.quantization_bits = quantization_bits;
+          options.precompute_leaves = precompute_leaves;
+          options.method = method;
+
+          triangle_mesh m(points, triangles, options);
+          IGLOO_CHECK(count_mismatches(m, rays) == 0);
+
+          // refit
+          m.update_points(moved);
+          IGLOO_CHECK(count_mismatches(m, rays) == 0);
+
+          m.update_points(points);
+          IGLOO_CHECK(count_mismatches(m, rays) == 0);
+        }
+      }
+    }
+  }
+} // end test_traversal()
+
+
+void test_empty_mesh()
+{
+  std::mt19937 rng(17);
+  std::vector<ray> rays = random_rays(rng, 40, 1.f);
+
+  for(std::size_t width : {2, 4, 8})
+  {
+    bounding_volume_hierarchy_options options;
+    options.width = width;
+
+    triangle_mesh m(std::vector<point>(), std::vector<uint3>(), options);
+    IGLOO_CHECK(count_mismatches(m, rays) == 0);
+  }
+} // end test_empty_mesh()
+
+
+void test_invalid_options()
+{
+  std::vector<point> points = {point(0,0,0), point(1,0,0), point(0,1,0)};
+  std::vector<uint3> triangles = {uint3(0,1,2)};
+
+  auto make_mesh = [&](std::size_t width, std::size_t quantization_bits)
+  {
+    return [=]
+    {
+      bounding_volume_hierarchy_options options;
+      options.width = width;
+      options.quantization_bits = quantization_bits;
+      triangle_mesh m(points, triangles, options);
+    };
+  };
+
+  IGLOO_CHECK(throws<std::logic_error>(make_mesh(3, 0)));
+  IGLOO_CHECK(throws<std::logic_error>(make_mesh(4, 4)));
+  IGLOO_CHECK(throws<std::logic_error>(make_mesh(2, 8)));
+  IGLOO_CHECK(!throws<std::logic_error>(make_mesh(8, 16)));
+} // end test_invalid_options()
+
+
+std::vector<char> read_file(const std::string &filename)
+{
+  std::ifstream is(filename, std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+} // end read_file()
+
+
+void write_file(const std::string &filename, const std::vector<char> &bytes)
+{
+  std::ofstream os(filename, std::ios::binary);
+  os.write(bytes.data(), bytes.size());
+} // end write_file()
+
+
+// returns the names of the files in a directory
+std::vector<std::string> files_in(const std::string &directory)
+{
+  std::vector<std::string> result;
+
+  DIR* d = opendir(directory.c_str());
+  while(dirent* entry = readdir(d))
+  {
+    std::string name = entry->d_name;
+    if(name != "." && name != "..")
+    {
+      result.push_back(directory + "/" + name);
+    }
+  }
+  closedir(d);
+
+  return result;
+} // end files_in()
+
+
+// checks that a cached hierarchy is mapped rather than rebuilt, and that a corrupt cache is rebuilt and replaced
+void test_cache()
+{
+  char directory_template[] = "/tmp/igloo_tests_XXXXXX";
+  std::string directory = mkdtemp(directory_template);
+
+  std::mt19937 rng(19);
+
+  std::vector<point> points;
+  std::vector<uint3> triangles;
+  random_triangles(rng, 2000, 1.f, points, triangles);
+
+  std::vector<ray> rays = random_rays(rng, 300, 1.2f);
+
+  for(std::size_t width : {2, 8})
+  {
+    bounding_volume_hierarchy_options options;
+    options.width = width;
+    options.quantization_bits = width == 2 ? 0 : 8;
+    options.cache_directory = directory;
+
+    {
+      triangle_mesh built(points, triangles, options);
+      IGLOO_CHECK(!built.hierarchy().is_mapped());
+    }
+
+    std::vector<std::string> files = files_in(directory);
+    IGLOO_CHECK(files.size() == 1);
+    if(files.size() != 1) return;
+
+    std::vector<char> intact = read_file(files[0]);
+
+    {
+      triangle_mesh mapped(points, triangles, options);
+      IGLOO_CHECK(mapped.hierarchy().is_mapped());
+      IGLOO_CHECK(count_mismatches(mapped, rays) == 0);
+    }
+
+    std::vector<char> flipped(intact);
+    flipped[flipped.size() / 2] ^= 0x5a;
+
+    std::vector<char> truncated(intact.begin(), intact.end() - 4);
+
+    for(const std::vector<char>& corrupt : {flipped, truncated, std::vector<char>()})
+    {
+      write_file(files[0], corrupt);
+
+      triangle_mesh rebuilt(points, triangles, options);
+      IGLOO_CHECK(!rebuilt.hierarchy().is_mapped());
+      IGLOO_CHECK(count_mismatches(rebuilt, rays) == 0);
+
+      // the corrupt file was replaced
+      IGLOO_CHECK(read_file(files[0]) == intact);
+    }
+
+    std::remove(files[0].c_str());
+  }
+
+  rmdir(directory.c_str());
+} // end test_cache()
+
+
+} // end namespace
+
+
+void test_hierarchies()
+{
+  test_traversal();
+  test_empty_mesh();
+  test_invalid_options();
+  test_cache();
+} // end test_hierarchies()
+
+
+} // end test
+} // end igloo
+
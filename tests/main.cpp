@@ -0,0 +1,22 @@
+#include "test.hpp"
+#include <iostream>
+
+int main()
+{
+  using namespace igloo::test;
+
+  test_hierarchies();
+  test_surfaces();
+  test_scenes();
+  test_sampling();
+
+  if(num_failures() > 0)
+  {
+    std::cerr << num_failures() << " checks failed" << std::endl;
+    return 1;
+  }
+
+  std::cout << "all checks passed" << std::endl;
+  return 0;
+}
+
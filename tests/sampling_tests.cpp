@@ -0,0 +1,113 @@
+#include "test.hpp"
+#include <igloo/utility/alias_table.hpp>
+#include <igloo/utility/select_by_cumulative_weight.hpp>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+
+namespace igloo
+{
+namespace test
+{
+namespace
+{
+
+
+// checks that an alias_table selects each value in proportion to its weight, and never one of zero weight
+void test_alias_table()
+{
+  std::vector<float> weights = {1.f, 0.f, 3.f, 0.5f, 0.f, 2.5f, 1.f};
+  float sum = std::accumulate(weights.begin(), weights.end(), 0.f);
+
+  std::vector<std::size_t> values(weights.size());
+  std::iota(values.begin(), values.end(), 0);
+
+  alias_table<std::vector<std::size_t>::const_iterator> table(values.cbegin(), values.cend(), [&](std::size_t i)
+  {
+    return weights[i];
+  });
+
+  float sum_of_probabilities = 0;
+  for(auto i = values.cbegin(); i != values.cend(); ++i)
+  {
+    IGLOO_CHECK(std::abs(table.probability_of(i) - weights[*i] / sum) < 1e-5f);
+    sum_of_probabilities += table.probability_of(i);
+  }
+  IGLOO_CHECK(std::abs(sum_of_probabilities - 1.f) < 1e-5f);
+
+  std::mt19937 rng(47);
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+
+  const int n = 200000;
+  std::vector<int> counts(weights.size());
+  std::size_t inconsistent = 0;
+  for(int i = 0; i < n; ++i)
+  {
+    auto selected = table(u(rng));
+    ++counts[*selected.first];
+
+    inconsistent += selected.second != table.probability_of(selected.first);
+  }
+  IGLOO_CHECK(inconsistent == 0);
+
+  for(std::size_t i = 0; i < weights.size(); ++i)
+  {
+    IGLOO_CHECK(std::abs(float(counts[i]) / n - weights[i] / sum) < 0.005f);
+    IGLOO_CHECK(weights[i] > 0 || counts[i] == 0);
+  }
+} // end test_alias_table()
+
+
+// checks that select_by_cumulative_weight() selects each element in proportion to its weight, never one of zero weight,
+// and leaves a remainder uniform over its range
+void test_select_by_cumulative_weight()
+{
+  std::vector<float> weights = {0.f, 2.f, 0.f, 0.f, 1.f, 5.f, 0.f};
+
+  std::vector<float> cumulative(weights.size());
+  std::partial_sum(weights.begin(), weights.end(), cumulative.begin());
+  float sum = cumulative.back();
+
+  std::mt19937_64 bits(53);
+
+  const int n = 200000;
+  const int num_bins = 8;
+  std::vector<int> counts(weights.size());
+  std::vector<int> remainder_counts(num_bins);
+  for(int i = 0; i < n; ++i)
+  {
+    auto selected = select_by_cumulative_weight(cumulative, bits());
+    ++counts[selected.first];
+    ++remainder_counts[selected.second >> 61];
+  }
+
+  for(std::size_t i = 0; i < weights.size(); ++i)
+  {
+    IGLOO_CHECK(std::abs(float(counts[i]) / n - weights[i] / sum) < 0.005f);
+    IGLOO_CHECK(weights[i] > 0 || counts[i] == 0);
+  }
+
+  for(int count : remainder_counts)
+  {
+    IGLOO_CHECK(std::abs(float(count) / n - 1.f / num_bins) < 0.005f);
+  }
+
+  // the extremes of the range select the first and last elements of nonzero weight
+  IGLOO_CHECK(select_by_cumulative_weight(cumulative, 0).first == 1);
+  IGLOO_CHECK(select_by_cumulative_weight(cumulative, ~std::uint64_t(0)).first == 5);
+} // end test_select_by_cumulative_weight()
+
+
+} // end namespace
+
+
+void test_sampling()
+{
+  test_alias_table();
+  test_select_by_cumulative_weight();
+} // end test_sampling()
+
+
+} // end test
+} // end igloo
+
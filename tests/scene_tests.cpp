@@ -0,0 +1,395 @@
+#include "test.hpp"
+#include <igloo/primitives/scene.hpp>
+#include <igloo/primitives/emitter_table.hpp>
+#include <igloo/primitives/occluder_cache.hpp>
+#include <igloo/surfaces/sphere.hpp>
+#include <igloo/surfaces/sphere_set.hpp>
+#include <igloo/surfaces/mesh.hpp>
+#include <igloo/surfaces/instance.hpp>
+#include <igloo/materials/matte.hpp>
+#include <igloo/materials/light.hpp>
+#include <igloo/geometry/ray_packet.hpp>
+#include <igloo/geometry/transform.hpp>
+#include <igloo/utility/array_ref.hpp>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+
+namespace igloo
+{
+namespace test
+{
+namespace
+{
+
+
+// returns the nearest hit of r with s's surfaces by testing each of them
+optional<hit> linear_find_hit(const scene &s, const ray &r)
+{
+  optional<hit> result;
+
+  for(std::size_t i = 0; i < s.size(); ++i)
+  {
+    auto h = s[i].find_hit(r);
+    if(h && (!result || h->ray_parameter < result->ray_parameter))
+    {
+      result = h;
+      result->primitive = static_cast<std::uint32_t>(i);
+    }
+  }
+
+  return result;
+} // end linear_find_hit()
+
+
+bool same_hit(const optional<hit> &a, const optional<hit> &b)
+{
+  return bool(a) == bool(b) && (!a || (a->primitive == b->primitive && std::abs(a->ray_parameter - b->ray_parameter) <= 1e-4f));
+} // end same_hit()
+
+
+bool is_occluder_of(const scene &s, const optional<occluder_cache::occluder> &o, const ray &r)
+{
+  return o && o->primitive < s.size() && s[o->primitive].is_element_intersected(r, o->element);
+} // end is_occluder_of()
+
+
+// returns n shadow rays from points in the cube [-extent, extent]^3 to just short of points on s's emitters,
+// and the position in s.emitters() of each ray's emitter
+std::vector<ray> shadow_rays(const scene &s, std::mt19937_64 &bits, std::size_t n, float extent, std::vector<std::uint32_t> &emitters)
+{
+  std::uniform_real_distribution<float> u(-1.f, 1.f);
+
+  std::vector<const surface_primitive*> targets;
+  for(const auto& e : s.emitters())
+  {
+    targets.push_back(&e);
+  }
+
+  std::vector<ray> result;
+  for(std::size_t i = 0; i < n; ++i)
+  {
+    // consecutive rays point toward the same emitter, as a renderer's would
+    std::uint32_t emitter = static_cast<std::uint32_t>((i / 16) % targets.size());
+
+    point o(extent * u(bits), extent * u(bits), extent * u(bits));
+    point target = targets[emitter]->sample_surface(bits(), bits()).point();
+
+    // stop short of the emitter's surface, whose own intersection rounding would decide
+    result.push_back(ray(o, o + 0.99f * (target - o)));
+    emitters.push_back(emitter);
+  }
+
+  return result;
+} // end shadow_rays()
+
+
+// counts the disagreements of s's single ray, packet, and stream queries with testing each of its surfaces
+std::size_t count_mismatches(const scene &s, const std::vector<ray> &rays)
+{
+  std::size_t result = 0;
+
+  std::vector<optional<hit>> expected;
+  for(const ray& r : rays)
+  {
+    expected.push_back(linear_find_hit(s, r));
+  }
+
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    result += !same_hit(s.find_hit(rays[i]), expected[i]);
+    result += bool(s.intersect(rays[i])) != bool(expected[i]);
+    result += s.is_intersected(rays[i]) != bool(expected[i]);
+
+    auto o = s.find_occluder(rays[i]);
+    result += bool(o) != bool(expected[i]) || (o && !is_occluder_of(s, o, rays[i]));
+  }
+
+  for(std::size_t first = 0; first < rays.size(); first += ray_packet::max_size)
+  {
+    ray_packet packet;
+    for(std::size_t i = first; i < std::min(first + ray_packet::max_size, rays.size()); ++i)
+    {
+      packet.push_back(rays[i]);
+    }
+
+    optional<hit> hits[ray_packet::max_size];
+    s.find_hits(packet, hits);
+
+    ray_packet::mask_type occluded = s.are_intersected(packet);
+
+    for(std::size_t lane = 0; lane < packet.size(); ++lane)
+    {
+      result += !same_hit(hits[lane], expected[first + lane]);
+      result += bool((occluded >> lane) & 1) != bool(expected[first + lane]);
+    }
+  }
+
+  std::vector<optional<hit>> hits(rays.size());
+  s.find_hits(rays, hits);
+
+  std::unique_ptr<bool[]> occluded(new bool[rays.size()]);
+  s.are_intersected(rays, array_ref<bool>(occluded.get(), rays.size()));
+
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    result += !same_hit(hits[i], expected[i]);
+    result += occluded[i] != bool(expected[i]);
+  }
+
+  return result;
+} // end count_mismatches()
+
+
+// counts the disagreements of s's occluder-cached shadow queries with testing each of its surfaces,
+// and the occluders cached which do not block a ray toward their emitter
+std::size_t count_cached_mismatches(const scene &s, const std::vector<ray> &rays, const std::vector<std::uint32_t> &emitters)
+{
+  std::size_t result = 0;
+
+  std::vector<bool> expected;
+  for(const ray& r : rays)
+  {
+    expected.push_back(bool(linear_find_hit(s, r)));
+  }
+
+  occluder_cache single;
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    result += s.is_intersected(rays[i], emitters[i], single) != expected[i];
+
+    // a blocked ray leaves its own occluder in the cache
+    result += expected[i] && !is_occluder_of(s, single[emitters[i]], rays[i]);
+  }
+  result += single.num_hits() == 0;
+
+  // packets of rays toward one emitter, as shadow_rays() groups them
+  occluder_cache packets;
+  for(std::size_t first = 0; first < rays.size(); first += 16)
+  {
+    ray_packet packet;
+    for(std::size_t i = first; i < std::min(first + 16, rays.size()); ++i)
+    {
+      packet.push_back(rays[i]);
+    }
+
+    ray_packet::mask_type occluded = s.are_intersected(packet, emitters[first], packets);
+
+    bool is_cached_valid = !packets[emitters[first]];
+    for(std::size_t lane = 0; lane < packet.size(); ++lane)
+    {
+      result += bool((occluded >> lane) & 1) != expected[first + lane];
+      is_cached_valid = is_cached_valid || is_occluder_of(s, packets[emitters[first]], packet[lane]);
+    }
+    result += !is_cached_valid;
+  }
+
+  occluder_cache stream;
+  std::unique_ptr<bool[]> occluded(new bool[rays.size()]);
+  s.are_intersected(rays, emitters, stream, array_ref<bool>(occluded.get(), rays.size()));
+
+  for(std::size_t i = 0; i < rays.size(); ++i)
+  {
+    result += occluded[i] != expected[i];
+  }
+
+  for(std::size_t emitter = 0; emitter < stream.size(); ++emitter)
+  {
+    bool is_cached_valid = !stream[emitter];
+    for(std::size_t i = 0; i < rays.size(); ++i)
+    {
+      is_cached_valid = is_cached_valid || (emitters[i] == emitter && is_occluder_of(s, stream[emitter], rays[i]));
+    }
+    result += !is_cached_valid;
+  }
+
+  return result;
+} // end count_cached_mismatches()
+
+
+std::unique_ptr<mesh> random_mesh(std::mt19937 &rng, std::size_t n, float extent, std::vector<point> &points)
+{
+  std::vector<uint3> triangles;
+  random_triangles(rng, n, extent, points, triangles);
+
+  return std::unique_ptr<mesh>(new mesh(points, triangles));
+} // end random_mesh()
+
+
+// checks a scene of meshes, spheres, a sphere_set, and an instance against testing each surface, before and after
+// editing it through handles
+void test_queries()
+{
+  std::mt19937 rng(37);
+  std::mt19937_64 bits(37);
+  std::uniform_real_distribution<float> u(-1.f, 1.f);
+
+  matte white(1, 1, 1);
+  light bright(color(4, 4, 4));
+  light dark(color(0, 0, 0));
+
+  scene s;
+
+  std::vector<point> deforming_points;
+  scene::handle deforming = s.add_surface(random_mesh(rng, 400, 1.f, deforming_points), white);
+
+  std::vector<point> points;
+  scene::handle moving = s.add_surface(random_mesh(rng, 300, 0.5f, points), white);
+
+  std::vector<point> prototype_points;
+  std::shared_ptr<mesh> prototype = random_mesh(rng, 200, 0.3f, prototype_points);
+  s.add_surface(std::unique_ptr<surface>(new instance(prototype, transform::translate(0.5f, 0.5f, 0.f))), white);
+
+  std::vector<point> centers;
+  std::vector<float> radii;
+  for(int i = 0; i < 50; ++i)
+  {
+    centers.push_back(point(u(rng), u(rng), u(rng)));
+    radii.push_back(0.02f);
+  }
+  s.add_surface(std::unique_ptr<surface>(new sphere_set(centers, radii)), white);
+
+  std::vector<scene::handle> spheres;
+  for(int i = 0; i < 40; ++i)
+  {
+    const material& m = i % 10 ? static_cast<const material&>(white) : bright;
+    spheres.push_back(s.add_surface(std::unique_ptr<surface>(new sphere(u(rng), u(rng), u(rng), 0.05f)), m));
+  }
+
+  // an emitter which emits nothing
+  s.add_surface(std::unique_ptr<surface>(new sphere(0.f, 0.f, 1.2f, 0.1f)), dark);
+
+  IGLOO_CHECK(!s.is_committed());
+  IGLOO_CHECK(throws<std::logic_error>([&]{ s.find_hit(ray(point(0,0,0), vector(0,0,1))); }));
+
+  s.commit();
+  IGLOO_CHECK(s.is_committed());
+  IGLOO_CHECK(s.emitters().size() == 5);
+
+  std::vector<ray> rays = random_rays(rng, 600, 1.5f);
+  IGLOO_CHECK(count_mismatches(s, rays) == 0);
+
+  std::vector<std::uint32_t> emitters;
+  std::vector<ray> shadows = shadow_rays(s, bits, 400, 1.5f, emitters);
+  IGLOO_CHECK(count_cached_mismatches(s, shadows, emitters) == 0);
+
+  // a few edits, which commit() records under the second hierarchy
+  std::vector<point> more_points;
+  scene::handle added = s.add_surface(random_mesh(rng, 100, 0.4f, more_points), white);
+  s.remove_surface(spheres[3]);
+  s.transform_surface(moving, transform::translate(0.2f, -0.3f, 0.1f));
+
+  for(point& p : deforming_points)
+  {
+    p = p + vector(0.f, 0.1f * p.x, 0.f);
+  }
+  s.update_points(deforming, deforming_points);
+
+  s.bind_material(spheres[5], bright);
+
+  IGLOO_CHECK(!s.is_committed());
+  IGLOO_CHECK(throws<std::logic_error>([&]{ s.is_intersected(rays[0]); }));
+  IGLOO_CHECK(throws<std::out_of_range>([&]{ s.index_of(spheres[3]); }));
+
+  s.commit();
+  IGLOO_CHECK(s.emitters().size() == 6);
+  IGLOO_CHECK(count_mismatches(s, rays) == 0);
+
+  emitters.clear();
+  shadows = shadow_rays(s, bits, 400, 1.5f, emitters);
+  IGLOO_CHECK(count_cached_mismatches(s, shadows, emitters) == 0);
+
+  // enough edits to rebuild the whole scene
+  s.remove_surface(added);
+  for(std::size_t i = 10; i < spheres.size(); ++i)
+  {
+    s.transform_surface(spheres[i], transform::translate(0.f, 0.f, 0.1f));
+  }
+
+  s.commit();
+  IGLOO_CHECK(count_mismatches(s, rays) == 0);
+  IGLOO_CHECK(count_cached_mismatches(s, shadows, emitters) == 0);
+} // end test_queries()
+
+
+void test_empty_scene()
+{
+  std::mt19937 rng(41);
+
+  scene s;
+  s.commit();
+
+  std::vector<ray> rays = random_rays(rng, 40, 1.f);
+  IGLOO_CHECK(count_mismatches(s, rays) == 0);
+  IGLOO_CHECK(s.emitters().size() == 0);
+  IGLOO_CHECK(emitter_table(s).empty());
+} // end test_empty_scene()
+
+
+// checks that an emitter_table's probabilities sum to one, that its selections follow them,
+// and that an emitter which seems to emit nothing may still be chosen
+void test_emitter_table()
+{
+  matte white(1, 1, 1);
+  light bright(color(4, 4, 4));
+  light dim(color(1, 1, 1));
+  light dark(color(0, 0, 0));
+
+  scene s;
+  s.add_surface(std::unique_ptr<surface>(new sphere(0.f, 0.f, 0.f, 1.f)), bright);
+  s.add_surface(std::unique_ptr<surface>(new sphere(2.f, 0.f, 0.f, 1.f)), dim);
+  s.add_surface(std::unique_ptr<surface>(new sphere(4.f, 0.f, 0.f, 1.f)), dark);
+  s.add_surface(std::unique_ptr<surface>(new sphere(6.f, 0.f, 0.f, 1.f)), white);
+  s.commit();
+
+  emitter_table table(s);
+  IGLOO_CHECK(table.size() == 3);
+
+  float sum = 0;
+  for(std::size_t position = 0; position < table.size(); ++position)
+  {
+    sum += table.probability(position);
+  }
+  IGLOO_CHECK(std::abs(sum - 1.f) < 1e-5f);
+
+  std::size_t dark_position = 2;
+  IGLOO_CHECK(table.probability(dark_position) > 0);
+  IGLOO_CHECK(table.probability(0) > table.probability(1));
+
+  std::mt19937 rng(43);
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+
+  const int n = 100000;
+  std::vector<int> counts(table.size());
+  std::size_t inconsistent = 0;
+  for(int i = 0; i < n; ++i)
+  {
+    emitter_table::selection chosen = table(u(rng));
+    ++counts[chosen.position];
+
+    inconsistent += chosen.probability != table.probability(chosen.position);
+  }
+  IGLOO_CHECK(inconsistent == 0);
+
+  for(std::size_t position = 0; position < table.size(); ++position)
+  {
+    IGLOO_CHECK(std::abs(float(counts[position]) / n - table.probability(position)) < 0.01f);
+  }
+} // end test_emitter_table()
+
+
+} // end namespace
+
+
+void test_scenes()
+{
+  test_queries();
+  test_empty_scene();
+  test_emitter_table();
+} // end test_scenes()
+
+
+} // end test
+} // end igloo
+
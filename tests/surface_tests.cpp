@@ -0,0 +1,223 @@
+#include "test.hpp"
+#include <igloo/surfaces/sphere.hpp>
+#include <igloo/surfaces/sphere_set.hpp>
+#include <igloo/surfaces/mesh.hpp>
+#include <igloo/surfaces/paged_mesh.hpp>
+#include <igloo/surfaces/instance.hpp>
+#include <igloo/geometry/transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace igloo
+{
+namespace test
+{
+namespace
+{
+
+
+bool same_hit(const optional<hit> &a, const optional<hit> &b, float tolerance)
+{
+  return bool(a) == bool(b) && (!a || std::abs(a->ray_parameter - b->ray_parameter) <= tolerance);
+} // end same_hit()
+
+
+// checks a sphere_set's queries against testing each sphere, and that its samples lie on its spheres
+void test_sphere_set()
+{
+  std::mt19937 rng(23);
+  std::uniform_real_distribution<float> u(-1.f, 1.f);
+
+  std::vector<point> centers;
+  std::vector<float> radii;
+  for(int i = 0; i < 500; ++i)
+  {
+    centers.push_back(point(u(rng), u(rng), u(rng)));
+    radii.push_back(i % 50 ? 0.02f + 0.02f * std::abs(u(rng)) : 0.f);
+  }
+
+  sphere_set spheres(centers, radii);
+
+  std::size_t mismatches = 0;
+  for(const ray& r : random_rays(rng, 2000, 1.2f))
+  {
+    bool is_hit = false;
+    float expected = 0;
+    for(std::size_t i = 0; i < centers.size(); ++i)
+    {
+      auto t = sphere::intersect_ray_parameter(r, centers[i], radii[i]);
+      if(t && (!is_hit || *t < expected))
+      {
+        is_hit = true;
+        expected = *t;
+      }
+    }
+
+    auto h = spheres.find_hit(r);
+    mismatches += bool(h) != is_hit || (h && std::abs(h->ray_parameter - expected) > 1e-5f);
+    mismatches += spheres.is_intersected(r) != is_hit;
+
+    auto element = spheres.find_occluder(r);
+    mismatches += bool(element) != is_hit || (element && !spheres.is_element_intersected(r, *element));
+  }
+  IGLOO_CHECK(mismatches == 0);
+
+  // sample_surface() consumes all 64 bits of its arguments
+  std::mt19937_64 bits(23);
+
+  std::size_t off_surface = 0;
+  for(int i = 0; i < 1000; ++i)
+  {
+    point p = spheres.sample_surface(bits(), bits()).point();
+
+    float nearest = std::abs(norm(p - centers[0]) - radii[0]);
+    for(std::size_t j = 1; j < centers.size(); ++j)
+    {
+      nearest = std::min(nearest, std::abs(norm(p - centers[j]) - radii[j]));
+    }
+
+    off_surface += nearest > 1e-4f;
+  }
+  IGLOO_CHECK(off_surface == 0);
+
+  IGLOO_CHECK(throws<std::logic_error>([]{ sphere_set empty({}, {}); }));
+  IGLOO_CHECK(throws<std::logic_error>([]{ sphere_set mismatched({point(0,0,0)}, {}); }));
+} // end test_sphere_set()
+
+
+// checks a paged_mesh with a small cache against a resident mesh of the same triangles
+void test_paged_mesh()
+{
+  char filename_template[] = "/tmp/igloo_tests_XXXXXX";
+  int fd = mkstemp(filename_template);
+  close(fd);
+  std::string filename = filename_template;
+
+  std::mt19937 rng(29);
+
+  std::vector<point> points;
+  std::vector<uint3> triangles;
+  random_triangles(rng, 4000, 1.f, points, triangles);
+
+  mesh resident(points, triangles);
+
+  paged_mesh::write(filename, points, {}, {}, triangles, 256);
+
+  {
+    // a budget of a few clusters, so that clusters are evicted and paged in again
+    paged_mesh paged(filename, 128 << 10);
+
+    IGLOO_CHECK(paged.size() == triangles.size());
+    IGLOO_CHECK(std::abs(paged.area() - resident.area()) <= 1e-3f * resident.area());
+
+    std::size_t mismatches = 0;
+    for(const ray& r : random_rays(rng, 300, 1.2f))
+    {
+      auto expected = resident.find_hit(r);
+      auto h = paged.find_hit(r);
+
+      mismatches += !same_hit(h, expected, 1e-5f);
+      if(h && expected)
+      {
+        mismatches += norm(paged.differential_geometry_at(r, *h).point() - resident.differential_geometry_at(r, *expected).point()) > 1e-4f;
+      }
+
+      mismatches += paged.is_intersected(r) != bool(expected);
+
+      auto element = paged.find_occluder(r);
+      mismatches += bool(element) != bool(expected) || (element && !paged.is_element_intersected(r, *element));
+    }
+    IGLOO_CHECK(mismatches == 0);
+    IGLOO_CHECK(paged.statistics().evictions > 0);
+
+    std::mt19937_64 bits(29);
+
+    std::size_t off_surface = 0;
+    for(int i = 0; i < 200; ++i)
+    {
+      differential_geometry dg = paged.sample_surface(bits(), bits());
+
+      // a short ray through the sample along its normal crosses the resident mesh
+      vector n(dg.normal().x, dg.normal().y, dg.normal().z);
+      off_surface += !resident.is_intersected(ray(dg.point() + 1e-3f * n, dg.point() - 1e-3f * n));
+    }
+    IGLOO_CHECK(off_surface == 0);
+  }
+
+  paged_mesh::write(filename, {}, {}, {}, {}, 256);
+
+  {
+    paged_mesh empty(filename, 64 << 10);
+
+    IGLOO_CHECK(empty.size() == 0);
+    IGLOO_CHECK(empty.area() == 0);
+    IGLOO_CHECK(!empty.find_hit(ray(point(0,0,0), vector(0,0,1))));
+    IGLOO_CHECK(throws<std::logic_error>([&]{ empty.sample_surface(1, 2); }));
+  }
+
+  std::remove(filename.c_str());
+} // end test_paged_mesh()
+
+
+// checks an instance against a mesh of its prototype's transformed points
+void test_instance()
+{
+  std::mt19937 rng(31);
+
+  std::vector<point> points;
+  std::vector<uint3> triangles;
+  random_triangles(rng, 2000, 1.f, points, triangles);
+
+  transform object_to_world = transform::translate(0.2f, -0.1f, 0.3f) * transform::rotate(30, 1, 1, 0) * transform::scale(1.5f, 1.5f, 1.5f);
+
+  instance inst(std::make_shared<mesh>(points, triangles), object_to_world);
+
+  std::vector<point> transformed;
+  for(const point& p : points)
+  {
+    transformed.push_back(object_to_world(p));
+  }
+
+  mesh expected_mesh(transformed, triangles);
+
+  std::size_t mismatches = 0;
+  for(const ray& r : random_rays(rng, 1000, 2.f))
+  {
+    auto expected = expected_mesh.find_hit(r);
+    auto h = inst.find_hit(r);
+
+    mismatches += !same_hit(h, expected, 1e-3f);
+    if(h && expected)
+    {
+      mismatches += norm(inst.differential_geometry_at(r, *h).point() - expected_mesh.differential_geometry_at(r, *expected).point()) > 1e-2f;
+    }
+
+    mismatches += inst.is_intersected(r) != bool(expected);
+
+    auto element = inst.find_occluder(r);
+    mismatches += bool(element) != bool(expected) || (element && !inst.is_element_intersected(r, *element));
+  }
+  IGLOO_CHECK(mismatches == 0);
+  IGLOO_CHECK(std::abs(inst.area() - expected_mesh.area()) <= 1e-3f * expected_mesh.area());
+} // end test_instance()
+
+
+} // end namespace
+
+
+void test_surfaces()
+{
+  test_sphere_set();
+  test_paged_mesh();
+  test_instance();
+} // end test_surfaces()
+
+
+} // end test
+} // end igloo
+
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <igloo/geometry/point.hpp>
+#include <igloo/geometry/ray.hpp>
+#include <igloo/geometry/triangle_mesh.hpp>
+#include <igloo/utility/optional.hpp>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace igloo
+{
+namespace test
+{
+
+
+// counts a failed check and reports where it failed
+#define IGLOO_CHECK(condition) ::igloo::test::check((condition), #condition, __FILE__, __LINE__)
+
+
+inline int &num_failures()
+{
+  static int result = 0;
+  return result;
+} // end num_failures()
+
+
+inline void check(bool condition, const char *expression, const char *file, int line)
+{
+  if(!condition)
+  {
+    ++num_failures();
+    std::cerr << file << ":" << line << ": check failed: " << expression << std::endl;
+  }
+} // end check()
+
+
+// returns true if f() throws an Exception
+template<class Exception, class Function>
+inline bool throws(Function f)
+{
+  try
+  {
+    f();
+  }
+  catch(const Exception&)
+  {
+    return true;
+  }
+
+  return false;
+} // end throws()
+
+
+// appends n small triangles scattered through the cube [-extent, extent]^3, every tenth of them long and thin
+inline void random_triangles(std::mt19937 &rng, std::size_t n, float extent, std::vector<point> &points, std::vector<uint3> &triangles)
+{
+  std::uniform_real_distribution<float> u(-1.f, 1.f);
+
+  for(std::size_t i = 0; i < n; ++i)
+  {
+    point c(extent * u(rng), extent * u(rng), extent * u(rng));
+    float size = (i % 10 == 0) ? 0.5f * extent : 0.03f * extent;
+
+    unsigned int first = static_cast<unsigned int>(points.size());
+    for(int k = 0; k < 3; ++k)
+    {
+      points.push_back(c + size * vector(u(rng), u(rng), u(rng)));
+    }
+
+    triangles.push_back(uint3(first, first + 1, first + 2));
+  }
+} // end random_triangles()
+
+
+// returns n rays from points in the cube [-extent, extent]^3 in random directions, half of them of bounded length
+inline std::vector<ray> random_rays(std::mt19937 &rng, std::size_t n, float extent)
+{
+  std::uniform_real_distribution<float> u(-1.f, 1.f);
+
+  std::vector<ray> result;
+  for(std::size_t i = 0; i < n; ++i)
+  {
+    point o(extent * u(rng), extent * u(rng), extent * u(rng));
+    vector d(u(rng), u(rng), u(rng));
+
+    result.push_back(i % 2 ? ray(o, d) : ray(o, o + extent * d));
+  }
+
+  return result;
+} // end random_rays()
+
+
+// returns the ray parameter of r's nearest intersection with m's triangles by testing each of them
+inline optional<float> brute_force_ray_parameter(const triangle_mesh &m, const ray &r)
+{
+  optional<float> result;
+
+  for(const auto& tri : m.triangles())
+  {
+    auto x = m.intersect(r, tri);
+    if(x && (!result || x->first < *result))
+    {
+      result = x->first;
+    }
+  }
+
+  return result;
+} // end brute_force_ray_parameter()
+
+
+void test_hierarchies();
+void test_surfaces();
+void test_scenes();
+void test_sampling();
+
+
+} // end test
+} // end igloo
+